@@ -223,7 +223,13 @@ CREATE TABLE IF NOT EXISTS [.classes] (
   /*
   Pre-computed vtypes for mapped columns
    */
-  vtypes        INTEGER NOT NULL             DEFAULT 0
+  vtypes        INTEGER NOT NULL             DEFAULT 0,
+
+  /*
+  Version of class definition. Incremented by triggers on every change of class row or its properties
+  in [.class_props], so that cached class definitions can be validated without reading Data
+   */
+  [Version]     INTEGER NOT NULL             DEFAULT 0
 );
 
 CREATE UNIQUE INDEX IF NOT EXISTS [idxClasses_byNameID]
@@ -251,7 +257,7 @@ BEGIN
 END;
 
 CREATE TRIGGER IF NOT EXISTS [trigClassesAfterUpdate]
-  AFTER UPDATE
+  AFTER UPDATE OF ClassID, NameID, SystemClass, ctloMask, Data, VirtualTable
   ON [.classes]
   FOR EACH ROW
 BEGIN
@@ -290,6 +296,14 @@ BEGIN
     WHERE [OldValue] <> [Value] OR (nullif([OldKey], [KEY])) IS NOT NULL;
 END;
 
+CREATE TRIGGER IF NOT EXISTS [trigClassesVersionAfterUpdate]
+  AFTER UPDATE OF NameID, SystemClass, ctloMask, Data, VirtualTable, ColMapActive, Deleted, vtypes
+  ON [.classes]
+  FOR EACH ROW
+BEGIN
+  UPDATE [.classes] SET [Version] = [Version] + 1 WHERE ClassID = new.ClassID;
+END;
+
 CREATE TRIGGER IF NOT EXISTS [trigClassesAfterDelete]
   AFTER DELETE
   ON [.classes]
@@ -395,7 +409,18 @@ CREATE TABLE IF NOT EXISTS [.class_props]
   /*
   How many times this property was referenced in search criteria. Candidate for indexing
    */
-  SearchHitCount INTEGER NOT NULL                           DEFAULT 0
+  SearchHitCount INTEGER NOT NULL                           DEFAULT 0,
+
+  /*
+  Copies of property name and attributes from class definition JSON ([.classes].Data).
+  Maintained by PropertyDef:saveToDB, so that property lookups do not need to parse class definitions
+   */
+  [Name]         TEXT    NULL,
+  [Type]         TEXT    NULL,
+  MinOccurrences INTEGER NOT NULL                           DEFAULT 0,
+  MaxOccurrences INTEGER NOT NULL                           DEFAULT 1,
+  MaxLength      INTEGER NULL,
+  IndexType      TEXT    NULL
 );
 
 CREATE UNIQUE INDEX IF NOT EXISTS [idxClassPropertiesByClassAndName]
@@ -408,6 +433,32 @@ CREATE UNIQUE INDEX IF NOT EXISTS [idxClassPropertiesByMap]
   (ClassID, ColMap)
   WHERE [ColMap] IS NOT NULL AND Deleted = 0;
 
+-- Changes of properties (except of statistics) increment version of their class
+CREATE TRIGGER IF NOT EXISTS [trigClassPropsVersionAfterInsert]
+  AFTER INSERT
+  ON [.class_props]
+  FOR EACH ROW
+BEGIN
+  UPDATE [.classes] SET [Version] = [Version] + 1 WHERE ClassID = new.ClassID;
+END;
+
+CREATE TRIGGER IF NOT EXISTS [trigClassPropsVersionAfterUpdate]
+  AFTER UPDATE OF ClassID, NameID, ctlv, ctlvPlan, ColMap, Deleted, [Name], [Type], MinOccurrences, MaxOccurrences,
+  MaxLength, IndexType
+  ON [.class_props]
+  FOR EACH ROW
+BEGIN
+  UPDATE [.classes] SET [Version] = [Version] + 1 WHERE ClassID IN (old.ClassID, new.ClassID);
+END;
+
+CREATE TRIGGER IF NOT EXISTS [trigClassPropsVersionAfterDelete]
+  AFTER DELETE
+  ON [.class_props]
+  FOR EACH ROW
+BEGIN
+  UPDATE [.classes] SET [Version] = [Version] + 1 WHERE ClassID = old.ClassID;
+END;
+
 ------------------------------------------------------------------------------------------
 -- [flexi_prop] view
 ------------------------------------------------------------------------------------------
@@ -417,21 +468,21 @@ CREATE VIEW IF NOT EXISTS [flexi_prop] AS
     cp.ClassID                                                         AS ClassID,
     cp.Class                                                           AS Class,
     cp.[NameID]                                                        AS NameID,
-    (SELECT n.[Value]
-     FROM [.sym_names] n
-     WHERE n.ID = cp.NameID
-     LIMIT 1)                                                          AS Property,
+    coalesce(cp.[Name], (SELECT n.[Value]
+                         FROM [.sym_names] n
+                         WHERE n.ID = cp.NameID
+                         LIMIT 1))                                     AS Property,
     cp.ctlv                                                            AS ctlv,
     cp.ctlvPlan                                                        AS ctlvPlan,
     cp.Definition                                                      AS Definition,
     cp.Deleted                                                         AS Deleted,
     cp.SearchHitCount                                                  AS SearchHitCount,
     cp.NonNullCount                                                    AS NonNullCount,
-    (json_extract(cp.Definition, '$.rules.type'))                      as Type,
-    coalesce(json_extract(cp.Definition, '$.rules.minOccurrences'), 0) as minOccurrences,
-    coalesce(json_extract(cp.Definition, '$.rules.maxOccurrences'), 1) as maxOccurrences,
-    (json_extract(cp.Definition, '$.rules.maxLength'))                 as maxLength,
-    (json_extract(cp.Definition, '$.index'))                           as IndexType
+    cp.[Type]                                                          as Type,
+    cp.MinOccurrences                                                  as minOccurrences,
+    cp.MaxOccurrences                                                  as maxOccurrences,
+    cp.MaxLength                                                       as maxLength,
+    cp.IndexType                                                       as IndexType
   FROM
     (select
        cp.*,
@@ -451,12 +502,12 @@ BEGIN
   --  TODO ??? SELECT flexi('create property', new.Class, new.Property, new.Definition);
 
   INSERT OR IGNORE INTO [.sym_names] ([Value]) VALUES (new.Property);
-  INSERT INTO [.class_props] (NameID, ClassID, ctlv, ctlvPlan)
+  INSERT INTO [.class_props] (NameID, ClassID, ctlv, ctlvPlan, [Name])
   VALUES (coalesce(new.NameID, (SELECT n.ID
                                 FROM [.sym_names] n
                                 WHERE n.[Value] = new.Property
                                 LIMIT 1)),
-          new.ClassID, new.ctlv, new.ctlvPlan);
+          new.ClassID, new.ctlv, new.ctlvPlan, new.Property);
 
   -- TODO Fix unresolved references??? (needed?)
 END;
@@ -477,7 +528,7 @@ BEGIN
                 FROM [.sym_names]
                 WHERE Value = new.Property
                 LIMIT 1),
-    ClassID  = new.ClassID, ctlv = new.ctlv, ctlvPlan = new.ctlvPlan
+    ClassID  = new.ClassID, ctlv = new.ctlv, ctlvPlan = new.ctlvPlan, [Name] = new.Property
   WHERE ID = old.PropertyID;
 END;
 
@@ -891,12 +942,16 @@ CREATE TABLE IF NOT EXISTS [.ref-values] (
     bit 8 - invalid value
     bit 9 - deleted
     bit 10 - no track changes
+    bit 11 - formula
+    bit 12 - compressed value
+    bit 13 - value is kept in [.value_store], Value is SHA3-256 hash
   */
   [ctlv]       INTEGER NOT NULL DEFAULT 0,
+
   /*
-Optional data for cell (font/color/format etc. customization)
-*/
-  [MetaData]   JSON1   NULL,
+  Optional cell data (font/color/format etc. customization) is kept in [.cell_metadata],
+  so that value rows stay narrow
+  */
 
   CONSTRAINT [] PRIMARY KEY ([ObjectID], [PropertyID], [PropIndex])
 )
@@ -928,6 +983,173 @@ BEGIN
                             WHERE [Value] = ObjectID AND ctlv IN (3)) = 0;
 END;
 
+------------------------------------------------------------------------------------------
+-- [.cell_metadata]
+-- Optional data for [.ref-values] cells (font/color/format etc. customization).
+-- Loaded on demand only (see ReadOnlyDBOV:loadCellMetaData). Rows of deleted objects are removed by triggers,
+-- other orphaned rows (e.g. after property was dropped) are removed by flexi('vacuum')
+------------------------------------------------------------------------------------------
+CREATE TABLE IF NOT EXISTS [.cell_metadata] (
+  [ObjectID]   INTEGER NOT NULL,
+  [PropertyID] INTEGER NOT NULL,
+  [PropIndex]  INTEGER NOT NULL,
+  [MetaData]   JSON1   NOT NULL,
+
+  CONSTRAINT [] PRIMARY KEY ([ObjectID], [PropertyID], [PropIndex])
+)
+  WITHOUT ROWID;
+
+CREATE TRIGGER IF NOT EXISTS [trigObjectsCellMetaDataAfterDelete]
+  AFTER DELETE
+  ON [.objects]
+  FOR EACH ROW
+BEGIN
+  DELETE FROM [.cell_metadata]
+  WHERE ObjectID = old.ObjectID;
+END;
+
+CREATE TRIGGER IF NOT EXISTS [trigObjectsCellMetaDataAfterUpdateOfObjectID]
+  AFTER UPDATE OF [ObjectID]
+  ON [.objects]
+  FOR EACH ROW
+  WHEN new.[ObjectID] <> old.ObjectID
+BEGIN
+  UPDATE [.cell_metadata]
+  SET ObjectID = new.[ObjectID]
+  WHERE ObjectID = old.ObjectID;
+END;
+
+------------------------------------------------------------------------------------------
+-- [.value_store]
+-- Content addressed storage of large text and blob values, which are shared by many cells
+-- (properties with 'dedup' attribute). [.ref-values] row with ctlv flag 0x2000 (8192) holds
+-- SHA3-256 hash of value instead of value itself. RefCount is maintained by triggers on [.ref-values].
+-- Unreferenced values are removed by flexi('vacuum')
+------------------------------------------------------------------------------------------
+CREATE TABLE IF NOT EXISTS [.value_store] (
+  [ID]       INTEGER NOT NULL PRIMARY KEY,
+  [Hash]     BLOB    NOT NULL,
+  [Value]            NOT NULL,
+  [RefCount] INTEGER NOT NULL DEFAULT 0
+);
+
+CREATE UNIQUE INDEX IF NOT EXISTS [idxValueStoreByHash]
+  ON [.value_store] ([Hash]);
+
+CREATE INDEX IF NOT EXISTS [idxValuesByStoredHash]
+  ON [.ref-values] ([Value])
+  WHERE [ctlv] & 8192;
+
+CREATE TRIGGER IF NOT EXISTS [trigValuesStoredAfterInsert]
+  AFTER INSERT
+  ON [.ref-values]
+  FOR EACH ROW
+  WHEN new.ctlv & 8192
+BEGIN
+  UPDATE [.value_store]
+  SET RefCount = RefCount + 1
+  WHERE Hash = new.[Value];
+END;
+
+CREATE TRIGGER IF NOT EXISTS [trigValuesStoredAfterUpdate]
+  AFTER UPDATE OF [Value], [ctlv]
+  ON [.ref-values]
+  FOR EACH ROW
+  WHEN (old.ctlv | new.ctlv) & 8192
+BEGIN
+  UPDATE [.value_store]
+  SET RefCount = RefCount - 1
+  WHERE old.ctlv & 8192 AND Hash = old.[Value];
+
+  UPDATE [.value_store]
+  SET RefCount = RefCount + 1
+  WHERE new.ctlv & 8192 AND Hash = new.[Value];
+END;
+
+CREATE TRIGGER IF NOT EXISTS [trigValuesStoredAfterDelete]
+  AFTER DELETE
+  ON [.ref-values]
+  FOR EACH ROW
+  WHEN old.ctlv & 8192
+BEGIN
+  UPDATE [.value_store]
+  SET RefCount = RefCount - 1
+  WHERE Hash = old.[Value];
+END;
+
+------------------------------------------------------------------------------------------
+-- [.content_hashes]
+-- SHA3-256 hashes of object payloads, as saved by flexi('import data') in upsert mode.
+-- Used to detect unchanged objects without loading them. Hash is removed by triggers on any change
+-- of object or its values, so objects modified by other means are treated as changed on next upsert.
+-- Triggers run their DELETE only for objects which have saved hash
+------------------------------------------------------------------------------------------
+CREATE TABLE IF NOT EXISTS [.content_hashes] (
+  [ObjectID] INTEGER NOT NULL PRIMARY KEY,
+  [Hash]     BLOB    NOT NULL
+)
+  WITHOUT ROWID;
+
+CREATE TRIGGER IF NOT EXISTS [trigValuesContentHashAfterInsert]
+  AFTER INSERT
+  ON [.ref-values]
+  FOR EACH ROW
+  WHEN EXISTS(SELECT 1
+              FROM [.content_hashes]
+              WHERE ObjectID = new.ObjectID)
+BEGIN
+  DELETE FROM [.content_hashes]
+  WHERE ObjectID = new.ObjectID;
+END;
+
+CREATE TRIGGER IF NOT EXISTS [trigValuesContentHashAfterUpdate]
+  AFTER UPDATE
+  ON [.ref-values]
+  FOR EACH ROW
+  WHEN EXISTS(SELECT 1
+              FROM [.content_hashes]
+              WHERE ObjectID IN (old.ObjectID, new.ObjectID))
+BEGIN
+  DELETE FROM [.content_hashes]
+  WHERE ObjectID IN (old.ObjectID, new.ObjectID);
+END;
+
+CREATE TRIGGER IF NOT EXISTS [trigValuesContentHashAfterDelete]
+  AFTER DELETE
+  ON [.ref-values]
+  FOR EACH ROW
+  WHEN EXISTS(SELECT 1
+              FROM [.content_hashes]
+              WHERE ObjectID = old.ObjectID)
+BEGIN
+  DELETE FROM [.content_hashes]
+  WHERE ObjectID = old.ObjectID;
+END;
+
+CREATE TRIGGER IF NOT EXISTS [trigObjectsContentHashAfterUpdate]
+  AFTER UPDATE
+  ON [.objects]
+  FOR EACH ROW
+  WHEN EXISTS(SELECT 1
+              FROM [.content_hashes]
+              WHERE ObjectID IN (old.ObjectID, new.ObjectID))
+BEGIN
+  DELETE FROM [.content_hashes]
+  WHERE ObjectID IN (old.ObjectID, new.ObjectID);
+END;
+
+CREATE TRIGGER IF NOT EXISTS [trigObjectsContentHashAfterDelete]
+  AFTER DELETE
+  ON [.objects]
+  FOR EACH ROW
+  WHEN EXISTS(SELECT 1
+              FROM [.content_hashes]
+              WHERE ObjectID = old.ObjectID)
+BEGIN
+  DELETE FROM [.content_hashes]
+  WHERE ObjectID = old.ObjectID;
+END;
+
 ------------------------------------------------------------------------------------------
 -- .multi_key2, .multi_key3, .multi_key4
 -- Clustered (without rowid), single-index tables used as external index for .ref-values
@@ -1033,4 +1255,29 @@ create index if not exists idxCalcDepsByCalcProp on [.prop-deps] (CalcPropID, Ch
 -- TODO triggers
 -- TODO Finalize design and implementation
 
+------------------------------------------------------------------------------------------
+-- [.object_access]
+------------------------------------------------------------------------------------------
+/* Row level access rules in indexable form.
+Source of truth is still [.objects].MetaData.accessRules. This table keeps the same rules, compiled to
+bit masks of CRUDE operations (C = 1, R = 2, U = 4, D = 8, E = 16), so that they can be applied
+as SQL predicate when querying [.objects], without loading and decoding MetaData.
+Rows exist only for objects with ctlo bit 34 (has accessRules) set.
+
+Subject is either 'u:<UserID>' or 'r:<Role>' ('r:*' - applicable to all users)
+ */
+CREATE TABLE IF NOT EXISTS [.object_access] (
+  [ObjectID] INTEGER NOT NULL CONSTRAINT [fkObjectAccessToObjects]
+  REFERENCES [.objects] ([ObjectID])
+    ON DELETE CASCADE
+    ON UPDATE CASCADE,
+  [Subject]  TEXT    NOT NULL COLLATE NOCASE,
+  [Allowed]  INTEGER NOT NULL DEFAULT 0,
+  [Denied]   INTEGER NOT NULL DEFAULT 0,
+  CONSTRAINT [pkObjectAccess] PRIMARY KEY ([ObjectID], [Subject])
+) WITHOUT ROWID;
+
+CREATE INDEX IF NOT EXISTS [idxObjectAccessBySubject]
+  ON [.object_access] ([Subject], [ObjectID]);
+
 -- END --
\ No newline at end of file
@@ -32,6 +32,36 @@ int sqlite3_extension_init(
     {
         return result;
     }
+    result = json_select_func_init(db, pzErrMsg, pApi);
+    if (result != SQLITE_OK)
+    {
+        return result;
+    }
+    result = idset_func_init(db, pzErrMsg, pApi);
+    if (result != SQLITE_OK)
+    {
+        return result;
+    }
+    result = sym_names_func_init(db, pzErrMsg, pApi);
+    if (result != SQLITE_OK)
+    {
+        return result;
+    }
+    result = json_cells_func_init(db, pzErrMsg, pApi);
+    if (result != SQLITE_OK)
+    {
+        return result;
+    }
+    result = compress_func_init(db, pzErrMsg, pApi);
+    if (result != SQLITE_OK)
+    {
+        return result;
+    }
+    result = shathree_func_init(db, pzErrMsg, pApi);
+    if (result != SQLITE_OK)
+    {
+        return result;
+    }
 
     // TODO register virtual table modules
     // TODO pass flexilite lua context
@@ -63,6 +63,42 @@ int memstat_func_init(
         const sqlite3_api_routines *pApi
 );
 
+int json_select_func_init(
+        sqlite3 *db,
+        char **pzErrMsg,
+        const sqlite3_api_routines *pApi
+);
+
+int idset_func_init(
+        sqlite3 *db,
+        char **pzErrMsg,
+        const sqlite3_api_routines *pApi
+);
+
+int sym_names_func_init(
+        sqlite3 *db,
+        char **pzErrMsg,
+        const sqlite3_api_routines *pApi
+);
+
+int json_cells_func_init(
+        sqlite3 *db,
+        char **pzErrMsg,
+        const sqlite3_api_routines *pApi
+);
+
+int compress_func_init(
+        sqlite3 *db,
+        char **pzErrMsg,
+        const sqlite3_api_routines *pApi
+);
+
+int shathree_func_init(
+        sqlite3 *db,
+        char **pzErrMsg,
+        const sqlite3_api_routines *pApi
+);
+
 int flexi_data_init(
         sqlite3 *db,
         char **pzErrMsg,
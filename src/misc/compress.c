@@ -17,6 +17,14 @@
 SQLITE_EXTENSION_INIT3
 #include <zlib.h>
 
+/*
+** Max length of uncompressed value. Corrupted or forged size prefix must not
+** make uncompress() allocate more than SQLite could return anyway
+*/
+#ifndef SQLITE_MAX_LENGTH
+# define SQLITE_MAX_LENGTH 1000000000
+#endif
+
 /*
 ** Implementation of the "compress(X)" SQL function.  The input X is
 ** compressed using zLib and the output is returned.
@@ -60,45 +68,96 @@ static void compressFunc(
 }
 
 /*
-** Implementation of the "uncompress(X)" SQL function.  The argument X
-** is a blob which was obtained from compress(Y).  The output will be
-** the value Y.
+** Uncompresses buffer obtained from compress(Y). Returns buffer allocated
+** by sqlite3_malloc64() and sets *pnOut to its length, or returns NULL on error,
+** including size prefix above SQLITE_MAX_LENGTH.
 */
-static void uncompressFunc(
-  sqlite3_context *context,
-  int argc,
-  sqlite3_value **argv
+static unsigned char *uncompressBuf(
+  const unsigned char *pIn,
+  unsigned int nIn,
+  unsigned long int *pnOut
 ){
-  const unsigned char *pIn;
   unsigned char *pOut;
-  unsigned int nIn;
   unsigned long int nOut;
   int rc;
   int i;
 
-  pIn = sqlite3_value_blob(argv[0]);
-  nIn = sqlite3_value_bytes(argv[0]);
   nOut = 0;
   for(i=0; i<nIn && i<5; i++){
     nOut = (nOut<<7) | (pIn[i]&0x7f);
     if( (pIn[i]&0x80)!=0 ){ i++; break; }
   }
-  pOut = sqlite3_malloc( nOut+1 );
+  if( nOut>SQLITE_MAX_LENGTH ) return 0;
+  pOut = sqlite3_malloc64( (sqlite3_uint64)nOut+1 );
+  if( pOut==0 ) return 0;
   rc = uncompress(pOut, &nOut, &pIn[i], nIn-i);
-  if( rc==Z_OK ){
-    sqlite3_result_blob(context, pOut, nOut, sqlite3_free);
-  }else{
+  if( rc!=Z_OK ){
     sqlite3_free(pOut);
+    return 0;
+  }
+  *pnOut = nOut;
+  return pOut;
+}
+
+/*
+** Implementation of the "uncompress(X)" SQL function.  The argument X
+** is a blob which was obtained from compress(Y).  The output will be
+** the value Y.
+*/
+static void uncompressFunc(
+  sqlite3_context *context,
+  int argc,
+  sqlite3_value **argv
+){
+  unsigned char *pOut;
+  unsigned long int nOut;
+
+  pOut = uncompressBuf(sqlite3_value_blob(argv[0]), sqlite3_value_bytes(argv[0]), &nOut);
+  if( pOut ){
+    sqlite3_result_blob(context, pOut, nOut, sqlite3_free);
   }
 }
 
+/*
+** Flag in [.ref-values].ctlv which marks compressed value
+** (see Constants.CTLV_FLAGS.COMPRESSED in Lua code)
+*/
+#define CTLV_COMPRESSED 0x1000
 
-#ifdef _WIN32
-__declspec(dllexport)
-#endif
-int sqlite3_compress_init(
-  sqlite3 *db, 
-  char **pzErrMsg, 
+/*
+** Implementation of the "flexi_unpack(Value, ctlv [, asBlob])" SQL function.
+** Used by Flexilite to access [.ref-values].Value in SQL expressions (filters,
+** flexi_select, full text index rebuild). If ctlv has compressed flag, Value is
+** uncompressed and returned as TEXT (or as BLOB if asBlob is non zero).
+** Otherwise, Value is returned as is.
+*/
+static void unpackFunc(
+  sqlite3_context *context,
+  int argc,
+  sqlite3_value **argv
+){
+  unsigned char *pOut;
+  unsigned long int nOut;
+
+  if( sqlite3_value_type(argv[0])==SQLITE_NULL
+   || (sqlite3_value_int64(argv[1]) & CTLV_COMPRESSED)==0 ){
+    sqlite3_result_value(context, argv[0]);
+    return;
+  }
+
+  pOut = uncompressBuf(sqlite3_value_blob(argv[0]), sqlite3_value_bytes(argv[0]), &nOut);
+  if( pOut==0 ){
+    sqlite3_result_error(context, "flexi_unpack: invalid compressed value", -1);
+  }else if( argc>2 && sqlite3_value_int(argv[2])!=0 ){
+    sqlite3_result_blob(context, pOut, nOut, sqlite3_free);
+  }else{
+    sqlite3_result_text(context, (const char *)pOut, nOut, sqlite3_free);
+  }
+}
+
+int compress_func_init(
+  sqlite3 *db,
+  char **pzErrMsg,
   const sqlite3_api_routines *pApi
 ){
   int rc = SQLITE_OK;
@@ -110,5 +169,13 @@ int sqlite3_compress_init(
     rc = sqlite3_create_function(db, "uncompress", 1, SQLITE_UTF8, 0,
                                  uncompressFunc, 0, 0);
   }
+  if( rc==SQLITE_OK ){
+    rc = sqlite3_create_function(db, "flexi_unpack", 2, SQLITE_UTF8, 0,
+                                 unpackFunc, 0, 0);
+  }
+  if( rc==SQLITE_OK ){
+    rc = sqlite3_create_function(db, "flexi_unpack", 3, SQLITE_UTF8, 0,
+                                 unpackFunc, 0, 0);
+  }
   return rc;
 }
@@ -0,0 +1,952 @@
+/*
+ * Compressed sets of object IDs, used by query planner to combine results of index lookups
+ * for 'or' and 'not' filters without building temp b-trees.
+ *
+ * Set is stored as BLOB, with roaring bitmap style layout: IDs are split by high bits (ID >> 16) into containers.
+ * Each container keeps low 16 bits either as sorted array of uint16 (up to IDSET_ARRAY_MAX items)
+ * or as 65536 bit bitmap. So both sparse and dense ranges of IDs take little memory, and set operations
+ * are done container by container, mostly as word-wide bit operations.
+ *
+ * BLOB layout (host byte order, sets are never persisted):
+ * for every container, sorted by key:
+ *  key (8 bytes), n - number of items (4 bytes),
+ *  n * 2 bytes of sorted values if n <= IDSET_ARRAY_MAX, or IDSET_BITMAP_WORDS * 8 bytes otherwise
+ *
+ * SQL API:
+ * flexi_idset(ObjectID) - aggregate, builds set. Returns empty set (not NULL) for no rows
+ * flexi_idset_union(set1, set2, ...)
+ * flexi_idset_intersect(set1, set2, ...)
+ * flexi_idset_except(set1, set2) - items of set1 which are not in set2
+ * flexi_idset_count(set)
+ * flexi_idset_each(set) - table valued function, returns IDs in ascending order in 'value' column
+ *
+ * Example:
+ * select ObjectID from [.objects] where ObjectID in (select value from flexi_idset_each(flexi_idset_union(
+ *      (select flexi_idset(ObjectID) from [.ref-values] where PropertyID = 10 and [Value] = 1),
+ *      (select flexi_idset(ObjectID) from [.ref-values] where PropertyID = 11 and [Value] > 100))));
+ */
+
+#include <string.h>
+#include <stdint.h>
+#include "../project_defs.h"
+
+SQLITE_EXTENSION_INIT3
+
+#define IDSET_ARRAY_MAX 4096
+#define IDSET_BITMAP_WORDS 1024
+
+/*
+ * Container for IDs with the same high bits
+ */
+typedef struct IdSetContainer_t
+{
+    sqlite3_int64 key;
+
+    // Number of items
+    int n;
+
+    // Sorted low 16 bits of IDs. Used when n <= IDSET_ARRAY_MAX
+    unsigned short *aValues;
+
+    // Allocated size of aValues
+    int nAlloc;
+
+    // Bitmap of low 16 bits of IDs. Used when n > IDSET_ARRAY_MAX
+    sqlite3_uint64 *aBits;
+} IdSetContainer_t;
+
+typedef struct IdSet_t
+{
+    IdSetContainer_t *aItems;
+    int nCount;
+    int nAlloc;
+} IdSet_t;
+
+static int _popcount(sqlite3_uint64 w)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_popcountll(w);
+#else
+    int result = 0;
+    while (w)
+    {
+        w &= w - 1;
+        result++;
+    }
+    return result;
+#endif
+}
+
+static int _ctz(sqlite3_uint64 w)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(w);
+#else
+    int result = 0;
+    while ((w & 1) == 0)
+    {
+        w >>= 1;
+        result++;
+    }
+    return result;
+#endif
+}
+
+static void _containerClear(IdSetContainer_t *c)
+{
+    sqlite3_free(c->aValues);
+    sqlite3_free(c->aBits);
+    memset(c, 0, sizeof(*c));
+}
+
+static void IdSet_clear(IdSet_t *pSet)
+{
+    for (int ii = 0; ii < pSet->nCount; ii++)
+        _containerClear(&pSet->aItems[ii]);
+    sqlite3_free(pSet->aItems);
+    memset(pSet, 0, sizeof(*pSet));
+}
+
+static sqlite3_int64 IdSet_count(IdSet_t *pSet)
+{
+    sqlite3_int64 result = 0;
+    for (int ii = 0; ii < pSet->nCount; ii++)
+        result += pSet->aItems[ii].n;
+    return result;
+}
+
+/*
+ * Appends new empty container. Keys must be appended in ascending order
+ */
+static IdSetContainer_t *_appendContainer(IdSet_t *pSet, sqlite3_int64 key)
+{
+    if (pSet->nCount == pSet->nAlloc)
+    {
+        int nNew = pSet->nAlloc == 0 ? 8 : pSet->nAlloc * 2;
+        IdSetContainer_t *aNew = sqlite3_realloc(pSet->aItems, nNew * sizeof(IdSetContainer_t));
+        if (aNew == NULL)
+            return NULL;
+        pSet->aItems = aNew;
+        pSet->nAlloc = nNew;
+    }
+
+    IdSetContainer_t *c = &pSet->aItems[pSet->nCount++];
+    memset(c, 0, sizeof(*c));
+    c->key = key;
+    return c;
+}
+
+/*
+ * Returns index of container with the given key, or (-insertPosition - 1) if not found
+ */
+static int _findContainer(IdSet_t *pSet, sqlite3_int64 key)
+{
+    int lo = 0, hi = pSet->nCount - 1;
+
+    // Fast path for IDs coming in ascending order
+    if (hi >= 0 && pSet->aItems[hi].key == key)
+        return hi;
+
+    while (lo <= hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (pSet->aItems[mid].key < key)
+            lo = mid + 1;
+        else
+            if (pSet->aItems[mid].key > key)
+                hi = mid - 1;
+            else
+                return mid;
+    }
+    return -lo - 1;
+}
+
+/*
+ * Returns position of value in sorted array, or (-insertPosition - 1) if not found
+ */
+static int _findValue(const unsigned short *aValues, int n, unsigned short v)
+{
+    int lo = 0, hi = n - 1;
+    if (hi >= 0 && aValues[hi] < v)
+        return -n - 1;
+
+    while (lo <= hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (aValues[mid] < v)
+            lo = mid + 1;
+        else
+            if (aValues[mid] > v)
+                hi = mid - 1;
+            else
+                return mid;
+    }
+    return -lo - 1;
+}
+
+static int _containerHas(const IdSetContainer_t *c, unsigned short v)
+{
+    if (c->aBits != NULL)
+        return (c->aBits[v >> 6] & ((sqlite3_uint64) 1 << (v & 63))) != 0;
+    return _findValue(c->aValues, c->n, v) >= 0;
+}
+
+/*
+ * Fills aBits with container items
+ */
+static void _containerToBits(const IdSetContainer_t *c, sqlite3_uint64 *aBits)
+{
+    if (c->aBits != NULL)
+    {
+        memcpy(aBits, c->aBits, IDSET_BITMAP_WORDS * sizeof(sqlite3_uint64));
+        return;
+    }
+
+    memset(aBits, 0, IDSET_BITMAP_WORDS * sizeof(sqlite3_uint64));
+    for (int ii = 0; ii < c->n; ii++)
+        aBits[c->aValues[ii] >> 6] |= (sqlite3_uint64) 1 << (c->aValues[ii] & 63);
+}
+
+/*
+ * Sets container content from bitmap. Takes ownership of aBits.
+ * Small sets are converted to array
+ */
+static int _containerFromBits(IdSetContainer_t *c, sqlite3_uint64 *aBits)
+{
+    int n = 0;
+    for (int ii = 0; ii < IDSET_BITMAP_WORDS; ii++)
+        n += _popcount(aBits[ii]);
+
+    c->n = n;
+    if (n > IDSET_ARRAY_MAX)
+    {
+        c->aBits = aBits;
+        return SQLITE_OK;
+    }
+
+    if (n > 0)
+    {
+        c->aValues = sqlite3_malloc(n * sizeof(unsigned short));
+        if (c->aValues == NULL)
+        {
+            sqlite3_free(aBits);
+            return SQLITE_NOMEM;
+        }
+        c->nAlloc = n;
+
+        int kk = 0;
+        for (int ii = 0; ii < IDSET_BITMAP_WORDS; ii++)
+        {
+            sqlite3_uint64 w = aBits[ii];
+            while (w)
+            {
+                int bit = _ctz(w);
+                c->aValues[kk++] = (unsigned short) ((ii << 6) + bit);
+                w &= w - 1;
+            }
+        }
+    }
+    sqlite3_free(aBits);
+    return SQLITE_OK;
+}
+
+/*
+ * Adds ID to set. IDs may come in any order
+ */
+static int IdSet_add(IdSet_t *pSet, sqlite3_int64 id)
+{
+    sqlite3_int64 key = id >> 16;
+    unsigned short v = (unsigned short) (id & 0xFFFF);
+
+    int idx = _findContainer(pSet, key);
+    IdSetContainer_t *c;
+    if (idx < 0)
+    {
+        idx = -idx - 1;
+        if (_appendContainer(pSet, key) == NULL)
+            return SQLITE_NOMEM;
+        if (idx < pSet->nCount - 1)
+        {
+            IdSetContainer_t tmp = pSet->aItems[pSet->nCount - 1];
+            memmove(&pSet->aItems[idx + 1], &pSet->aItems[idx],
+                    (pSet->nCount - 1 - idx) * sizeof(IdSetContainer_t));
+            pSet->aItems[idx] = tmp;
+        }
+    }
+    c = &pSet->aItems[idx];
+
+    if (c->aBits != NULL)
+    {
+        sqlite3_uint64 mask = (sqlite3_uint64) 1 << (v & 63);
+        if ((c->aBits[v >> 6] & mask) == 0)
+        {
+            c->aBits[v >> 6] |= mask;
+            c->n++;
+        }
+        return SQLITE_OK;
+    }
+
+    int pos = _findValue(c->aValues, c->n, v);
+    if (pos >= 0)
+        return SQLITE_OK;
+    pos = -pos - 1;
+
+    if (c->n == IDSET_ARRAY_MAX)
+        // Convert to bitmap
+    {
+        sqlite3_uint64 *aBits = sqlite3_malloc(IDSET_BITMAP_WORDS * sizeof(sqlite3_uint64));
+        if (aBits == NULL)
+            return SQLITE_NOMEM;
+        _containerToBits(c, aBits);
+        aBits[v >> 6] |= (sqlite3_uint64) 1 << (v & 63);
+        sqlite3_free(c->aValues);
+        c->aValues = NULL;
+        c->nAlloc = 0;
+        c->aBits = aBits;
+        c->n++;
+        return SQLITE_OK;
+    }
+
+    if (c->n == c->nAlloc)
+    {
+        int nNew = c->nAlloc == 0 ? 16 : c->nAlloc * 2;
+        if (nNew > IDSET_ARRAY_MAX)
+            nNew = IDSET_ARRAY_MAX;
+        unsigned short *aNew = sqlite3_realloc(c->aValues, nNew * sizeof(unsigned short));
+        if (aNew == NULL)
+            return SQLITE_NOMEM;
+        c->aValues = aNew;
+        c->nAlloc = nNew;
+    }
+
+    memmove(&c->aValues[pos + 1], &c->aValues[pos], (c->n - pos) * sizeof(unsigned short));
+    c->aValues[pos] = v;
+    c->n++;
+    return SQLITE_OK;
+}
+
+/*
+ * Deep copy of container
+ */
+static int _containerCopy(IdSetContainer_t *pDest, const IdSetContainer_t *pSrc)
+{
+    pDest->n = pSrc->n;
+    if (pSrc->aBits != NULL)
+    {
+        pDest->aBits = sqlite3_malloc(IDSET_BITMAP_WORDS * sizeof(sqlite3_uint64));
+        if (pDest->aBits == NULL)
+            return SQLITE_NOMEM;
+        memcpy(pDest->aBits, pSrc->aBits, IDSET_BITMAP_WORDS * sizeof(sqlite3_uint64));
+    }
+    else
+        if (pSrc->n > 0)
+        {
+            pDest->aValues = sqlite3_malloc(pSrc->n * sizeof(unsigned short));
+            if (pDest->aValues == NULL)
+                return SQLITE_NOMEM;
+            memcpy(pDest->aValues, pSrc->aValues, pSrc->n * sizeof(unsigned short));
+            pDest->nAlloc = pSrc->n;
+        }
+    return SQLITE_OK;
+}
+
+typedef enum
+{
+    IDSET_UNION = 0,
+    IDSET_INTERSECT = 1,
+    IDSET_EXCEPT = 2
+} IdSetOp_t;
+
+/*
+ * Combines 2 containers with the same key into pDest (empty)
+ */
+static int _containerCombine(IdSetContainer_t *pDest, const IdSetContainer_t *a, const IdSetContainer_t *b,
+                             IdSetOp_t op)
+{
+    // Array based shortcuts: result is subset of array a
+    if (a->aBits == NULL && (op == IDSET_EXCEPT || op == IDSET_INTERSECT))
+    {
+        if (a->n > 0)
+        {
+            pDest->aValues = sqlite3_malloc(a->n * sizeof(unsigned short));
+            if (pDest->aValues == NULL)
+                return SQLITE_NOMEM;
+            pDest->nAlloc = a->n;
+        }
+        for (int ii = 0; ii < a->n; ii++)
+        {
+            if (_containerHas(b, a->aValues[ii]) == (op == IDSET_INTERSECT))
+                pDest->aValues[pDest->n++] = a->aValues[ii];
+        }
+        return SQLITE_OK;
+    }
+
+    if (op == IDSET_INTERSECT && b->aBits == NULL)
+        return _containerCombine(pDest, b, a, op);
+
+    if (op == IDSET_UNION && a->aBits == NULL && b->aBits == NULL && a->n + b->n <= IDSET_ARRAY_MAX)
+        // Merge sorted arrays
+    {
+        pDest->aValues = sqlite3_malloc((a->n + b->n) * sizeof(unsigned short));
+        if (pDest->aValues == NULL)
+            return SQLITE_NOMEM;
+        pDest->nAlloc = a->n + b->n;
+        int ia = 0, ib = 0;
+        while (ia < a->n || ib < b->n)
+        {
+            if (ib == b->n || (ia < a->n && a->aValues[ia] < b->aValues[ib]))
+                pDest->aValues[pDest->n++] = a->aValues[ia++];
+            else
+                if (ia == a->n || b->aValues[ib] < a->aValues[ia])
+                    pDest->aValues[pDest->n++] = b->aValues[ib++];
+                else
+                {
+                    pDest->aValues[pDest->n++] = a->aValues[ia++];
+                    ib++;
+                }
+        }
+        return SQLITE_OK;
+    }
+
+    // General case: word-wide bit operations
+    sqlite3_uint64 *aBits = sqlite3_malloc(IDSET_BITMAP_WORDS * sizeof(sqlite3_uint64));
+    if (aBits == NULL)
+        return SQLITE_NOMEM;
+    _containerToBits(a, aBits);
+
+    if (b->aBits != NULL)
+    {
+        for (int ii = 0; ii < IDSET_BITMAP_WORDS; ii++)
+        {
+            switch (op)
+            {
+                case IDSET_UNION:
+                    aBits[ii] |= b->aBits[ii];
+                    break;
+                case IDSET_INTERSECT:
+                    aBits[ii] &= b->aBits[ii];
+                    break;
+                default:
+                    aBits[ii] &= ~b->aBits[ii];
+                    break;
+            }
+        }
+    }
+    else
+    {
+        // b is array, op is union or except
+        for (int ii = 0; ii < b->n; ii++)
+        {
+            sqlite3_uint64 mask = (sqlite3_uint64) 1 << (b->aValues[ii] & 63);
+            if (op == IDSET_UNION)
+                aBits[b->aValues[ii] >> 6] |= mask;
+            else
+                aBits[b->aValues[ii] >> 6] &= ~mask;
+        }
+    }
+
+    return _containerFromBits(pDest, aBits);
+}
+
+/*
+ * pResult = a <op> b. pResult must be empty
+ */
+static int IdSet_combine(IdSet_t *pResult, const IdSet_t *a, const IdSet_t *b, IdSetOp_t op)
+{
+    int ia = 0, ib = 0;
+    int rc = SQLITE_OK;
+
+    while (ia < a->nCount || ib < b->nCount)
+    {
+        const IdSetContainer_t *ca = ia < a->nCount ? &a->aItems[ia] : NULL;
+        const IdSetContainer_t *cb = ib < b->nCount ? &b->aItems[ib] : NULL;
+
+        if (cb == NULL || (ca != NULL && ca->key < cb->key))
+        {
+            ia++;
+            if (op == IDSET_INTERSECT)
+                continue;
+            IdSetContainer_t *c = _appendContainer(pResult, ca->key);
+            if (c == NULL)
+                return SQLITE_NOMEM;
+            rc = _containerCopy(c, ca);
+        }
+        else
+            if (ca == NULL || cb->key < ca->key)
+            {
+                ib++;
+                if (op != IDSET_UNION)
+                    continue;
+                IdSetContainer_t *c = _appendContainer(pResult, cb->key);
+                if (c == NULL)
+                    return SQLITE_NOMEM;
+                rc = _containerCopy(c, cb);
+            }
+            else
+            {
+                ia++;
+                ib++;
+                IdSetContainer_t *c = _appendContainer(pResult, ca->key);
+                if (c == NULL)
+                    return SQLITE_NOMEM;
+                rc = _containerCombine(c, ca, cb, op);
+                if (rc == SQLITE_OK && c->n == 0)
+                {
+                    _containerClear(c);
+                    pResult->nCount--;
+                }
+            }
+
+        if (rc != SQLITE_OK)
+            return rc;
+    }
+
+    return rc;
+}
+
+/*
+ * Decodes BLOB into set. NULL value is treated as empty set
+ */
+static int IdSet_load(IdSet_t *pSet, sqlite3_value *pVal)
+{
+    memset(pSet, 0, sizeof(*pSet));
+    if (sqlite3_value_type(pVal) == SQLITE_NULL)
+        return SQLITE_OK;
+
+    const unsigned char *p = sqlite3_value_blob(pVal);
+    int nBytes = sqlite3_value_bytes(pVal);
+    const unsigned char *pEnd = p + nBytes;
+
+    while (p < pEnd)
+    {
+        sqlite3_int64 key;
+        int n;
+        if (pEnd - p < (int) (sizeof(key) + sizeof(n)))
+            goto CORRUPT;
+        memcpy(&key, p, sizeof(key));
+        p += sizeof(key);
+        memcpy(&n, p, sizeof(n));
+        p += sizeof(n);
+
+        if (n <= 0 || n > 65536 || (pSet->nCount > 0 && pSet->aItems[pSet->nCount - 1].key >= key))
+            goto CORRUPT;
+
+        IdSetContainer_t *c = _appendContainer(pSet, key);
+        if (c == NULL)
+        {
+            IdSet_clear(pSet);
+            return SQLITE_NOMEM;
+        }
+
+        int nSize = n > IDSET_ARRAY_MAX ? IDSET_BITMAP_WORDS * (int) sizeof(sqlite3_uint64)
+                                        : n * (int) sizeof(unsigned short);
+        if (pEnd - p < nSize)
+            goto CORRUPT;
+
+        void *pData = sqlite3_malloc(nSize);
+        if (pData == NULL)
+        {
+            IdSet_clear(pSet);
+            return SQLITE_NOMEM;
+        }
+        memcpy(pData, p, nSize);
+        p += nSize;
+
+        c->n = n;
+        if (n > IDSET_ARRAY_MAX)
+            c->aBits = pData;
+        else
+        {
+            c->aValues = pData;
+            c->nAlloc = n;
+        }
+    }
+
+    return SQLITE_OK;
+
+    CORRUPT:
+    IdSet_clear(pSet);
+    return SQLITE_MISMATCH;
+}
+
+/*
+ * Returns set as BLOB result
+ */
+static void IdSet_result(sqlite3_context *context, IdSet_t *pSet)
+{
+    sqlite3_int64 nBytes = 0;
+    for (int ii = 0; ii < pSet->nCount; ii++)
+    {
+        IdSetContainer_t *c = &pSet->aItems[ii];
+        nBytes += sizeof(c->key) + sizeof(c->n) + (c->aBits != NULL ? IDSET_BITMAP_WORDS * sizeof(sqlite3_uint64)
+                                                                    : c->n * sizeof(unsigned short));
+    }
+
+    if (nBytes == 0)
+    {
+        sqlite3_result_zeroblob(context, 0);
+        return;
+    }
+
+    unsigned char *pBuf = sqlite3_malloc64(nBytes);
+    if (pBuf == NULL)
+    {
+        sqlite3_result_error_nomem(context);
+        return;
+    }
+
+    unsigned char *p = pBuf;
+    for (int ii = 0; ii < pSet->nCount; ii++)
+    {
+        IdSetContainer_t *c = &pSet->aItems[ii];
+        memcpy(p, &c->key, sizeof(c->key));
+        p += sizeof(c->key);
+        memcpy(p, &c->n, sizeof(c->n));
+        p += sizeof(c->n);
+        if (c->aBits != NULL)
+        {
+            memcpy(p, c->aBits, IDSET_BITMAP_WORDS * sizeof(sqlite3_uint64));
+            p += IDSET_BITMAP_WORDS * sizeof(sqlite3_uint64);
+        }
+        else
+        {
+            memcpy(p, c->aValues, c->n * sizeof(unsigned short));
+            p += c->n * sizeof(unsigned short);
+        }
+    }
+
+    sqlite3_result_blob64(context, pBuf, nBytes, sqlite3_free);
+}
+
+/*
+ * flexi_idset(ObjectID) aggregate
+ */
+static void idsetStep(sqlite3_context *context, int argc, sqlite3_value **argv)
+{
+    IdSet_t *pSet = sqlite3_aggregate_context(context, sizeof(IdSet_t));
+    if (pSet == NULL)
+    {
+        sqlite3_result_error_nomem(context);
+        return;
+    }
+
+    if (sqlite3_value_type(argv[0]) == SQLITE_NULL)
+        return;
+
+    if (IdSet_add(pSet, sqlite3_value_int64(argv[0])) != SQLITE_OK)
+        sqlite3_result_error_nomem(context);
+}
+
+static void idsetFinal(sqlite3_context *context)
+{
+    IdSet_t *pSet = sqlite3_aggregate_context(context, 0);
+    if (pSet == NULL)
+    {
+        sqlite3_result_zeroblob(context, 0);
+        return;
+    }
+
+    IdSet_result(context, pSet);
+    IdSet_clear(pSet);
+}
+
+static void _loadError(sqlite3_context *context, int rc)
+{
+    if (rc == SQLITE_NOMEM)
+        sqlite3_result_error_nomem(context);
+    else
+        sqlite3_result_error(context, "Invalid ID set", -1);
+}
+
+/*
+ * flexi_idset_union, flexi_idset_intersect and flexi_idset_except.
+ * Operation is passed as user data
+ */
+static void idsetCombineFunc(sqlite3_context *context, int argc, sqlite3_value **argv)
+{
+    IdSetOp_t op = (IdSetOp_t) (intptr_t) sqlite3_user_data(context);
+    IdSet_t acc;
+    int rc;
+
+    if (argc == 0)
+    {
+        sqlite3_result_zeroblob(context, 0);
+        return;
+    }
+
+    rc = IdSet_load(&acc, argv[0]);
+    if (rc != SQLITE_OK)
+    {
+        _loadError(context, rc);
+        return;
+    }
+
+    for (int ii = 1; ii < argc; ii++)
+    {
+        // Intersection with empty set is empty
+        if (acc.nCount == 0 && op != IDSET_UNION)
+            break;
+
+        IdSet_t next;
+        IdSet_t result;
+        memset(&result, 0, sizeof(result));
+
+        rc = IdSet_load(&next, argv[ii]);
+        if (rc == SQLITE_OK)
+            rc = IdSet_combine(&result, &acc, &next, op);
+        IdSet_clear(&next);
+        IdSet_clear(&acc);
+        acc = result;
+
+        if (rc != SQLITE_OK)
+        {
+            IdSet_clear(&acc);
+            _loadError(context, rc);
+            return;
+        }
+    }
+
+    IdSet_result(context, &acc);
+    IdSet_clear(&acc);
+}
+
+static void idsetCountFunc(sqlite3_context *context, int argc, sqlite3_value **argv)
+{
+    IdSet_t set;
+    int rc = IdSet_load(&set, argv[0]);
+    if (rc != SQLITE_OK)
+    {
+        _loadError(context, rc);
+        return;
+    }
+    sqlite3_result_int64(context, IdSet_count(&set));
+    IdSet_clear(&set);
+}
+
+/*
+ * flexi_idset_each table valued function
+ */
+typedef struct IdSetEachCursor_t
+{
+    sqlite3_vtab_cursor base;
+    IdSet_t set;
+
+    // Current container
+    int iContainer;
+
+    // Position in current container: index in array or bit number in bitmap
+    int iPos;
+
+    sqlite3_int64 lValue;
+    int bEof;
+} IdSetEachCursor_t;
+
+#define IDSET_EACH_COLUMN_VALUE 0
+#define IDSET_EACH_COLUMN_SET 1
+
+static int idsetEachConnect(sqlite3 *db, void *pAux, int argc, const char *const *argv,
+                            sqlite3_vtab **ppVtab, char **pzErr)
+{
+    int rc = sqlite3_declare_vtab(db, "create table x(value, [set] hidden)");
+    if (rc != SQLITE_OK)
+        return rc;
+
+    sqlite3_vtab *pVtab = sqlite3_malloc(sizeof(sqlite3_vtab));
+    if (pVtab == NULL)
+        return SQLITE_NOMEM;
+    memset(pVtab, 0, sizeof(*pVtab));
+    *ppVtab = pVtab;
+    return SQLITE_OK;
+}
+
+static int idsetEachDisconnect(sqlite3_vtab *pVtab)
+{
+    sqlite3_free(pVtab);
+    return SQLITE_OK;
+}
+
+/*
+ * Set argument is required. IDs are always returned in ascending order
+ */
+static int idsetEachBestIndex(sqlite3_vtab *tab, sqlite3_index_info *pIdxInfo)
+{
+    for (int ii = 0; ii < pIdxInfo->nConstraint; ii++)
+    {
+        if (pIdxInfo->aConstraint[ii].usable && pIdxInfo->aConstraint[ii].iColumn == IDSET_EACH_COLUMN_SET
+            && pIdxInfo->aConstraint[ii].op == SQLITE_INDEX_CONSTRAINT_EQ)
+        {
+            pIdxInfo->aConstraintUsage[ii].argvIndex = 1;
+            pIdxInfo->aConstraintUsage[ii].omit = 1;
+            pIdxInfo->idxNum = 1;
+            pIdxInfo->estimatedCost = 10;
+            if (pIdxInfo->nOrderBy == 1 && pIdxInfo->aOrderBy[0].iColumn == IDSET_EACH_COLUMN_VALUE
+                && !pIdxInfo->aOrderBy[0].desc)
+                pIdxInfo->orderByConsumed = 1;
+            return SQLITE_OK;
+        }
+    }
+
+    pIdxInfo->idxNum = 0;
+    pIdxInfo->estimatedCost = 1e99;
+    return SQLITE_OK;
+}
+
+static int idsetEachOpen(sqlite3_vtab *pVtab, sqlite3_vtab_cursor **ppCursor)
+{
+    IdSetEachCursor_t *cur = sqlite3_malloc(sizeof(IdSetEachCursor_t));
+    if (cur == NULL)
+        return SQLITE_NOMEM;
+    memset(cur, 0, sizeof(*cur));
+    *ppCursor = &cur->base;
+    return SQLITE_OK;
+}
+
+static int idsetEachClose(sqlite3_vtab_cursor *pCursor)
+{
+    IdSetEachCursor_t *cur = (void *) pCursor;
+    IdSet_clear(&cur->set);
+    sqlite3_free(cur);
+    return SQLITE_OK;
+}
+
+/*
+ * Moves to the first item at or after (iContainer, iPos)
+ */
+static void _eachSeek(IdSetEachCursor_t *cur)
+{
+    while (cur->iContainer < cur->set.nCount)
+    {
+        IdSetContainer_t *c = &cur->set.aItems[cur->iContainer];
+        if (c->aBits == NULL)
+        {
+            if (cur->iPos < c->n)
+            {
+                cur->lValue = (c->key << 16) | c->aValues[cur->iPos];
+                return;
+            }
+        }
+        else
+        {
+            while (cur->iPos < 65536)
+            {
+                sqlite3_uint64 w = c->aBits[cur->iPos >> 6] >> (cur->iPos & 63);
+                if (w != 0)
+                {
+                    cur->iPos += _ctz(w);
+                    cur->lValue = (c->key << 16) | cur->iPos;
+                    return;
+                }
+                cur->iPos = ((cur->iPos >> 6) + 1) << 6;
+            }
+        }
+
+        cur->iContainer++;
+        cur->iPos = 0;
+    }
+
+    cur->bEof = 1;
+}
+
+static int idsetEachFilter(sqlite3_vtab_cursor *pCursor, int idxNum, const char *idxStr,
+                           int argc, sqlite3_value **argv)
+{
+    IdSetEachCursor_t *cur = (void *) pCursor;
+    IdSet_clear(&cur->set);
+    cur->iContainer = 0;
+    cur->iPos = 0;
+    cur->bEof = 0;
+
+    if (idxNum == 0 || argc == 0)
+    {
+        cur->bEof = 1;
+        return SQLITE_OK;
+    }
+
+    int rc = IdSet_load(&cur->set, argv[0]);
+    if (rc != SQLITE_OK)
+    {
+        if (rc == SQLITE_MISMATCH)
+        {
+            sqlite3_free(pCursor->pVtab->zErrMsg);
+            pCursor->pVtab->zErrMsg = sqlite3_mprintf("Invalid ID set");
+            rc = SQLITE_ERROR;
+        }
+        return rc;
+    }
+
+    _eachSeek(cur);
+    return SQLITE_OK;
+}
+
+static int idsetEachNext(sqlite3_vtab_cursor *pCursor)
+{
+    IdSetEachCursor_t *cur = (void *) pCursor;
+    cur->iPos++;
+    _eachSeek(cur);
+    return SQLITE_OK;
+}
+
+static int idsetEachEof(sqlite3_vtab_cursor *pCursor)
+{
+    IdSetEachCursor_t *cur = (void *) pCursor;
+    return cur->bEof;
+}
+
+static int idsetEachColumn(sqlite3_vtab_cursor *pCursor, sqlite3_context *context, int iCol)
+{
+    IdSetEachCursor_t *cur = (void *) pCursor;
+    if (iCol == IDSET_EACH_COLUMN_VALUE)
+        sqlite3_result_int64(context, cur->lValue);
+    return SQLITE_OK;
+}
+
+static int idsetEachRowid(sqlite3_vtab_cursor *pCursor, sqlite3_int64 *pRowid)
+{
+    IdSetEachCursor_t *cur = (void *) pCursor;
+    *pRowid = cur->lValue;
+    return SQLITE_OK;
+}
+
+static sqlite3_module idsetEachModule = {
+        .iVersion = 0,
+        .xCreate = NULL,
+        .xConnect = idsetEachConnect,
+        .xBestIndex = idsetEachBestIndex,
+        .xDisconnect = idsetEachDisconnect,
+        .xDestroy = NULL,
+        .xOpen = idsetEachOpen,
+        .xClose = idsetEachClose,
+        .xFilter = idsetEachFilter,
+        .xNext = idsetEachNext,
+        .xEof = idsetEachEof,
+        .xColumn = idsetEachColumn,
+        .xRowid = idsetEachRowid,
+};
+
+int idset_func_init(
+        sqlite3 *db,
+        char **pzErrMsg,
+        const sqlite3_api_routines *pApi
+)
+{
+    int rc = SQLITE_OK;
+
+    rc = sqlite3_create_function(db, "flexi_idset", 1, SQLITE_UTF8, NULL,
+                                 NULL, idsetStep, idsetFinal);
+    if (rc == SQLITE_OK)
+        rc = sqlite3_create_function(db, "flexi_idset_union", -1, SQLITE_UTF8 | SQLITE_DETERMINISTIC,
+                                     (void *) (intptr_t) IDSET_UNION, idsetCombineFunc, NULL, NULL);
+    if (rc == SQLITE_OK)
+        rc = sqlite3_create_function(db, "flexi_idset_intersect", -1, SQLITE_UTF8 | SQLITE_DETERMINISTIC,
+                                     (void *) (intptr_t) IDSET_INTERSECT, idsetCombineFunc, NULL, NULL);
+    if (rc == SQLITE_OK)
+        rc = sqlite3_create_function(db, "flexi_idset_except", 2, SQLITE_UTF8 | SQLITE_DETERMINISTIC,
+                                     (void *) (intptr_t) IDSET_EXCEPT, idsetCombineFunc, NULL, NULL);
+    if (rc == SQLITE_OK)
+        rc = sqlite3_create_function(db, "flexi_idset_count", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC,
+                                     NULL, idsetCountFunc, NULL, NULL);
+    if (rc == SQLITE_OK)
+        rc = sqlite3_create_module(db, "flexi_idset_each", &idsetEachModule, NULL);
+
+    return rc;
+}
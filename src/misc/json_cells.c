@@ -0,0 +1,411 @@
+/*
+ * flexi_json_cells - table valued function which decodes JSON payload of 'import data' into flat list of
+ * property values (cells), so that Lua side does not need to build full table tree of the payload and walk it.
+ *
+ * Payload is parsed once (by JSON1 parser) into a flat cell buffer, which references parsed nodes.
+ * Property names are returned as is and get resolved by Lua side, which has class definitions cached.
+ *
+ * Usage:
+ * select * from flexi_json_cells(json) - classless payload: {"Class1": [{...}, {...}], "Class2": [...]}
+ * select * from flexi_json_cells(json, className) - single object or array of objects of given class
+ *
+ * Columns:
+ * Class - class name
+ * ObjectIndex - 1 based index of object in class payload. NULL if class payload in classless mode is not array
+ * Property - property name. NULL if Value has entire item which is not a regular object (class payload
+ *  in classless mode which is not array, array item which is not object, or object without properties)
+ * PropIndex - 1 based index of value in property. Arrays of scalar values are returned as separate cells
+ * Value - scalar value, or JSON text for nested objects and arrays
+ * VType - JSON type of value: 'null', 'true', 'false', 'integer', 'real', 'text', 'array', 'object'
+ * InArray - 1 if value is item of array of scalar values
+ */
+
+#include "../project_defs.h"
+#include "json1.h"
+
+SQLITE_EXTENSION_INIT3
+
+typedef struct JsonCell_t
+{
+    // Index of node with class name, 0 if class name was passed as argument
+    u32 iClass;
+
+    // Index of node with property name, 0 for entire item
+    u32 iProp;
+
+    // Index of value node
+    u32 iValue;
+
+    // 1 based, 0 if class payload is not array
+    int iObject;
+
+    int iPropIndex;
+
+    u8 bInArray;
+} JsonCell_t;
+
+typedef struct JsonCellsVTab_t
+{
+    sqlite3_vtab base;
+    sqlite3 *db;
+} JsonCellsVTab_t;
+
+typedef struct JsonCellsCursor_t
+{
+    sqlite3_vtab_cursor base;
+
+    // Copy of payload. Parsed nodes point to this text
+    char *zJson;
+
+    char *zClass;
+
+    JsonParse parse;
+    int bParsed;
+
+    JsonCell_t *aCells;
+    int nCells;
+    int nAlloc;
+
+    int iCell;
+} JsonCellsCursor_t;
+
+#define JSON_CELLS_COLUMN_CLASS 0
+#define JSON_CELLS_COLUMN_OBJECT_INDEX 1
+#define JSON_CELLS_COLUMN_PROPERTY 2
+#define JSON_CELLS_COLUMN_PROP_INDEX 3
+#define JSON_CELLS_COLUMN_VALUE 4
+#define JSON_CELLS_COLUMN_VTYPE 5
+#define JSON_CELLS_COLUMN_IN_ARRAY 6
+#define JSON_CELLS_COLUMN_JSON 7
+#define JSON_CELLS_COLUMN_CLASS_ARG 8
+
+static const char *g_zJsonTypes[] = {"null", "true", "false", "integer", "real", "text", "array", "object"};
+
+static u32 _nodeSize(JsonNode *pNode)
+{
+    return pNode->eType >= JSON_ARRAY ? pNode->n + 1 : 1;
+}
+
+static int jsonCellsConnect(sqlite3 *db, void *pAux, int argc, const char *const *argv,
+                            sqlite3_vtab **ppVtab, char **pzErr)
+{
+    int rc = sqlite3_declare_vtab(db, "create table x(Class, ObjectIndex, Property, PropIndex, "
+            "Value, VType, InArray, [json] hidden, [className] hidden)");
+    if (rc != SQLITE_OK)
+        return rc;
+
+    JsonCellsVTab_t *pVtab = sqlite3_malloc(sizeof(JsonCellsVTab_t));
+    if (pVtab == NULL)
+        return SQLITE_NOMEM;
+    memset(pVtab, 0, sizeof(*pVtab));
+    pVtab->db = db;
+    *ppVtab = &pVtab->base;
+    return SQLITE_OK;
+}
+
+static int jsonCellsDisconnect(sqlite3_vtab *pVtab)
+{
+    sqlite3_free(pVtab);
+    return SQLITE_OK;
+}
+
+/*
+ * json argument is required, class is optional. idxNum has bit 1 set for json and bit 2 for class
+ */
+static int jsonCellsBestIndex(sqlite3_vtab *tab, sqlite3_index_info *pIdxInfo)
+{
+    int iJson = -1, iClass = -1;
+    for (int ii = 0; ii < pIdxInfo->nConstraint; ii++)
+    {
+        if (!pIdxInfo->aConstraint[ii].usable || pIdxInfo->aConstraint[ii].op != SQLITE_INDEX_CONSTRAINT_EQ)
+            continue;
+        if (pIdxInfo->aConstraint[ii].iColumn == JSON_CELLS_COLUMN_JSON)
+            iJson = ii;
+        else if (pIdxInfo->aConstraint[ii].iColumn == JSON_CELLS_COLUMN_CLASS_ARG)
+            iClass = ii;
+    }
+
+    if (iJson < 0)
+    {
+        pIdxInfo->idxNum = 0;
+        pIdxInfo->estimatedCost = 1e99;
+        return SQLITE_OK;
+    }
+
+    pIdxInfo->aConstraintUsage[iJson].argvIndex = 1;
+    pIdxInfo->aConstraintUsage[iJson].omit = 1;
+    pIdxInfo->idxNum = 1;
+    if (iClass >= 0)
+    {
+        pIdxInfo->aConstraintUsage[iClass].argvIndex = 2;
+        pIdxInfo->aConstraintUsage[iClass].omit = 1;
+        pIdxInfo->idxNum |= 2;
+    }
+    pIdxInfo->estimatedCost = 100;
+    return SQLITE_OK;
+}
+
+static int jsonCellsOpen(sqlite3_vtab *pVtab, sqlite3_vtab_cursor **ppCursor)
+{
+    JsonCellsCursor_t *cur = sqlite3_malloc(sizeof(JsonCellsCursor_t));
+    if (cur == NULL)
+        return SQLITE_NOMEM;
+    memset(cur, 0, sizeof(*cur));
+    *ppCursor = &cur->base;
+    return SQLITE_OK;
+}
+
+static void _reset(JsonCellsCursor_t *cur)
+{
+    if (cur->bParsed)
+    {
+        jsonParseReset(&cur->parse);
+        cur->bParsed = 0;
+    }
+    sqlite3_free(cur->zJson);
+    cur->zJson = NULL;
+    sqlite3_free(cur->zClass);
+    cur->zClass = NULL;
+    cur->nCells = 0;
+    cur->iCell = 0;
+}
+
+static int jsonCellsClose(sqlite3_vtab_cursor *pCursor)
+{
+    JsonCellsCursor_t *cur = (void *) pCursor;
+    _reset(cur);
+    sqlite3_free(cur->aCells);
+    sqlite3_free(cur);
+    return SQLITE_OK;
+}
+
+static int _addCell(JsonCellsCursor_t *cur, u32 iClass, int iObject, u32 iProp, u32 iValue, int iPropIndex,
+                    u8 bInArray)
+{
+    if (cur->nCells >= cur->nAlloc)
+    {
+        int nNew = cur->nAlloc == 0 ? 64 : cur->nAlloc * 2;
+        JsonCell_t *aNew = sqlite3_realloc(cur->aCells, nNew * sizeof(JsonCell_t));
+        if (aNew == NULL)
+            return SQLITE_NOMEM;
+        cur->aCells = aNew;
+        cur->nAlloc = nNew;
+    }
+
+    JsonCell_t *pCell = &cur->aCells[cur->nCells++];
+    pCell->iClass = iClass;
+    pCell->iObject = iObject;
+    pCell->iProp = iProp;
+    pCell->iValue = iValue;
+    pCell->iPropIndex = iPropIndex;
+    pCell->bInArray = bInArray;
+
+    return SQLITE_OK;
+}
+
+/*
+ * Adds cells for single item of class payload
+ */
+static int _addItem(JsonCellsCursor_t *cur, u32 iClass, int iObject, u32 iItem)
+{
+    JsonNode *aNode = cur->parse.aNode;
+    int rc = SQLITE_OK;
+
+    if (aNode[iItem].eType != JSON_OBJECT || aNode[iItem].n == 0)
+        return _addCell(cur, iClass, iObject, 0, iItem, 1, 0);
+
+    // Object properties are pairs of nodes: name and value
+    for (u32 j = 1; j <= aNode[iItem].n && rc == SQLITE_OK; j += _nodeSize(&aNode[iItem + j + 1]) + 1)
+    {
+        u32 iProp = iItem + j;
+        u32 iValue = iProp + 1;
+        JsonNode *pValue = &aNode[iValue];
+
+        if (pValue->eType == JSON_ARRAY && pValue->n > 0)
+        {
+            // Arrays of scalars are returned item by item. Arrays with nested objects and arrays are returned as JSON
+            int bScalars = 1;
+            for (u32 k = 1; k <= pValue->n; k++)
+            {
+                if (pValue[k].eType >= JSON_ARRAY)
+                {
+                    bScalars = 0;
+                    break;
+                }
+            }
+
+            if (bScalars)
+            {
+                for (u32 k = 1; k <= pValue->n && rc == SQLITE_OK; k++)
+                    rc = _addCell(cur, iClass, iObject, iProp, iValue + k, k, 1);
+                continue;
+            }
+        }
+
+        rc = _addCell(cur, iClass, iObject, iProp, iValue, 1, 0);
+    }
+
+    return rc;
+}
+
+/*
+ * Adds cells for payload of single class: array of objects, or single object if class was passed as argument.
+ * In classless payload, object is not data but query, so it is returned as is
+ */
+static int _addClassPayload(JsonCellsCursor_t *cur, u32 iClass, u32 iPayload)
+{
+    JsonNode *aNode = cur->parse.aNode;
+    int rc = SQLITE_OK;
+
+    if (aNode[iPayload].eType != JSON_ARRAY)
+    {
+        if (iClass != 0)
+            return _addCell(cur, iClass, 0, 0, iPayload, 1, 0);
+        return _addItem(cur, 0, 1, iPayload);
+    }
+
+    int iObject = 1;
+    for (u32 j = 1; j <= aNode[iPayload].n && rc == SQLITE_OK; j += _nodeSize(&aNode[iPayload + j]))
+        rc = _addItem(cur, iClass, iObject++, iPayload + j);
+
+    return rc;
+}
+
+static int jsonCellsFilter(sqlite3_vtab_cursor *pCursor, int idxNum, const char *idxStr,
+                           int argc, sqlite3_value **argv)
+{
+    JsonCellsCursor_t *cur = (void *) pCursor;
+    sqlite3_vtab *pVtab = pCursor->pVtab;
+    int rc = SQLITE_OK;
+
+    _reset(cur);
+
+    if (idxNum == 0 || argc == 0 || sqlite3_value_type(argv[0]) == SQLITE_NULL)
+        return SQLITE_OK;
+
+    cur->zJson = sqlite3_mprintf("%s", sqlite3_value_text(argv[0]));
+    if (argc > 1 && sqlite3_value_type(argv[1]) != SQLITE_NULL)
+        cur->zClass = sqlite3_mprintf("%s", sqlite3_value_text(argv[1]));
+    if (cur->zJson == NULL || (argc > 1 && sqlite3_value_type(argv[1]) != SQLITE_NULL && cur->zClass == NULL))
+        return SQLITE_NOMEM;
+
+    if (jsonParse(&cur->parse, NULL, cur->zJson) != 0)
+    {
+        sqlite3_free(pVtab->zErrMsg);
+        pVtab->zErrMsg = sqlite3_mprintf("malformed JSON");
+        return SQLITE_ERROR;
+    }
+    cur->bParsed = 1;
+
+    JsonNode *aNode = cur->parse.aNode;
+
+    if (cur->zClass != NULL)
+        rc = _addClassPayload(cur, 0, 0);
+    else
+    {
+        if (aNode[0].eType != JSON_OBJECT)
+        {
+            sqlite3_free(pVtab->zErrMsg);
+            pVtab->zErrMsg = sqlite3_mprintf("Invalid data type: object with class names expected");
+            return SQLITE_ERROR;
+        }
+
+        for (u32 j = 1; j <= aNode[0].n && rc == SQLITE_OK; j += _nodeSize(&aNode[j + 1]) + 1)
+            rc = _addClassPayload(cur, j, j + 1);
+    }
+
+    return rc;
+}
+
+static int jsonCellsNext(sqlite3_vtab_cursor *pCursor)
+{
+    JsonCellsCursor_t *cur = (void *) pCursor;
+    cur->iCell++;
+    return SQLITE_OK;
+}
+
+static int jsonCellsEof(sqlite3_vtab_cursor *pCursor)
+{
+    JsonCellsCursor_t *cur = (void *) pCursor;
+    return cur->iCell >= cur->nCells;
+}
+
+static int jsonCellsColumn(sqlite3_vtab_cursor *pCursor, sqlite3_context *context, int iCol)
+{
+    JsonCellsCursor_t *cur = (void *) pCursor;
+    JsonCell_t *pCell = &cur->aCells[cur->iCell];
+    JsonNode *aNode = cur->parse.aNode;
+
+    switch (iCol)
+    {
+        case JSON_CELLS_COLUMN_CLASS:
+            if (pCell->iClass != 0)
+                jsonReturn(&aNode[pCell->iClass], context, NULL);
+            else
+                sqlite3_result_text(context, cur->zClass, -1, SQLITE_STATIC);
+            break;
+
+        case JSON_CELLS_COLUMN_OBJECT_INDEX:
+            if (pCell->iObject > 0)
+                sqlite3_result_int(context, pCell->iObject);
+            break;
+
+        case JSON_CELLS_COLUMN_PROPERTY:
+            if (pCell->iProp != 0)
+                jsonReturn(&aNode[pCell->iProp], context, NULL);
+            break;
+
+        case JSON_CELLS_COLUMN_PROP_INDEX:
+            sqlite3_result_int(context, pCell->iPropIndex);
+            break;
+
+        case JSON_CELLS_COLUMN_VALUE:
+            jsonReturn(&aNode[pCell->iValue], context, NULL);
+            break;
+
+        case JSON_CELLS_COLUMN_VTYPE:
+            sqlite3_result_text(context, g_zJsonTypes[aNode[pCell->iValue].eType], -1, SQLITE_STATIC);
+            break;
+
+        case JSON_CELLS_COLUMN_IN_ARRAY:
+            sqlite3_result_int(context, pCell->bInArray);
+            break;
+
+        default:
+            break;
+    }
+
+    return SQLITE_OK;
+}
+
+static int jsonCellsRowid(sqlite3_vtab_cursor *pCursor, sqlite3_int64 *pRowid)
+{
+    JsonCellsCursor_t *cur = (void *) pCursor;
+    *pRowid = cur->iCell + 1;
+    return SQLITE_OK;
+}
+
+static sqlite3_module jsonCellsModule = {
+        .iVersion = 0,
+        .xCreate = NULL,
+        .xConnect = jsonCellsConnect,
+        .xBestIndex = jsonCellsBestIndex,
+        .xDisconnect = jsonCellsDisconnect,
+        .xDestroy = NULL,
+        .xOpen = jsonCellsOpen,
+        .xClose = jsonCellsClose,
+        .xFilter = jsonCellsFilter,
+        .xNext = jsonCellsNext,
+        .xEof = jsonCellsEof,
+        .xColumn = jsonCellsColumn,
+        .xRowid = jsonCellsRowid,
+};
+
+int json_cells_func_init(
+        sqlite3 *db,
+        char **pzErrMsg,
+        const sqlite3_api_routines *pApi
+)
+{
+    return sqlite3_create_module(db, "flexi_json_cells", &jsonCellsModule, NULL);
+}
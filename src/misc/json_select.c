@@ -0,0 +1,352 @@
+/*
+ * flexi_json_agg aggregate function. Builds JSON array (or JSON Lines) of objects directly from
+ * [.objects]/[.ref-values] rows, without creating Lua objects for every cell.
+ * Used by flexi('select', ...).
+ *
+ * Arguments (in order):
+ * Ord - ordinal number of object in result set
+ * ObjectID
+ * PropertyID - NULL for object header row (so that objects without values are included too)
+ * Name - property name
+ * IsArray - 1 if property values must be always output as array
+ * Value
+ * ctlv - only vtype bits (0-2) are used
+ * EnumText - decoded enum item text, if applicable
+ * Mode - 'json' (default) or 'jsonl'
+ *
+ * Rows are expected to be sorted by Ord, PropertyID, PropIndex.
+ *
+ * Values are decoded according to vtype:
+ * datetime - Julian day -> 'YYYY-MM-DDTHH:MM:SS'
+ * symbol - [.sym_names].ID -> [.sym_names].Value
+ * money - integer with 4 fixed decimal digits -> number
+ * json - embedded as is
+ * enum - EnumText, if supplied
+ * BLOBs are encoded as base64
+ */
+
+#include <string.h>
+#include "../project_defs.h"
+#include "../util/StringBuilder.h"
+#include "sym_names.h"
+
+SQLITE_EXTENSION_INIT3
+
+/*
+ * Value types, as defined in Constants.vtype
+ */
+enum
+{
+    VTYPE_DEFAULT = 0,
+    VTYPE_DATETIME = 1,
+    VTYPE_TIMESPAN = 2,
+    VTYPE_SYMBOL = 3,
+    VTYPE_MONEY = 4,
+    VTYPE_JSON = 5,
+    VTYPE_ENUM = 6,
+    VTYPE_REFERENCE = 7,
+    VTYPE_MASK = 7
+};
+
+/*
+ * Aggregate context
+ */
+typedef struct JsonSelectCtx_t
+{
+    StringBuilder_t sb;
+
+    // Ordinal number of current object. -1 if none
+    sqlite3_int64 lCurOrd;
+
+    // Current property ID. 0 if none
+    sqlite3_int64 lCurPropID;
+
+    // Number of values output for current property
+    int nPropValues;
+
+    // True if current property is output as array
+    bool bCurArray;
+
+    // Number of objects output so far
+    sqlite3_int64 nObjects;
+
+    bool bJsonLines;
+
+    bool bInitialized;
+} JsonSelectCtx_t;
+
+static const char base64Chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static void _appendBase64(StringBuilder_t *sb, const unsigned char *pData, int nData)
+{
+    char buf[4];
+    int i;
+
+    StringBuilder_appendRaw(sb, "\"", 1);
+    for (i = 0; i + 2 < nData; i += 3)
+    {
+        buf[0] = base64Chars[pData[i] >> 2];
+        buf[1] = base64Chars[((pData[i] & 0x03) << 4) | (pData[i + 1] >> 4)];
+        buf[2] = base64Chars[((pData[i + 1] & 0x0f) << 2) | (pData[i + 2] >> 6)];
+        buf[3] = base64Chars[pData[i + 2] & 0x3f];
+        StringBuilder_appendRaw(sb, buf, 4);
+    }
+
+    if (i < nData)
+    {
+        buf[0] = base64Chars[pData[i] >> 2];
+        if (i + 1 < nData)
+        {
+            buf[1] = base64Chars[((pData[i] & 0x03) << 4) | (pData[i + 1] >> 4)];
+            buf[2] = base64Chars[(pData[i + 1] & 0x0f) << 2];
+        }
+        else
+        {
+            buf[1] = base64Chars[(pData[i] & 0x03) << 4];
+            buf[2] = '=';
+        }
+        buf[3] = '=';
+        StringBuilder_appendRaw(sb, buf, 4);
+    }
+    StringBuilder_appendRaw(sb, "\"", 1);
+}
+
+/*
+ * Converts Julian day number to ISO 8601 string. Algorithm is the same as in SQLite date.c
+ */
+static void _appendJulianDate(StringBuilder_t *sb, double rJD)
+{
+    char buf[32];
+    sqlite3_int64 iJD = (sqlite3_int64) (rJD * 86400000.0 + 0.5);
+    int Z, A, B, C, D, E, X1;
+    int year, month, day, h, m, s;
+
+    Z = (int) ((iJD + 43200000) / 86400000);
+    A = (int) ((Z - 1867216.25) / 36524.25);
+    A = Z + 1 + A - (A / 4);
+    B = A + 1524;
+    C = (int) ((B - 122.1) / 365.25);
+    D = (36525 * (C & 32767)) / 100;
+    E = (int) ((B - D) / 30.6001);
+    X1 = (int) (30.6001 * E);
+    day = B - D - X1;
+    month = E < 14 ? E - 1 : E - 13;
+    year = month > 2 ? C - 4716 : C - 4715;
+
+    s = (int) ((iJD + 43200000) % 86400000) / 1000;
+    h = s / 3600;
+    s -= h * 3600;
+    m = s / 60;
+    s -= m * 60;
+
+    sqlite3_snprintf(sizeof(buf), buf, "\"%.4d-%.2d-%.2dT%.2d:%.2d:%.2d\"", year, month, day, h, m, s);
+    StringBuilder_appendRaw(sb, buf, -1);
+}
+
+static void _appendMoney(StringBuilder_t *sb, sqlite3_int64 lValue)
+{
+    char buf[32];
+    const char *zSign = lValue < 0 ? "-" : "";
+    sqlite3_uint64 uValue = lValue < 0 ? (sqlite3_uint64) (-lValue) : (sqlite3_uint64) lValue;
+    sqlite3_snprintf(sizeof(buf), buf, "%s%llu.%04llu", zSign, uValue / 10000, uValue % 10000);
+    StringBuilder_appendRaw(sb, buf, -1);
+}
+
+/*
+ * Appends symbol name by its ID (via shared symbol name cache). If not found, appends ID as is
+ */
+static void _appendSymbol(sqlite3_context *context, JsonSelectCtx_t *pCtx, sqlite3_int64 lSymID)
+{
+    char buf[32];
+    int nBytes = 0;
+    const char *zName = flexi_sym_name_get(sqlite3_context_db_handle(context), lSymID, &nBytes);
+    if (zName != NULL)
+    {
+        StringBuilder_appendJsonElem(&pCtx->sb, zName, nBytes);
+    }
+    else
+    {
+        sqlite3_snprintf(sizeof(buf), buf, "%lld", lSymID);
+        StringBuilder_appendRaw(&pCtx->sb, buf, -1);
+    }
+}
+
+static void _appendValue(sqlite3_context *context, JsonSelectCtx_t *pCtx, sqlite3_value *pValue, int vtype,
+                         sqlite3_value *pEnumText)
+{
+    char buf[32];
+    StringBuilder_t *sb = &pCtx->sb;
+
+    if (vtype == VTYPE_ENUM && sqlite3_value_type(pEnumText) != SQLITE_NULL)
+    {
+        pValue = pEnumText;
+        vtype = VTYPE_DEFAULT;
+    }
+
+    switch (sqlite3_value_type(pValue))
+    {
+        case SQLITE_NULL:
+            StringBuilder_appendRaw(sb, "null", 4);
+            break;
+
+        case SQLITE_INTEGER:
+            if (vtype == VTYPE_SYMBOL)
+                _appendSymbol(context, pCtx, sqlite3_value_int64(pValue));
+            else
+                if (vtype == VTYPE_MONEY)
+                    _appendMoney(sb, sqlite3_value_int64(pValue));
+                else
+                    if (vtype == VTYPE_DATETIME)
+                        _appendJulianDate(sb, (double) sqlite3_value_int64(pValue));
+                    else
+                    {
+                        sqlite3_snprintf(sizeof(buf), buf, "%lld", sqlite3_value_int64(pValue));
+                        StringBuilder_appendRaw(sb, buf, -1);
+                    }
+            break;
+
+        case SQLITE_FLOAT:
+            if (vtype == VTYPE_DATETIME)
+                _appendJulianDate(sb, sqlite3_value_double(pValue));
+            else
+            {
+                sqlite3_snprintf(sizeof(buf), buf, "%!.15g", sqlite3_value_double(pValue));
+                StringBuilder_appendRaw(sb, buf, -1);
+            }
+            break;
+
+        case SQLITE_TEXT:
+            if (vtype == VTYPE_JSON)
+                StringBuilder_appendRaw(sb, (const char *) sqlite3_value_text(pValue), sqlite3_value_bytes(pValue));
+            else
+                StringBuilder_appendJsonElem(sb, (const char *) sqlite3_value_text(pValue),
+                                             sqlite3_value_bytes(pValue));
+            break;
+
+        default:
+            _appendBase64(sb, sqlite3_value_blob(pValue), sqlite3_value_bytes(pValue));
+            break;
+    }
+}
+
+/*
+ * Closes array of values of the current property, if needed
+ */
+static void _closeProp(JsonSelectCtx_t *pCtx)
+{
+    if (pCtx->lCurPropID != 0 && pCtx->bCurArray)
+        StringBuilder_appendRaw(&pCtx->sb, "]", 1);
+    pCtx->lCurPropID = 0;
+}
+
+static void _closeObject(JsonSelectCtx_t *pCtx)
+{
+    if (pCtx->lCurOrd >= 0)
+    {
+        _closeProp(pCtx);
+        StringBuilder_appendRaw(&pCtx->sb, "}", 1);
+        if (pCtx->bJsonLines)
+            StringBuilder_appendRaw(&pCtx->sb, "\n", 1);
+    }
+    pCtx->lCurOrd = -1;
+}
+
+static void jsonAggStep(sqlite3_context *context, int argc, sqlite3_value **argv)
+{
+    char buf[48];
+    JsonSelectCtx_t *pCtx = sqlite3_aggregate_context(context, sizeof(JsonSelectCtx_t));
+    if (pCtx == NULL)
+    {
+        sqlite3_result_error_nomem(context);
+        return;
+    }
+
+    if (!pCtx->bInitialized)
+    {
+        StringBuilder_init(&pCtx->sb);
+        pCtx->lCurOrd = -1;
+        pCtx->bInitialized = true;
+        if (argc > 8 && sqlite3_value_type(argv[8]) == SQLITE_TEXT)
+            pCtx->bJsonLines = sqlite3_stricmp((const char *) sqlite3_value_text(argv[8]), "jsonl") == 0;
+        if (!pCtx->bJsonLines)
+            StringBuilder_appendRaw(&pCtx->sb, "[", 1);
+    }
+
+    sqlite3_int64 lOrd = sqlite3_value_int64(argv[0]);
+    if (lOrd != pCtx->lCurOrd)
+    {
+        _closeObject(pCtx);
+        if (pCtx->nObjects > 0 && !pCtx->bJsonLines)
+            StringBuilder_appendRaw(&pCtx->sb, ",", 1);
+        sqlite3_snprintf(sizeof(buf), buf, "{\"id\":%lld", sqlite3_value_int64(argv[1]));
+        StringBuilder_appendRaw(&pCtx->sb, buf, -1);
+        pCtx->lCurOrd = lOrd;
+        pCtx->nObjects++;
+    }
+
+    // Object header row
+    if (sqlite3_value_type(argv[2]) == SQLITE_NULL)
+        return;
+
+    sqlite3_int64 lPropID = sqlite3_value_int64(argv[2]);
+    if (lPropID != pCtx->lCurPropID)
+    {
+        _closeProp(pCtx);
+        StringBuilder_appendRaw(&pCtx->sb, ",", 1);
+        StringBuilder_appendJsonElem(&pCtx->sb, (const char *) sqlite3_value_text(argv[3]),
+                                     sqlite3_value_bytes(argv[3]));
+        StringBuilder_appendRaw(&pCtx->sb, ":", 1);
+        pCtx->bCurArray = sqlite3_value_int(argv[4]) != 0;
+        if (pCtx->bCurArray)
+            StringBuilder_appendRaw(&pCtx->sb, "[", 1);
+        pCtx->lCurPropID = lPropID;
+        pCtx->nPropValues = 0;
+    }
+    else
+        if (!pCtx->bCurArray)
+        {
+            // Scalar property: only first value is output
+            return;
+        }
+
+    if (pCtx->nPropValues > 0)
+        StringBuilder_appendRaw(&pCtx->sb, ",", 1);
+    _appendValue(context, pCtx, argv[5], sqlite3_value_int(argv[6]) & VTYPE_MASK, argv[7]);
+    pCtx->nPropValues++;
+}
+
+static void jsonAggFinal(sqlite3_context *context)
+{
+    JsonSelectCtx_t *pCtx = sqlite3_aggregate_context(context, 0);
+
+    // Mode is not known when there were no rows. flexi('select') does not call aggregate for empty result
+    if (pCtx == NULL || !pCtx->bInitialized)
+    {
+        sqlite3_result_text(context, "[]", -1, SQLITE_STATIC);
+        return;
+    }
+
+    _closeObject(pCtx);
+    if (!pCtx->bJsonLines)
+        StringBuilder_appendRaw(&pCtx->sb, "]", 1);
+
+    if (pCtx->sb.bErr)
+        sqlite3_result_error_nomem(context);
+    else
+        sqlite3_result_text(context, pCtx->sb.zBuf, (int) pCtx->sb.nUsed, SQLITE_TRANSIENT);
+    StringBuilder_clear(&pCtx->sb);
+}
+
+int json_select_func_init(
+        sqlite3 *db,
+        char **pzErrMsg,
+        const sqlite3_api_routines *pApi
+)
+{
+    int rc = SQLITE_OK;
+
+    rc = sqlite3_create_function(db, "flexi_json_agg", 9, SQLITE_UTF8, NULL,
+                                 NULL, jsonAggStep, jsonAggFinal);
+
+    return rc;
+}
@@ -0,0 +1,162 @@
+/*
+ * Per-connection cache of symbol names ([.sym_names] ID -> Value), used by C modules (flexi_json_agg,
+ * virtual tables) to decode symbol values without querying [.sym_names] for every cell and without calling Lua.
+ * Lua side keeps its own intern table (see NameCache.lua) and resets this cache on rollback
+ * via flexi_sym_names_reset().
+ *
+ * Names are loaded on demand and kept till connection is closed. Records in [.sym_names] are never
+ * deleted, so cached names do not become stale, except for names inserted by rolled back transaction.
+ *
+ * SQL functions:
+ * flexi_sym_name(NameID) - returns name text, or NULL
+ * flexi_sym_names_reset() - clears cache
+ */
+
+#include "../project_defs.h"
+#include "../util/hash.h"
+#include "sym_names.h"
+
+SQLITE_EXTENSION_INIT3
+
+typedef struct SymNameCache_t
+{
+    sqlite3 *db;
+
+    // NameID -> zero terminated text (sqlite3_malloc'ed)
+    Hash names;
+
+    struct SymNameCache_t *pNext;
+} SymNameCache_t;
+
+/*
+ * List of caches for all connections. Protected by SQLITE_MUTEX_STATIC_APP1
+ */
+static SymNameCache_t *g_pCaches = NULL;
+
+static SymNameCache_t *_findCache(sqlite3 *db)
+{
+    SymNameCache_t *result;
+    sqlite3_mutex *mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_APP1);
+    sqlite3_mutex_enter(mutex);
+    for (result = g_pCaches; result != NULL && result->db != db; result = result->pNext);
+    sqlite3_mutex_leave(mutex);
+    return result;
+}
+
+const char *flexi_sym_name_get(sqlite3 *db, sqlite3_int64 lNameID, int *pnBytes)
+{
+    SymNameCache_t *pCache = _findCache(db);
+    if (pCache == NULL)
+        return NULL;
+
+    DictionaryKey_t key = {.iKey = lNameID};
+    char *zName = HashTable_get(&pCache->names, key);
+    if (zName != NULL)
+    {
+        if (pnBytes != NULL)
+            *pnBytes = (int) strlen(zName);
+        return zName;
+    }
+
+    /*
+     * Statement is not kept between calls, as unfinalized statement would prevent connection from closing.
+     * Every name is loaded only once anyway
+     */
+    sqlite3_stmt *pStmt = NULL;
+    if (sqlite3_prepare_v2(db, "select [Value] from [.sym_names] where ID = ?1 limit 1;", -1,
+                           &pStmt, NULL) != SQLITE_OK)
+        return NULL;
+
+    sqlite3_bind_int64(pStmt, 1, lNameID);
+    if (sqlite3_step(pStmt) == SQLITE_ROW)
+    {
+        int nBytes = sqlite3_column_bytes(pStmt, 0);
+        zName = sqlite3_malloc(nBytes + 1);
+        if (zName != NULL)
+        {
+            memcpy(zName, sqlite3_column_text(pStmt, 0), nBytes);
+            zName[nBytes] = 0;
+            HashTable_set(&pCache->names, key, zName);
+            if (pnBytes != NULL)
+                *pnBytes = nBytes;
+        }
+    }
+    sqlite3_finalize(pStmt);
+
+    return zName;
+}
+
+void flexi_sym_names_reset(sqlite3 *db)
+{
+    SymNameCache_t *pCache = _findCache(db);
+    if (pCache != NULL)
+        HashTable_clear(&pCache->names);
+}
+
+static void symNameFunc(sqlite3_context *context, int argc, sqlite3_value **argv)
+{
+    if (sqlite3_value_type(argv[0]) == SQLITE_NULL)
+        return;
+
+    int nBytes = 0;
+    const char *zName = flexi_sym_name_get(sqlite3_context_db_handle(context), sqlite3_value_int64(argv[0]),
+                                           &nBytes);
+    if (zName != NULL)
+        sqlite3_result_text(context, zName, nBytes, SQLITE_TRANSIENT);
+}
+
+static void symNamesResetFunc(sqlite3_context *context, int argc, sqlite3_value **argv)
+{
+    flexi_sym_names_reset(sqlite3_context_db_handle(context));
+}
+
+/*
+ * Called when connection gets closed (as destructor of flexi_sym_name function)
+ */
+static void symNameCacheFree(void *pArg)
+{
+    SymNameCache_t *pCache = pArg;
+
+    sqlite3_mutex *mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_APP1);
+    sqlite3_mutex_enter(mutex);
+    SymNameCache_t **pp = &g_pCaches;
+    while (*pp != NULL && *pp != pCache)
+        pp = &(*pp)->pNext;
+    if (*pp != NULL)
+        *pp = pCache->pNext;
+    sqlite3_mutex_leave(mutex);
+
+    HashTable_clear(&pCache->names);
+    sqlite3_free(pCache);
+}
+
+int sym_names_func_init(
+        sqlite3 *db,
+        char **pzErrMsg,
+        const sqlite3_api_routines *pApi
+)
+{
+    int rc = SQLITE_OK;
+
+    SymNameCache_t *pCache = sqlite3_malloc(sizeof(SymNameCache_t));
+    if (pCache == NULL)
+        return SQLITE_NOMEM;
+    memset(pCache, 0, sizeof(*pCache));
+    pCache->db = db;
+    HashTable_init(&pCache->names, DICT_INT, sqlite3_free);
+
+    sqlite3_mutex *mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_APP1);
+    sqlite3_mutex_enter(mutex);
+    pCache->pNext = g_pCaches;
+    g_pCaches = pCache;
+    sqlite3_mutex_leave(mutex);
+
+    // Cache gets freed by function destructor, even if registration fails
+    rc = sqlite3_create_function_v2(db, "flexi_sym_name", 1, SQLITE_UTF8, pCache,
+                                    symNameFunc, NULL, NULL, symNameCacheFree);
+    if (rc == SQLITE_OK)
+        rc = sqlite3_create_function(db, "flexi_sym_names_reset", 0, SQLITE_UTF8, NULL,
+                                     symNamesResetFunc, NULL, NULL);
+
+    return rc;
+}
@@ -0,0 +1,31 @@
+// Per-connection cache of [.sym_names] values, shared by C modules
+
+#ifndef SQLITE_EXTENSIONS_SYM_NAMES_H
+#define SQLITE_EXTENSIONS_SYM_NAMES_H
+
+#include "../../lib/sqlite/sqlite3ext.h"
+
+SQLITE_EXTENSION_INIT3
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Returns text of symbol name by its ID, or NULL if name does not exist (or on out of memory).
+ * Returned string is owned by the cache and stays valid until cache is reset
+ * (see flexi_sym_names_reset), so it should be copied if needed longer than current call
+ */
+const char *flexi_sym_name_get(sqlite3 *db, sqlite3_int64 lNameID, int *pnBytes);
+
+/*
+ * Drops all cached names for the connection. Called by Lua DBContext when transaction
+ * which inserted new names gets rolled back, as rolled back IDs may be reused
+ */
+void flexi_sym_names_reset(sqlite3 *db);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //SQLITE_EXTENSIONS_SYM_NAMES_H
@@ -6,19 +6,173 @@
 --[[
 Implements access control storage and permission verification
 Used as a singleton object by DBContext
+
+Access rules (defined on class or property level) are compiled into bit masks of allowed and denied
+CRUDE operations, per role and per user. Compiled rules are kept until schema gets changed.
+Effective permissions of specific user are calculated as bitwise OR of allowed masks of all user's roles,
+excluding explicitly denied operations ('N' or '-'). Effective permissions are cached per user (user ID + roles),
+so that switching current user does not require recalculation.
 ]]
 
 local class = require 'pl.class'
 local tablex = require 'pl.tablex'
 local schema = require 'schema'
+local Constants = require 'Constants'
+local bits = type(jit) == 'table' and require('bit') or require('bit32')
+local json = cjson or require 'cjson'
+
+-- Bit masks for CRUDE operations
+local OP_MASK = {
+    [Constants.OPERATION.CREATE] = 0x01,
+    [Constants.OPERATION.READ] = 0x02,
+    [Constants.OPERATION.UPDATE] = 0x04,
+    [Constants.OPERATION.DELETE] = 0x08,
+    [Constants.OPERATION.EXECUTE] = 0x10,
+}
+
+local ALL_OPS = 0x1F
+
+-- Compiles permission string (e.g. 'CRU', '*', 'N') into pair of bit masks
+---@param permissions string
+---@return number, number @comment allowed and denied operations
+local function compilePermissions(permissions)
+    permissions = string.upper(tostring(permissions))
+
+    if string.find(permissions, '[N%-]') then
+        return 0, ALL_OPS
+    end
+
+    if string.find(permissions, '*', 1, true) then
+        return ALL_OPS, 0
+    end
+
+    local allowed = 0
+    for op, mask in pairs(OP_MASK) do
+        if string.find(permissions, op, 1, true) then
+            allowed = bits.bor(allowed, mask)
+        end
+    end
+    return allowed, 0
+end
+
+---@class CompiledAccessRules
+---@field roles table<string, number[]> @comment role name -> { allowed mask, denied mask }
+---@field users table<string, number[]> @comment user ID -> { allowed mask, denied mask }
+
+-- Compiles access rules into bit masks
+---@param accessRules table | nil
+---@return CompiledAccessRules | nil @comment nil if there are no rules, i.e. everything is allowed
+local function compileAccessRules(accessRules)
+    if not accessRules or (type(accessRules.roles) ~= 'table' and type(accessRules.users) ~= 'table') then
+        return nil
+    end
+
+    ---@type CompiledAccessRules
+    local result = { roles = {}, users = {} }
+
+    for _, kind in ipairs { 'roles', 'users' } do
+        if type(accessRules[kind]) == 'table' then
+            for name, permissions in pairs(accessRules[kind]) do
+                result[kind][tostring(name)] = { compilePermissions(permissions) }
+            end
+        end
+    end
+
+    -- TODO hook
+
+    return result
+end
+
+-- Returns user roles as array of strings. If user has no roles, '*' is assumed
+---@param userInfo UserInfo
+---@return string[]
+local function getUserRoles(userInfo)
+    local roles = userInfo and userInfo.Roles
+    if roles == nil or (type(roles) == 'table' and #roles == 0) then
+        return { '*' }
+    end
+
+    if type(roles) ~= 'table' then
+        return { tostring(roles) }
+    end
+
+    return tablex.map(tostring, roles)
+end
+
+-- Calculates bit mask of operations allowed for the user by compiled rules
+---@param rules CompiledAccessRules | nil
+---@param userID string
+---@param roles string[]
+---@return number
+local function getEffectiveMask(rules, userID, roles)
+    if not rules then
+        return ALL_OPS
+    end
+
+    local allowed, denied, matched = 0, 0, false
+
+    local function apply(masks)
+        if masks then
+            matched = true
+            allowed = bits.bor(allowed, masks[1])
+            denied = bits.bor(denied, masks[2])
+        end
+    end
+
+    if roles[1] ~= '*' then
+        apply(rules.roles['*'])
+    end
+    for _, role in ipairs(roles) do
+        apply(rules.roles[role])
+    end
+    apply(rules.users[userID])
+
+    -- No rules applicable to the user - access is not restricted
+    if not matched then
+        return ALL_OPS
+    end
+
+    return bits.band(allowed, bits.bnot(denied))
+end
+
+-- Returns list of access subjects for the user, in format used by [.object_access].Subject
+---@param userID string
+---@param roles string[]
+---@return string[]
+local function getAccessSubjects(userID, roles)
+    local result = { 'u:' .. userID, 'r:*' }
+    for _, role in ipairs(roles) do
+        if role ~= '*' then
+            table.insert(result, 'r:' .. role)
+        end
+    end
+    return result
+end
+
+---@class UserPermissions
+---@field userID string
+---@field roles string[]
+---@field subjects string @comment JSON array of access subjects (see [.object_access])
+---@field classes table<number, number> @comment class ID -> bit mask of allowed operations
+---@field props table<number, number> @comment property ID -> bit mask of allowed operations
 
 ---@class AccessControl
+---@field DBContext DBContext
+---@field ClassRules table<number, CompiledAccessRules | boolean> @comment compiled class rules (false if no rules)
+---@field PropRules table<number, CompiledAccessRules | boolean> @comment compiled property rules (false if no rules)
+---@field UserPermissions table<string, UserPermissions> @comment effective permissions by user key
+---@field UserPermissionsCount number @comment number of entries in UserPermissions
 local AccessControl = class()
 
+-- Max number of users (user ID + roles combinations) with cached permissions. When exceeded, cache is reset,
+-- so that long living connection serving many users does not grow it unlimitedly
+AccessControl.MAX_CACHED_USERS = 100
+
 -- constructor
 ---@param DBContext DBContext
 function AccessControl:_init(DBContext)
     self.DBContext = DBContext
+    self:flushCache()
 end
 
 --- Ensures that given user is granted permission to create a new class
@@ -31,9 +185,9 @@ end
 --[[
 Checks if given user's roles match given accessRules (coming from class, property, or object)
 Returns true or false
-accessRules may have 3 (optional) elements: roles, users, hook. If present, all of them are checked
-to determine if there is any 'access denied' setting. 'Access denied' has highest priority
-If userInfo or userInfo.roles is nil or empty, it is treated as '*' - access to everything
+accessRules may have 3 (optional) elements: roles, users, hook. Permissions of all matching roles and user
+are combined. Explicit 'access denied' ('N' or '-') has highest priority
+If userInfo or userInfo.Roles is nil or empty, it is treated as '*' - access to everything
 
 accessRules are defined on class or property level
 ]]
@@ -42,50 +196,10 @@ accessRules are defined on class or property level
 ---@param op string @comment One of these characters 'CRUDE' (Create, Read, Update, Delete, Execute)
 ---@return boolean
 function AccessControl:checkUserPermission(userInfo, accessRules, op)
-
-    local function checkPerm(permissions)
-        local ch = string.match(permissions, '[N-]')
-        if not ch then
-            return false
-        end
-
-        ch = string.match(permissions, op)
-        return ch ~= nil
-    end
-
-    local userRoles
-    if not userInfo or not userInfo.roles then
-        userRoles = { '*' }
-    else
-        userRoles = userInfo.userRoles
-    end
-
-    if accessRules then
-        -- users
-        if type(accessRules.users) == 'table' and accessRules.users[userInfo.ID] then
-            if not checkPerm(accessRules.users[userInfo.ID]) then
-                return false
-            end
-        end
-
-        -- roles
-        if type(accessRules.roles) == 'table' then
-            -- Get intersection of accessRules.roles and userInfo.Roles
-            local rr = tablex.intersection(accessRules.roles, userRoles)
-            for _, rolePermissions in pairs(rr) do
-                if not checkPerm(rolePermissions) then
-                    return false
-                end
-            end
-        end
-
-        -- hook
-        if type(accessRules.hook) == 'string' then
-            -- TODO Call function by name. Check result
-        end
-    end
-
-    return true
+    local mask = getEffectiveMask(compileAccessRules(accessRules),
+            tostring(userInfo and userInfo.ID), getUserRoles(userInfo))
+    local opMask = OP_MASK[op] or ALL_OPS
+    return bits.band(mask, opMask) == opMask
 end
 
 -- Similar to mayUser but throws 'Non authorized' error if mayUser returns false
@@ -103,28 +217,143 @@ end
 
 -- Get aggregated permissions for the given accessRules
 ---@param accessRules AccessRules
+---@return CompiledAccessRules | nil
 function AccessControl:getPermissions(accessRules)
+    return compileAccessRules(accessRules)
+end
+
+-- Returns cached effective permissions for the given user. Permissions are cached by user ID and roles
+---@param userInfo UserInfo
+---@return UserPermissions
+function AccessControl:getUserPermissions(userInfo)
+    -- Fast path: same user as on last call
+    local last = self.lastUser
+    if last and last.userInfo == userInfo and last.roles == userInfo.Roles and last.ID == userInfo.ID then
+        return last.permissions
+    end
+
+    local userID = tostring(userInfo.ID)
+    local roles = getUserRoles(userInfo)
+    local sortedRoles = tablex.copy(roles)
+    table.sort(sortedRoles)
+    local key = userID .. '|' .. table.concat(sortedRoles, ',')
 
+    local result = self.UserPermissions[key]
+    if not result then
+        if self.UserPermissionsCount >= AccessControl.MAX_CACHED_USERS then
+            self.UserPermissions = {}
+            self.UserPermissionsCount = 0
+        end
+        self.UserPermissionsCount = self.UserPermissionsCount + 1
+        result = { userID = userID, roles = roles, classes = {}, props = {},
+                   subjects = json.encode(getAccessSubjects(userID, roles)) }
+        self.UserPermissions[key] = result
+    end
+
+    self.lastUser = { userInfo = userInfo, roles = userInfo.Roles, ID = userInfo.ID, permissions = result }
+    return result
+end
+
+-- Raises 'Not authorized' error if op is not allowed by mask
+---@param mask number
+---@param op string
+local function ensureMask(mask, op)
+    local opMask = OP_MASK[op] or ALL_OPS
+    if bits.band(mask, opMask) ~= opMask then
+        -- TODO Log details. Message with specific info
+        error('Not authorized')
+    end
 end
 
 -- Ensures that current user has required permission for class level
 function AccessControl:ensureCurrentUserAccessForClass(classID, op)
-    local classDef = self.DBContext:getClassDef(classID)
-    self:ensureUserPermission(self.DBContext.UserInfo, classDef.D.accessRules, op)
+    local perms = self:getUserPermissions(self.DBContext.UserInfo)
+    local mask = perms.classes[classID]
+    if not mask then
+        local rules = self.ClassRules[classID]
+        if rules == nil then
+            local classDef = self.DBContext:getClassDef(classID)
+            rules = compileAccessRules(classDef.D.accessRules) or false
+            self.ClassRules[classID] = rules
+        end
+        mask = getEffectiveMask(rules or nil, perms.userID, perms.roles)
+        perms.classes[classID] = mask
+    end
+    ensureMask(mask, op)
 end
 
 -- Ensures that current user has required permission for property level
 function AccessControl:ensureCurrentUserAccessForProperty(propID, op)
     assert(type(propID) == 'number')
-    local propDef = self.DBContext.ClassProps[propID]
-    assert(propDef)
-    self:ensureUserPermission(self.DBContext.UserInfo, propDef.D.accessRules, op)
+    local perms = self:getUserPermissions(self.DBContext.UserInfo)
+    local mask = perms.props[propID]
+    if not mask then
+        local rules = self.PropRules[propID]
+        if rules == nil then
+            local propDef = self.DBContext.ClassProps[propID]
+            assert(propDef)
+            rules = compileAccessRules(propDef.D.accessRules) or false
+            self.PropRules[propID] = rules
+        end
+        mask = getEffectiveMask(rules or nil, perms.userID, perms.roles)
+        perms.props[propID] = mask
+    end
+    ensureMask(mask, op)
+end
+
+--[[ Returns SQL predicate to filter [.objects] rows by row level access rules (see [.object_access]).
+Objects without access rules are not restricted. Objects with access rules are available only if
+any of user's subjects (user ID or roles) is granted requested operation, and none is denied.
+Unlike class and property rules, if none of object rules matches the user, access is denied.
+]]
+---@param objectsTable string @comment name or alias of [.objects] table in the query
+---@param op string @comment 'C', 'R', 'U', 'D', 'E'
+---@param subjectsExpr string @comment SQL expression which returns JSON array of subjects, e.g. parameter name
+---@return string
+function AccessControl.getRowAccessPredicate(objectsTable, op, subjectsExpr)
+    local opMask = OP_MASK[op] or ALL_OPS
+    local subjectCond = string.format([[oa.ObjectID = %s.ObjectID and oa.Subject in (select value from json_each(%s))]],
+            objectsTable, subjectsExpr)
+    return string.format([[((%s.ctlo & %d) = 0 or (exists (select 1 from [.object_access] oa
+        where %s and (oa.Allowed & %d) <> 0) and not exists (select 1 from [.object_access] oa
+        where %s and (oa.Denied & %d) <> 0)))]],
+            objectsTable, Constants.CTLO_FLAGS.HAS_ACCESS_RULES, subjectCond, opMask, subjectCond, opMask)
+end
+
+-- Returns JSON array of access subjects for the current user, to be used with getRowAccessPredicate
+---@return string
+function AccessControl:getCurrentUserAccessSubjects()
+    return self:getUserPermissions(self.DBContext.UserInfo).subjects
+end
+
+-- Saves object level access rules to [.object_access]
+---@param objectID number
+---@param accessRules table | nil @comment [.objects].MetaData.accessRules
+function AccessControl:saveObjectAccessRules(objectID, accessRules)
+    self.DBContext:execStatement([[delete from [.object_access] where ObjectID = :ObjectID;]],
+            { ObjectID = objectID })
+
+    local rules = compileAccessRules(accessRules)
+    if not rules then
+        return
+    end
+
+    for kind, prefix in pairs { roles = 'r:', users = 'u:' } do
+        for name, masks in pairs(rules[kind]) do
+            self.DBContext:execStatement([[insert into [.object_access] (ObjectID, Subject, Allowed, Denied)
+                values (:ObjectID, :Subject, :Allowed, :Denied);]],
+                    { ObjectID = objectID, Subject = prefix .. name, Allowed = masks[1], Denied = masks[2] })
+        end
+    end
 end
 
--- Reset temp data
+-- Resets compiled rules and cached user permissions. Called on schema changes
 function AccessControl:flushCache()
-    self.ClassPermissions = {}
-    self.PropPermissions = {}
+    self.ClassRules = {}
+    self.PropRules = {}
+    self.UserPermissions = {}
+    self.UserPermissionsCount = 0
+    self.lastUser = nil
 end
 
 --[[
@@ -374,8 +374,10 @@ function ClassDef:_init(params)
 
         -- Load from .class_props
         for propRow in self.DBContext:loadRows([[
-        select PropertyID, ClassID, NameID, Property, ctlv, ctlvPlan,
-            Deleted, SearchHitCount, NonNullCount from [flexi_prop] cp where cp.ClassID = :ClassID;]],
+        select ID as PropertyID, ClassID, NameID,
+            coalesce([Name], (select [Value] from [.sym_names] where ID = cp.NameID limit 1)) as Property,
+            ctlv, ctlvPlan, Deleted, SearchHitCount, NonNullCount
+            from [.class_props] cp where cp.ClassID = :ClassID and cp.Deleted = 0;]],
                 { ClassID = self.ClassID }) do
             self:loadPropertyFromDB(propRow, assert(self.D.properties[tostring(propRow.PropertyID)], 'Null property definition'))
         end
@@ -425,6 +427,20 @@ function ClassDef:AddNewProperty(propName, propJsonData)
     return prop
 end
 
+--- Returns class properties which are columns of flexi_data virtual table for this class, ordered by property ID.
+--- Column index (starting from 0) is position in this list
+---@return PropertyDef[]
+function ClassDef:getDataColumns()
+    local result = {}
+    for _, prop in pairs(self.Properties) do
+        table.insert(result, prop)
+    end
+    table.sort(result, function(a, b)
+        return a.ID < b.ID
+    end)
+    return result
+end
+
 -- Fills MixinProperties with properties from mixin classes, if applicable
 function ClassDef:initMixinProperties()
     self.MixinProperties = {}
@@ -945,6 +961,44 @@ function ClassDef:lookupObjectsByProperty(propDef, v, fetchLimit)
     end
 end
 
+--[[ Batched version of lookupObjectsByProperty. Finds IDs of objects which have propDef value in the given list,
+using single query (values are passed as JSON array and joined via json_each). Objects are not loaded
+]]
+---@param propDef PropertyDef
+---@param values any[]
+---@return table<any, number> @comment map of property value to object ID
+function ClassDef:lookupObjectIDsByProperty(propDef, values)
+    assert(propDef)
+    local result = {}
+    if #values == 0 then
+        return result
+    end
+
+    local indexMask = propDef:getIndexMask()
+    local sql
+    if self.ColMapActive and propDef.ColMap then
+        sql = string.format([[select [%s] as [Value], ObjectID from [.objects] where ClassID = :classID
+            and (ctlo & :ctloMask) = :ctloMask and [%s] in (select [value] from json_each(:values));]],
+                propDef.ColMap, propDef.ColMap)
+    else
+        -- Conditions on ctlv must match partial indexes on [.ref-values]
+        local ctlvCond = ''
+        if indexMask == 8 then
+            ctlvCond = ' and (ctlv & 8)'
+        elseif indexMask ~= 0 then
+            ctlvCond = ' and (ctlv & 0xF0)'
+        end
+        sql = string.format([[select [Value], ObjectID from [.ref-values] where PropertyID = :propID%s
+            and [Value] in (select [value] from json_each(:values));]], ctlvCond)
+    end
+
+    for row in self.DBContext:loadRows(sql, { classID = self.ClassID, propID = propDef.ID, ctloMask = indexMask,
+                                              values = json.encode(values) }) do
+        result[row.Value] = row.ObjectID
+    end
+    return result
+end
+
 ---@param udidValue string | number
 ---@param mustExist boolean | nil
 ---@return DBObject
@@ -34,6 +34,9 @@ local Constants = {
     bit 8 - invalid value
     bit 9 - deleted
     bit 10 - no track changes
+    bit 11 - formula
+    bit 12 - value is compressed (see PropertyDef:getCompressThreshold)
+    bit 13 - value is kept in [.value_store], Value holds its hash (see PropertyDef:getDedupThreshold)
     ]]
     CTLV_FLAGS = {
         VTYPE_MASK = 7,
@@ -56,6 +59,8 @@ local Constants = {
         DELETED = 0x0200,
         NO_TRACK_CHANGES = 0x0400,
         FORMULA = 0x0800,
+        COMPRESSED = 0x1000,
+        DEDUP = 0x2000,
         INDEX_AND_REFS_MASK = 0x00F0,
         ALL_REFS_MASK = 0x00E0,
     },
@@ -114,6 +119,25 @@ local Constants = {
         EXPRESSION = 'E',
     },
 
+    -- Constraint operators passed to virtual table xBestIndex (SQLITE_INDEX_CONSTRAINT_*).
+    -- NE, ISNOT, ISNOTNULL, ISNULL and IS are passed by SQLite 3.21+ only
+    INDEX_CONSTRAINT = {
+        EQ = 2,
+        GT = 4,
+        LE = 8,
+        LT = 16,
+        GE = 32,
+        MATCH = 64,
+        LIKE = 65,
+        GLOB = 66,
+        REGEXP = 67,
+        NE = 68,
+        ISNOT = 69,
+        ISNOTNULL = 70,
+        ISNULL = 71,
+        IS = 72,
+    },
+
     -- Epsilon value for float equality comparison
     EPSILON = 1E-5,
     --EPSILON = 1E-12,
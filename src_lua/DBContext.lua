@@ -29,12 +29,14 @@ local ClassDef = require('ClassDef')
 local PropertyDef = require('PropertyDef')
 local UserInfo = require('UserInfo')
 local AccessControl = require 'AccessControl'
+local ObjectCache = require 'ObjectCache'
+local NameCache = require 'NameCache'
 local DBObject = require 'DBObject'
 local RefDataManager = require 'RefDataManager'
 local Constants = require 'Constants'
 local DictCI = require('Util').DictCI
+local wallClock = require('Util').wallClock
 local sqlite3 = sqlite3 or require 'sqlite3'
-local List = require 'pl.List'
 local Events = require 'EventEmitter'
 local string = _G.string
 local table = _G.table
@@ -47,14 +49,20 @@ sqlite3.DONE = 101
 local flexiRel = require 'flexi_rel_vtable'
 local dbg = nil -- future reference to 'debugger.lua'
 
----@class ActionQueue : List
+--[[ FIFO queue of actions to be run at the end of request. Items are kept in array part of the queue
+with first/last indexes, so that both enqueue and dequeue are O(1)
+]]
+---@class ActionQueue
 ---@field DBContext DBContext
-local ActionQueue = class(List)
+---@field first number
+---@field last number
+---@field batches table<string, table>
+local ActionQueue = class()
 
 ---@param DBContext DBContext
 function ActionQueue:_init(DBContext)
-    self:super()
     self.DBContext = DBContext
+    self:clear()
 end
 
 ---@class ActionQueueItem
@@ -64,27 +72,66 @@ end
 ---@param act function
 function ActionQueue:enqueue(act, params)
     ---@type ActionQueueItem
-    local item = { action = act, params = params}
-    self:append(item)
+    local item = { action = act, params = params }
+    self.last = self.last + 1
+    self[self.last] = item
+end
+
+--[[ Adds item to the batch identified by key. Batch is queued as a single action when its first item is added,
+and act gets called once, with array of all items collected for the batch by the time it is dequeued.
+Used for set-based processing of deferred values (e.g. resolving references by UDID)
+]]
+---@param key string
+---@param act fun(items: any[], DBContext: DBContext)
+---@param item any
+function ActionQueue:enqueueBatch(key, act, item)
+    local batch = self.batches[key]
+    if not batch then
+        batch = {}
+        self.batches[key] = batch
+        self:enqueue(function(items, DBContext)
+            -- Items added after this point go to the new batch
+            self.batches[key] = nil
+            act(items, DBContext)
+        end, batch)
+    end
+    table.insert(batch, item)
 end
 
----@return function
+---@return ActionQueueItem | nil
 function ActionQueue:dequeue()
-    if #self > 0 then
-        local result = self[1]
-        self:remove(1)
-        return result
+    local first = self.first
+    if first > self.last then
+        return nil
     end
 
-    return nil
+    local result = self[first]
+    self[first] = nil
+    self.first = first + 1
+    return result
+end
+
+---@return number
+function ActionQueue:count()
+    return self.last - self.first + 1
+end
+
+function ActionQueue:clear()
+    for i = self.first or 1, self.last or 0 do
+        self[i] = nil
+    end
+    self.first = 1
+    self.last = 0
+    self.batches = {}
 end
 
 function ActionQueue:run()
-    while #self > 0 do
-        local item = self:dequeue()
-        if item and item.action then
+    local item = self:dequeue()
+    while item do
+        if item.action then
             item.action(item.params, self.DBContext)
         end
+        item = self:dequeue()
     end
 end
 
@@ -105,6 +152,18 @@ end
 
 ---@class DBContextConfig
 ---@field createVirtualTable boolean
+---@field busyTimeout number
+---@field busyRetries number
+---@field groupCommit boolean
+---@field groupCommitMaxBatch number
+---@field groupCommitMaxDelay number
+---@field budgetTime number
+---@field budgetRows number
+---@field budgetObjects number
+---@field budgetCheckSteps number
+---@field objectCacheSize number
+---@field crossRequestCache boolean
+---@field preloadNames boolean
 
 ---@class DBContext
 ---@field db userdata @comment sqlite3 - sqlite database handler
@@ -112,6 +171,7 @@ end
 ---@field MemDB table
 ---@field UserInfo UserInfo
 ---@field Classes DictCI
+---@field ClassVersions table<number, number> @comment [.classes].Version of classes loaded from database, by class ID
 ---@field Functions table @comment TODO use Function class
 ---@field ClassProps table<number, PropertyDef>
 ---@field Objects table <number, DBObject>
@@ -127,6 +187,14 @@ end
 ---@field debugMode boolean
 ---@field NAMClasses DictCI @comment new-and-modified classes before committing schema changes
 ---@field events Events
+---@field ActionStats table<string, ActionStats>
+---@field GroupCommit GroupCommitState
+---@field WriteStats table @comment skippedWrites - number of skipped writes of unchanged data
+---@field Budget CallBudget | nil
+---@field ObjectCache ObjectCache
+---@field NameCache NameCache
+---@field DataVersion number @comment last known PRAGMA data_version
+---@field OpenCursors table<userdata, boolean> @comment ad hoc statements of not completed iterations
 local DBContext = class()
 
 DBContext.EVENT_NAMES = {
@@ -151,6 +219,10 @@ function DBContext:_init(db)
     -- Collection of classes. Each class is referenced twice - by ID and Name
     self.Classes = DictCI()
 
+    -- Versions of loaded classes, by class ID. [.classes].Version is incremented by triggers on every change
+    -- of class or its properties, so unchanged classes are kept after schema version change
+    self.ClassVersions = {}
+
     -- Global list of registered functions. Each function is referenced twice - by ID and name
     self.Functions = {}
 
@@ -174,9 +246,81 @@ function DBContext:_init(db)
 
     -- Can be overridden by flexi('config', ...)
     self.config = {
-        createVirtualTable = false
+        createVirtualTable = false,
+        -- Initial busy timeout (in milliseconds) for BEGIN IMMEDIATE. Gets doubled on every retry
+        busyTimeout = 50,
+        -- Max number of retries to obtain write lock
+        busyRetries = 5,
+        -- If true, sync of write actions to disk is shared by group of actions (see DBContext:getGroupCommitLevel)
+        groupCommit = false,
+        -- Max number of write actions in group
+        groupCommitMaxBatch = 100,
+        -- Max age of group, in milliseconds
+        groupCommitMaxDelay = 50,
+        -- Default per-call budgets (0 = unlimited). Can be overridden for single call by flexi('budget', ...)
+        -- Max wall time, in milliseconds
+        budgetTime = 0,
+        -- Max number of rows scanned by queries
+        budgetRows = 0,
+        -- Max number of objects loaded
+        budgetObjects = 0,
+        -- Number of SQLite VM instructions between time budget checks
+        budgetCheckSteps = 10000,
+        -- Max number of clean objects kept in Objects cache during request (0 - unlimited)
+        objectCacheSize = 10000,
+        -- If true, objects loaded by read-only actions are kept between calls (see DBContext:validateDataCache)
+        crossRequestCache = false,
+        -- If true, all symbol names are loaded into NameCache on first call. Otherwise names are loaded on demand
+        preloadNames = false,
+        -- Min length (in bytes) of value to be stored compressed, for properties with 'compress = true'
+        compressThreshold = 1024,
+        -- Min length (in bytes) of value to be stored in [.value_store], for properties with 'dedup = true'
+        dedupThreshold = 256,
     }
 
+    ---@type ObjectCache
+    self.ObjectCache = ObjectCache(self.config.objectCacheSize)
+
+    ---@type NameCache
+    self.NameCache = NameCache(self)
+
+    -- true if compress()/uncompress() SQL functions are available. nil - not checked yet
+    self.compressionSupported = nil
+
+    -- true if [.value_store] and sha3() SQL function are available. nil - not checked yet
+    self.dedupSupported = nil
+
+    -- true if flexi_json_cells table valued function is available. nil - not checked yet
+    self.jsonCellsSupported = nil
+
+    -- Uncompresses packed value. Passed to PackedDBValue, so that DBValue does not hold reference to DBContext
+    self.unpackValue = function(packed)
+        return self:uncompressValue(packed)
+    end
+
+    -- Loads value from [.value_store] by its hash. Passed to PackedDBValue
+    self.loadStoredValue = function(hash)
+        return self:getStoredValue(hash)
+    end
+
+    ---@type CallBudget
+    self.Budget = nil
+
+    ---@type GroupCommitState
+    self.GroupCommit = { pending = 0, started = 0, failures = 0 }
+
+    -- Per-action call and lock contention counters
+    self.ActionStats = {}
+
+    -- Write counters
+    self.WriteStats = { skippedWrites = 0 }
+
+    self.OpenCursors = {}
+
+    -- Objects loaded by PrefetchObjects during current flexi call, by ID
+    ---@type table<number, DBObject> | nil
+    self.PrefetchedObjects = nil
+
     self.Vars = {}
 
     -- flexi
@@ -222,17 +366,30 @@ properties will be loaded on demand. Also, when object gets edited, its entire c
 ---@param objRow table | nil @comment row of [.objects]
 ---@return DBObject
 function DBContext:LoadObject(id, propIds, forUpdate, objRow)
-    local result = self.Objects[id]
+    local result = self.Objects[id] or (self.PrefetchedObjects and self.PrefetchedObjects[id])
 
     if not result then
         local op = forUpdate and Constants.OPERATION.UPDATE or Constants.OPERATION.READ
         -- TODO Check access rules for class and specific object
+        self:budgetObjectLoaded()
         result = DBObject({ ID = id, PropIDs = propIds, DBContext = self, ObjRow = objRow }, op)
-        self.Objects[id] = result
+        self:cacheObject(id, result)
+    else
+        self.ObjectCache:touch(id)
     end
     return result
 end
 
+-- Puts loaded object to Objects cache. If cache exceeds its capacity, least recently used clean objects
+-- get evicted
+---@param id number
+---@param obj DBObject
+function DBContext:cacheObject(id, obj)
+    self.Objects[id] = obj
+    self.ObjectCache:add(id)
+    self.ObjectCache:evict(self.Objects, self.DirtyObjects)
+end
+
 -- Starts editing an existing objects
 ---@param id number
 ---@return DBObject
@@ -291,46 +448,474 @@ function DBContext:checkSqlite(opResult)
     end
 end
 
+-- SQLite result codes which indicate lock contention
+local SQLITE_BUSY = 5
+local SQLITE_LOCKED = 6
+
+---@class ActionStats
+---@field calls number
+---@field errors number
+---@field busyRetries number @comment number of retries of BEGIN IMMEDIATE because of SQLITE_BUSY/SQLITE_LOCKED
+---@field busyFailures number @comment number of calls failed because write lock was not obtained
+---@field lockWaitTime number @comment total time (in seconds) spent on waiting for write lock
+---@field budgetExceeded number @comment number of calls cancelled because of exceeded budget
+
+-- Returns statistics record for the given action name
+---@param action string
+---@return ActionStats
+function DBContext:getActionStats(action)
+    local result = self.ActionStats[action]
+    if not result then
+        result = { calls = 0, errors = 0, busyRetries = 0, busyFailures = 0, lockWaitTime = 0, budgetExceeded = 0 }
+        self.ActionStats[action] = result
+    end
+    return result
+end
+
+-- Returns true if compression functions (see src/misc/compress.c) are registered for the connection.
+-- They may be missing when Lua code runs with plain SQLite connection (e.g. in unit tests),
+-- and then values are stored uncompressed
+---@return boolean
+function DBContext:isCompressionSupported()
+    if self.compressionSupported == nil then
+        local stmt = self.db:prepare [[select uncompress(compress(''));]]
+        self.compressionSupported = stmt ~= nil
+        if stmt then
+            stmt:finalize()
+        end
+    end
+    return self.compressionSupported
+end
+
+-- Uncompresses value stored with CTLV_FLAGS.COMPRESSED flag
+---@param packed string
+---@return string
+function DBContext:uncompressValue(packed)
+    local stmt = self:getStatement [[select uncompress(:v);]]
+    stmt:bind_names { v = packed }
+    local result
+    for v in stmt:urows() do
+        result = v
+    end
+    return result
+end
+
+-- Returns true if object ID set functions (see src/misc/idset.c) are registered for the connection.
+-- Otherwise, 'or' and 'not' filters are evaluated by Lua only
+---@return boolean
+function DBContext:isIdSetSupported()
+    if self.idSetSupported == nil then
+        local stmt = self.db:prepare [[select flexi_idset_union(flexi_idset(1), flexi_idset(2));]]
+        self.idSetSupported = stmt ~= nil
+        if stmt then
+            stmt:finalize()
+        end
+    end
+    return self.idSetSupported
+end
+
+-- Returns true if flexi_json_cells (see src/misc/json_cells.c) is registered for the connection.
+-- Otherwise, payload of 'import data' is decoded by cjson
+---@return boolean
+function DBContext:isJsonCellsSupported()
+    if self.jsonCellsSupported == nil then
+        local stmt = self.db:prepare [[select 1 from flexi_json_cells(null);]]
+        self.jsonCellsSupported = stmt ~= nil
+        if stmt then
+            stmt:finalize()
+        end
+    end
+    return self.jsonCellsSupported
+end
+
+-- Returns true if values can be deduplicated, i.e. [.value_store] table exists (database schema
+-- is up to date) and sha3() function (see src/misc/shathree.c) is registered for the connection
+---@return boolean
+function DBContext:isDedupSupported()
+    if self.dedupSupported == nil then
+        local stmt = self.db:prepare [[select sha3(''), (select 1 from [.value_store] limit 1);]]
+        self.dedupSupported = stmt ~= nil
+        if stmt then
+            stmt:finalize()
+        end
+    end
+    return self.dedupSupported
+end
+
+-- Returns value stored in [.value_store] by its hash
+---@param hash string
+---@return string
+function DBContext:getStoredValue(hash)
+    local stmt = self:getStatement [[select [Value] from [.value_store] where Hash = :h;]]
+    stmt:bind_names { h = hash }
+    local result
+    for v in stmt:urows() do
+        result = v
+    end
+    return result
+end
+
+--[[ Removes unreferenced values from [.value_store]. RefCount is maintained by triggers on [.ref-values],
+but is recalculated here as [.ref-values] rows replaced by INSERT OR REPLACE do not fire delete triggers
+(unless recursive_triggers is on)
+]]
+---@return number @comment number of removed values
+function DBContext:collectStoredValues()
+    if not self:isDedupSupported() then
+        return 0
+    end
+
+    -- Condition on ctlv must match partial index idxValuesByStoredHash (8192 = CTLV_FLAGS.DEDUP)
+    self:execStatement [[update [.value_store] set RefCount = (select count(*) from [.ref-values] v
+        where v.[Value] = [.value_store].Hash and v.ctlv & 8192);]]
+    self:execStatement [[delete from [.value_store] where RefCount <= 0;]]
+    return self.db:changes()
+end
+
+--[[ Removes [.cell_metadata] rows which do not have matching [.ref-values] row anymore.
+Normally such rows are removed by DBProperty on value deletion, but values removed directly
+(e.g. via [.ref-values] or property/class purge) may leave them orphaned
+]]
+---@return number @comment number of removed rows
+function DBContext:collectCellMetaData()
+    self:execStatement [[delete from [.cell_metadata] where not exists (select 1 from [.ref-values] v
+        where v.ObjectID = [.cell_metadata].ObjectID and v.PropertyID = [.cell_metadata].PropertyID
+        and v.PropIndex = [.cell_metadata].PropIndex);]]
+    return self.db:changes()
+end
+
+-- Counts writes to [.objects], [.ref-values] and index tables which were skipped because
+-- their input values have not changed
+---@param count number
+function DBContext:countSkippedWrites(count)
+    self.WriteStats.skippedWrites = self.WriteStats.skippedWrites + count
+end
+
+--[[ Starts write transaction using BEGIN IMMEDIATE, so that write lock is obtained upfront,
+rather than on first write (which may fail with SQLITE_BUSY in the middle of action).
+If database is locked, retries with exponential backoff: busy timeout starts with config.busyTimeout
+and gets doubled on every attempt, up to config.busyRetries attempts.
+Busy timeout set by application is restored before return
+]]
+---@param stats ActionStats
+function DBContext:beginWriteTransaction(stats)
+    local savedTimeout = 0
+    for v in self.db:urows 'pragma busy_timeout;' do
+        savedTimeout = v
+    end
+
+    local timeout = self.config.busyTimeout
+    local started = wallClock()
+    local attempt = 0
+    local result
+    while true do
+        self.db:busy_timeout(timeout)
+        result = self.db:exec 'begin immediate'
+        if result == sqlite3.OK or (result ~= SQLITE_BUSY and result ~= SQLITE_LOCKED)
+                or attempt >= self.config.busyRetries then
+            break
+        end
+
+        attempt = attempt + 1
+        stats.busyRetries = stats.busyRetries + 1
+        timeout = timeout * 2
+    end
+
+    self.db:busy_timeout(savedTimeout)
+    stats.lockWaitTime = stats.lockWaitTime + (wallClock() - started)
+    if result == SQLITE_BUSY or result == SQLITE_LOCKED then
+        stats.busyFailures = stats.busyFailures + 1
+    end
+    self:checkSqlite(result)
+end
+
+--[[ Group commit support.
+When config.groupCommit is on and database is in WAL mode, every write action still runs in its own transaction
+and commits it before returning, so every caller gets result or error of its own commit, and no lock is held
+between calls. Only sync to disk is shared: commits of a group run with synchronous = NORMAL, which in WAL mode
+does not sync WAL file. Group is closed by the write action which finds on entry that group has reached
+config.groupCommitMaxBatch actions or is older than config.groupCommitMaxDelay (in milliseconds), and by
+flexi('commit'). Closing action commits with synchronous level of the connection (FULL by default), so single
+sync of WAL file makes all commits of the group durable.
+Limits are checked on entry only: if application goes idle, last group stays not synced (but committed and
+visible to other connections) till next write action, flexi('commit') or DBContext:close(). In case of OS crash or
+power loss this group may be lost, but database stays consistent.
+]]
+
+---@class GroupCommitState
+---@field pending number @comment number of committed actions not yet synced to disk
+---@field started number @comment time of first commit in the group
+---@field failures number @comment number of failed actions which were to close the group
+---@field lastError string | nil @comment error of last failed closing action
+
+-- Returns synchronous level of connection, if commits of write actions can be grouped, i.e. config.groupCommit is on,
+-- database is in WAL mode and synchronous level is higher than NORMAL. Otherwise returns nil
+---@return number | nil
+function DBContext:getGroupCommitLevel()
+    if not self.config.groupCommit then
+        return nil
+    end
+
+    for mode in self.db:urows 'pragma journal_mode;' do
+        if string.lower(mode) ~= 'wal' then
+            return nil
+        end
+    end
+
+    local result
+    for level in self.db:urows 'pragma synchronous;' do
+        result = level
+    end
+    if result and result > 1 then
+        return result
+    end
+    return nil
+end
+
+-- Rewrites user_version with the same value, so that current write transaction has at least one page to commit.
+-- This forces sync of WAL file by transaction which closes group
+function DBContext:touchUserVersion()
+    local version = 0
+    for v in self.db:urows 'pragma user_version;' do
+        version = v
+    end
+    self:checkSqlite(self.db:exec(string.format('pragma user_version = %d;', version)))
+end
+
+--- Closes group of write actions (see config.groupCommit): the call itself runs in write transaction
+--- which syncs all earlier commits of the group
+function DBContext:flexi_Commit()
+    return string.format('%d action(s) committed', self.GroupCommit.pending)
+end
+
+-- Syncs commits of the current group outside of flexi call
+function DBContext:syncGroup()
+    local group = self.GroupCommit
+    if group.pending > 0 then
+        self:beginWriteTransaction(self:getActionStats('commit'))
+        local ok, errMsg = pcall(function()
+            self:touchUserVersion()
+            self:checkSqlite(self.db:exec 'commit')
+        end)
+        if not ok then
+            self.db:exec 'rollback'
+            error(errMsg, 0)
+        end
+        group.pending = 0
+    end
+end
+
+--[[ Per-call budgets.
+Every flexi call may be limited by wall time, number of rows scanned and number of objects loaded.
+Default limits are set in config (budgetTime, budgetRows, budgetObjects). Limits for single call
+can be passed as flexi('budget', '{"time": 1000, "rows": 100000, "objects": 5000}', <action>, <args>...)
+Time is checked by SQLite progress handler (so long running SQL statements get interrupted) and by Lua scan loops.
+Rows and objects are counted by Lua scan loops (see DBContext:budgetRowScanned and budgetObjectLoaded).
+When any budget is exceeded, call fails with error naming this budget, and all its changes are rolled back
+]]
+
+---@class CallBudget
+---@field time number @comment max time in milliseconds, 0 - unlimited
+---@field rows number
+---@field objects number
+---@field deadline number @comment wall clock time when time budget expires
+---@field rowsScanned number
+---@field objectsLoaded number
+---@field exceeded string | nil @comment name of exceeded budget
+
+---@param callBudget table | nil @comment per-call limits: time, rows, objects
+function DBContext:startBudget(callBudget)
+    callBudget = callBudget or {}
+    local budget = {
+        time = callBudget.time or self.config.budgetTime,
+        rows = callBudget.rows or self.config.budgetRows,
+        objects = callBudget.objects or self.config.budgetObjects,
+        rowsScanned = 0,
+        objectsLoaded = 0,
+    }
+
+    if budget.time <= 0 and budget.rows <= 0 and budget.objects <= 0 then
+        self.Budget = nil
+        return
+    end
+
+    self.Budget = budget
+    if budget.time > 0 then
+        budget.deadline = wallClock() + budget.time / 1000
+        -- Non-false result interrupts current SQLite statement
+        self.db:progress_handler(self.config.budgetCheckSteps, function()
+            return budget.exceeded ~= nil or (wallClock() > budget.deadline and self:exceedBudget('time', true))
+        end)
+    end
+end
+
+function DBContext:stopBudget()
+    if self.Budget and self.Budget.deadline then
+        self.db:progress_handler()
+    end
+    self.Budget = nil
+end
+
+-- Marks budget as exceeded. Raises error, unless silent is true
+---@param name string @comment 'time', 'rows' or 'objects'
+---@param silent boolean
+---@return boolean
+function DBContext:exceedBudget(name, silent)
+    local budget = self.Budget
+    budget.exceeded = budget.exceeded or name
+    if not silent then
+        error(string.format('Budget exceeded: %s (limit %d)', name, budget[name]))
+    end
+    return true
+end
+
+-- Checks if current call is within its budget. To be called from scan loops
+function DBContext:checkBudget()
+    local budget = self.Budget
+    if budget then
+        if budget.exceeded then
+            self:exceedBudget(budget.exceeded)
+        end
+        if budget.deadline and wallClock() > budget.deadline then
+            self:exceedBudget('time')
+        end
+    end
+end
+
+-- Counts row scanned by query and checks budget
+function DBContext:budgetRowScanned()
+    local budget = self.Budget
+    if budget then
+        budget.rowsScanned = budget.rowsScanned + 1
+        if budget.rows > 0 and budget.rowsScanned > budget.rows then
+            self:exceedBudget('rows')
+        end
+        self:checkBudget()
+    end
+end
+
+-- Counts loaded object and checks budget
+function DBContext:budgetObjectLoaded()
+    local budget = self.Budget
+    if budget then
+        budget.objectsLoaded = budget.objectsLoaded + 1
+        if budget.objects > 0 and budget.objectsLoaded > budget.objects then
+            self:exceedBudget('objects')
+        end
+    end
+end
+
 -- Callback to sqlite 'flexi' function
+--[[
+Actions marked as readOnly in flexiMeta run in deferred transaction (plain BEGIN), so they do not compete for write
+lock with other connections, but still see consistent snapshot of database. All other actions run in write
+transaction started by BEGIN IMMEDIATE, and commit it before returning (see also Group commit support)
+]]
 function DBContext:flexiAction(ctx, action, ...)
     local result
+    local args = { ... }
+
+    -- flexi('budget', <budget JSON>, <action>, <args>...)
+    local callBudget
+    if action == 'budget' then
+        local ok
+        ok, callBudget = pcall(json.decode, table.remove(args, 1) or '{}')
+        if not ok or type(callBudget) ~= 'table' then
+            ctx:result_error('Invalid budget: ' .. tostring(callBudget))
+            return
+        end
+        action = table.remove(args, 1)
+    end
+
     local ff = flexiFuncs[action]
     if ff == nil then
-        ctx:result_error('Flexi action ' .. action .. ' not found')
+        ctx:result_error('Flexi action ' .. tostring(action) .. ' not found')
         return
     end
 
     local meta = flexiMeta[ff]
+    local stats = self:getActionStats(action)
+    stats.calls = stats.calls + 1
 
     self.SchemaChanged = false
 
-    local args = { ... }
-    -- Start transaction
-    self.db:exec 'begin'
-
     local errorMsg = ''
 
+    local group = self.GroupCommit
+    local groupLevel = not meta.readOnly and not meta.closeGroup and self:getGroupCommitLevel()
+    -- Write action closes group if it is explicitly requested, or group has reached its limits
+    local closeGroup = not meta.readOnly and group.pending > 0 and (meta.closeGroup or not groupLevel
+            or group.pending >= self.config.groupCommitMaxBatch
+            or (wallClock() - group.started) * 1000 >= self.config.groupCommitMaxDelay)
+    local inReadTransaction = false
+
     local function execute()
+        -- Start transaction. Synchronous level can be changed only outside of transaction
+        if groupLevel and not closeGroup then
+            self:checkSqlite(self.db:exec 'pragma synchronous = NORMAL;')
+        end
+
+        if not meta.readOnly then
+            self:beginWriteTransaction(stats)
+        else
+            self:checkSqlite(self.db:exec 'begin')
+            inReadTransaction = true
+        end
+
+        if self.config.preloadNames and not self.NameCache.preloaded then
+            self.NameCache:preload()
+        end
+
         -- Check if schema has been changed since last call
         local uv = self:loadOneRow(
         ---@language SQL
                 [[pragma user_version;]])
         if self.SchemaVersion ~= uv.user_version then
-            self:flushSchemaCache()
+            self:flushSchemaCache(true)
+        end
+
+        if self.config.crossRequestCache then
+            self:validateDataCache()
         end
 
         self.ActionQueue:clear()
 
+        self:startBudget(callBudget)
+
         result = ff(self, unpack(args))
+        self:closeCursors()
 
-        if meta.schemaChange or self.SchemaChanged then
-            self.SchemaVersion = (self.SchemaVersion or 0) + 1
-            self.db:exec(string.format([[pragma user_version=%d;]], self.SchemaVersion))
-        end
+        -- SQLite statement could be interrupted by progress handler
+        self:checkBudget()
+
+        if not meta.readOnly then
+            if meta.schemaChange or self.SchemaChanged then
+                self.SchemaVersion = (self.SchemaVersion or 0) + 1
+                self.db:exec(string.format([[pragma user_version=%d;]], self.SchemaVersion))
+            end
 
-        self.ActionQueue:run()
+            self.ActionQueue:run()
 
-        self.db:exec 'commit'
+            if closeGroup then
+                self:touchUserVersion()
+            end
+
+            self:checkSqlite(self.db:exec 'commit')
+            self.NameCache:commit()
+
+            if closeGroup then
+                group.pending = 0
+            end
+            if groupLevel and not closeGroup then
+                if group.pending == 0 then
+                    group.started = wallClock()
+                end
+                group.pending = group.pending + 1
+            end
+        elseif inReadTransaction then
+            self:checkSqlite(self.db:exec 'commit')
+            inReadTransaction = false
+        end
     end
 
     local function error_handler(error)
@@ -340,16 +925,68 @@ function DBContext:flexiAction(ctx, action, ...)
     end
 
     local ok = xpcall(execute, error_handler)
+    self:releasePrefetchedObjects()
+
+    if self.Budget and self.Budget.exceeded then
+        stats.budgetExceeded = stats.budgetExceeded + 1
+        if not ok then
+            errorMsg = string.format('Budget exceeded: %s (limit %d)\n%s', self.Budget.exceeded,
+                    self.Budget[self.Budget.exceeded], errorMsg)
+        end
+    end
+    self:stopBudget()
+
+    if not ok then
+        stats.errors = stats.errors + 1
+        self:closeCursors()
+        if not meta.readOnly or inReadTransaction then
+            self.db:exec 'rollback'
+            self.NameCache:rollback(0)
+        end
+
+        -- Group stays open and will be closed by next write action
+        if closeGroup then
+            group.failures = group.failures + 1
+            group.lastError = errorMsg
+        end
+    end
+
+    if groupLevel and not closeGroup then
+        self.db:exec(string.format('pragma synchronous = %d;', groupLevel))
+    end
 
     if not ok then
-        self.db:exec 'rollback'
         ctx:result_error(errorMsg)
     else
         ctx:result(result)
     end
 
-    self:flushDataCache()
-    self.AccessControl:flushCache()
+    -- Names inserted by read-only action are already committed
+    if meta.readOnly and ok then
+        self.NameCache:commit()
+    end
+
+    -- Loaded objects may be kept for next calls only after successful read-only action.
+    -- data_version is not changed by commits on the same connection, so cache must be dropped after writes
+    if not (self.config.crossRequestCache and meta.readOnly and ok) then
+        self:flushDataCache()
+    end
+end
+
+--[[ Cross-request data cache.
+If config.crossRequestCache is on, objects loaded by read-only actions are kept in Objects cache
+between calls (limited by config.objectCacheSize). Before every call PRAGMA data_version is checked,
+and if it has changed (i.e. database was modified by another connection), cache is dropped.
+Write actions always drop cache on completion.
+]]
+function DBContext:validateDataCache()
+    local row = self:loadOneRow(
+    ---@language SQL
+            [[pragma data_version;]])
+    if self.DataVersion ~= row.data_version then
+        self:flushDataCache()
+        self.DataVersion = row.data_version
+    end
 end
 
 -- Utility method to obtain prepared sqlite statement
@@ -383,6 +1020,8 @@ function DBContext:finalizeStatements()
 end
 
 function DBContext:close()
+    self:syncGroup()
+    self:closeCursors()
     self:finalizeStatements()
 end
 
@@ -404,13 +1043,7 @@ end
 --- @param nameID number
 --- @return string
 function DBContext:getNameValueByID(nameID)
-    local row = self:loadOneRow([[select [Value] from [.sym_names] where ID = :v limit 1;]],
-            { v = nameID })
-    if row then
-        return row.Value
-    end
-
-    return nil
+    return self.NameCache:getValue(nameID)
 end
 
 --- Checks if string is a valid name
@@ -427,10 +1060,10 @@ end
 --- does not exist, error will be thrown
 --- @return number @collection property ID or -1 if property does not exist
 function DBContext:getPropIdByClassAndNameIds(classId, propName, errorIfNotFound)
-    local row = self:loadOneRow([[select PropertyID from [flexi_prop] where ClassID = :c and NameID = :n;"]],
+    local row = self:loadOneRow([[select ID from [.class_props] where ClassID = :c and NameID = :n and Deleted = 0;]],
             { c = classId, n = propName }, errorIfNotFound)
     if row then
-        return row.PropertyID
+        return row.ID
     end
 
     return -1
@@ -439,12 +1072,7 @@ end
 --- @param name string
 --- @return number @comment nameID
 function DBContext:insertName(name)
-    local sql = [[insert  into [.sym_names] ([Value]) select :v
-        where not exists (select ID from [.sym_names] where [Value] = :v limit 1);
-        ]]
-    self:execStatement(sql, { v = name })
-    --TODO Use last insert id?
-    return self:getNameID(name)
+    return self.NameCache:ensure(name)
 end
 
 --- @param sql string
@@ -465,15 +1093,12 @@ end
 --- @return number
 function DBContext:getNameID(name)
     assert(name)
-    local row = self:loadOneRow('select NameID from [.names] where [Value] = :n;', { n = name })
-    if not row then
-
-        local cnt = self:loadOneRow([[select * from [.sym_names];]], {})
-        print(cnt)
+    local result = self.NameCache:getID(name)
+    if not result then
         error('Name [' .. name .. '] not found')
     end
 
-    return row.NameID
+    return result
 end
 
 --- Returns property ID based on its class ID and associated name ID
@@ -481,13 +1106,13 @@ end
 ---@param propNameId number
 ---@return number @comment -1 if not found, valid ID otherwise
 function DBContext:getPropIdByClassIdAndPropNameId(classId, propNameId)
-    local row = self:loadOneRow("select PropertyID from [flexi_prop] where ClassID = :c and NameID = :n;",
+    local row = self:loadOneRow([[select ID from [.class_props] where ClassID = :c and NameID = :n and Deleted = 0;]],
             { c = classId, n = propNameId })
     if not row then
         return -1
     end
 
-    return row.PropertyID
+    return row.ID
 end
 
 --- @param name string
@@ -571,6 +1196,7 @@ function DBContext:getClassDefRO(classIdOrName, mustExist)
 
     result = ClassDef { data = classRow, DBContext = self }
     ClassCollection_add(self.Classes, result)
+    self.ClassVersions[result.ClassID] = classRow.Version
 
     return result, false
 end
@@ -669,7 +1295,7 @@ function DBContext:flexi_CurrentUser(userInfo, roles, culture)
 
     local dd = json.decode(userInfo)
     if type(dd) == 'string' then
-        self.UserInfo.UserID = dd
+        self.UserInfo.ID = dd
     else
         self.UserInfo = UserInfo:new(dd)
         return 'Current user info updated'
@@ -704,6 +1330,29 @@ end
 --- @param propName string @comment if set, will purge deleted data for that property only
 function DBContext:flexi_vacuum(className, propName)
     -- TODO Hard delete data
+
+    local removed = self:collectStoredValues()
+    local orphaned = self:collectCellMetaData()
+    return string.format('%d unreferenced value(s) removed, %d orphaned cell metadata row(s) removed',
+            removed, orphaned)
+end
+
+--- Returns per-action call and lock contention statistics, object cache usage and group commit state as JSON
+--- @param reset string | nil @comment if 'reset', statistics will be cleared after returning
+function DBContext:flexi_Stats(reset)
+    local group = self.GroupCommit
+    local result = json.encode({ actions = self.ActionStats, objectCache = self.ObjectCache:getStats(),
+                                 writes = self.WriteStats,
+                                 groupCommit = { pending = group.pending, failures = group.failures,
+                                                 lastError = group.lastError } })
+    if reset == 'reset' then
+        self.ActionStats = {}
+        group.failures = 0
+        group.lastError = nil
+        self.WriteStats = { skippedWrites = 0 }
+        self.ObjectCache = ObjectCache(self.config.objectCacheSize)
+    end
+    return result
 end
 
 --- Closes all opened statements, flushes cache
@@ -746,19 +1395,45 @@ function DBContext:initMemoizeFunctions()
     end)
 end
 
-function DBContext:flushSchemaCache()
-    self.Classes = DictCI()
+--- Drops cached schema data
+---@param keepUnchangedClasses boolean @comment if true, classes which were not changed in database
+--- since they were loaded are kept, so that only changed classes get decoded again
+function DBContext:flushSchemaCache(keepUnchangedClasses)
+    local classes = DictCI()
+    local versions = {}
     self.ClassProps = {}
+
+    if keepUnchangedClasses and next(self.ClassVersions) ~= nil then
+        for row in self:loadRows([[select ClassID, Version from [.classes];]], {}) do
+            local classDef = self.Classes[row.ClassID]
+            if classDef and self.ClassVersions[row.ClassID] == row.Version then
+                ClassCollection_add(classes, classDef)
+                versions[row.ClassID] = row.Version
+                for _, propDef in pairs(classDef.Properties) do
+                    if propDef.ID then
+                        self.ClassProps[propDef.ID] = propDef
+                    end
+                end
+            end
+        end
+    end
+
+    self.Classes = classes
+    self.ClassVersions = versions
     self.Functions = {}
     self:flushDataCache()
     self:initMemoizeFunctions()
+    self.AccessControl:flushCache()
     self:flushCurrentUserCheckPermissions()
     self:finalizeStatements()
     self.events:emit(DBContext.EVENT_NAMES.FLUSH_SCHEMA_DATA, self)
 end
 
 function DBContext:flushDataCache()
+    self.ObjectCache:sampleMemory()
     self.Objects = {}
+    self.ObjectCache:clear()
+    self:releasePrefetchedObjects()
 end
 
 ---@param objectID number
@@ -769,29 +1444,131 @@ function DBContext:getObject(objectID)
 
     local result = self.Objects[objectID]
     if result then
+        self.ObjectCache:touch(objectID)
         return result
     end
 
     result = DBObject(self, nil, objectID)
-    self.Objects[objectID] = result
+    self:cacheObject(objectID, result)
     return result
 end
 
---[[ Initializes memoize (cache-based) functions to get actual permission for given database objects
+-- Loads [.objects] rows and all property values for the given object IDs.
+-- Uses single scan on [.objects] (for objects not yet in Objects cache) and single scan on [.ref-values].
+-- Returns loaded objects by ID. Objects are also put to Objects cache, but may be evicted from it
+-- while batch is still being loaded, so callers must use returned map
+---@param objectIDs number[]
+---@return table<number, DBObject>
+function DBContext:loadObjectsBatch(objectIDs)
+    local objects = {}
+    local missingIDs = {}
+    for _, id in ipairs(objectIDs) do
+        local obj = self.Objects[id] or (self.PrefetchedObjects and self.PrefetchedObjects[id])
+        if obj then
+            objects[id] = obj
+        else
+            table.insert(missingIDs, id)
+        end
+    end
+
+    if #missingIDs > 0 then
+        for objRow in self:loadRows([[select * from [.objects]
+            where ObjectID in (select value from json_each(:ObjectIDs));]], { ObjectIDs = json.encode(missingIDs) }) do
+            objects[objRow.ObjectID] = self:LoadObject(objRow.ObjectID, nil, false, objRow)
+        end
+    end
+
+    for row in self:loadRows([[select * from [.ref-values]
+        where ObjectID in (select value from json_each(:ObjectIDs))
+        order by ObjectID, PropertyID, PropIndex;]], { ObjectIDs = json.encode(objectIDs) }) do
+        local obj = objects[row.ObjectID]
+        if obj and obj.state ~= Constants.OPERATION.CREATE then
+            obj.origVer:setPrefetchedValue(row)
+        end
+    end
+
+    for _, obj in pairs(objects) do
+        if obj.state ~= Constants.OPERATION.CREATE then
+            obj.origVer:setAllPropsLoaded()
+        end
+    end
+
+    return objects
+end
+
+--[[ Loads objects and their referenced objects in batches, level by level.
+Every level is loaded by one scan on [.objects] and one scan on [.ref-values], regardless of number of objects
+on the level. Objects referenced from the current level (as defined by include spec) form the next level.
+Loaded objects are placed into Objects cache, so that subsequent LoadObject, ExportData and DBProperty:GetValue
+calls do not hit database. They are also pinned in PrefetchedObjects till the end of flexi call (see
+releasePrefetchedObjects), so that large exports do not load evicted objects again one by one
+]]
+---@param objectIDs number[]
+---@param include ExportIncludeSpec | nil @comment if not set, refDef.autoFetchDepth of reference properties is used
+function DBContext:PrefetchObjects(objectIDs, include)
+    -- Map of object ID to include spec (false if not set)
+    ---@type table<number, ExportIncludeSpec | boolean>
+    local level = {}
+    for _, id in ipairs(objectIDs) do
+        level[id] = include or false
+    end
+
+    local visited = {}
+    while next(level) ~= nil do
+        local ids = {}
+        for id in pairs(level) do
+            if not visited[id] then
+                visited[id] = true
+                table.insert(ids, id)
+            end
+        end
+
+        if #ids == 0 then
+            break
+        end
+
+        local objects = self:loadObjectsBatch(ids)
+        self.PrefetchedObjects = self.PrefetchedObjects or {}
+
+        local nextLevel = {}
+        for _, id in ipairs(ids) do
+            local obj = objects[id]
+            self.PrefetchedObjects[id] = obj
+            if obj and obj.state ~= Constants.OPERATION.CREATE then
+                for _, prop in pairs(obj.origVer.props) do
+                    local refInclude = DBObject.GetRefIncludeSpec(level[id] or nil, prop.PropDef)
+                    if refInclude and prop.values then
+                        for _, dbv in pairs(prop.values) do
+                            local refID = dbv.Value
+                            if type(refID) == 'number' and not visited[refID] and nextLevel[refID] == nil then
+                                nextLevel[refID] = refInclude
+                            end
+                        end
+                    end
+                end
+            end
+        end
+
+        level = nextLevel
+    end
+end
+
+--[[ Initializes functions to get actual permission for given database objects
  Makes the following functions available:
  * ensureCurrentUserAccessForProperty
  * ensureCurrentUserAccessForClass
 
- These functions are reset on schema or current user change
+ Permissions are compiled and cached by AccessControl per user, so these functions
+ do not need to be reset on current user change
 ]]
 function DBContext:flushCurrentUserCheckPermissions()
-    self.ensureCurrentUserAccessForProperty = util.memoize(function(propID, op)
+    self.ensureCurrentUserAccessForProperty = function(propID, op)
         self.AccessControl:ensureCurrentUserAccessForProperty(propID, op)
-    end)
+    end
 
-    self.ensureCurrentUserAccessForClass = util.memoize(function(classID, op)
+    self.ensureCurrentUserAccessForClass = function(classID, op)
         self.AccessControl:ensureCurrentUserAccessForClass(classID, op)
-    end)
+    end
 end
 
 -- Internal method. Prepares ad hoc SQL statement and binds parameters
@@ -810,6 +1587,32 @@ function DBContext:getAdhocStmt(sql, params)
     return result
 end
 
+-- Registers ad hoc statement used by iterator (see DBQuery:Iterate), so that it gets finalized
+-- at the end of flexi call even if iteration was not completed
+---@param stmt userdata @comment lsqlite.stmt
+function DBContext:registerCursor(stmt)
+    self.OpenCursors[stmt] = true
+end
+
+---@param stmt userdata @comment lsqlite.stmt
+function DBContext:closeCursor(stmt)
+    self.OpenCursors[stmt] = nil
+    stmt:finalize()
+end
+
+-- Unpins objects loaded by PrefetchObjects. They stay in Objects cache, subject to eviction
+function DBContext:releasePrefetchedObjects()
+    self.PrefetchedObjects = nil
+end
+
+-- Finalizes statements of all not completed iterations
+function DBContext:closeCursors()
+    for stmt in pairs(self.OpenCursors) do
+        stmt:finalize()
+    end
+    self.OpenCursors = {}
+end
+
 -- Executes ad hoc SQL
 ---@param sql string
 ---@param params table | nil
@@ -938,12 +1741,14 @@ local flexi_SplitProperty = require 'flexi_SplitProperty'
 local flexi_MergeProperty = require 'flexi_MergeProperty'
 local TriggerAPI = require 'Triggers'
 local flexi_DataUpdate = require 'flexi_DataUpdate'
+local flexi_Select = require 'flexi_Select'
 
 -- Initialization should be **AFTER** all FLEXI functions are defined
 -- Variables are declared above
 
 -- Dictionary by action functions, to get metadata about actions
--- Values are tables: { shortInfo:string, fullInfo:string, schemaChange:boolean, actionNames:Array }
+-- Values are tables: { shortInfo:string, fullInfo:string, schemaChange:boolean, readOnly:boolean, closeGroup:boolean,
+-- actionNames:Array }
 flexiMeta = {
     [flexi_CreateClass.CreateClass] = { shortInfo = '', fullInfo = [[]], schemaChange = true },
     [flexi_CreateClass.CreateSchema] = { shortInfo = '', fullInfo = [[]], schemaChange = true },
@@ -953,14 +1758,14 @@ flexiMeta = {
     [flexi_AlterProperty] = { shortInfo = '', fullInfo = [[]], schemaChange = true },
     [flexi_DropProperty] = { shortInfo = '', fullInfo = [[]], schemaChange = true },
     [flexi_Configure] = { shortInfo = '', fullInfo = [[]], schemaChange = true },
-    [DBContext.flexi_ping] = { shortInfo = '', fullInfo = [[]] },
-    [DBContext.flexi_CurrentUser] = { shortInfo = '', fullInfo = [[]] },
+    [DBContext.flexi_ping] = { shortInfo = '', fullInfo = [[]], readOnly = true },
+    [DBContext.flexi_CurrentUser] = { shortInfo = '', fullInfo = [[]], readOnly = true },
     [flexi_PropToObject] = { shortInfo = '', fullInfo = [[]], schemaChange = true },
     [flexi_ObjectToProp] = { shortInfo = '', fullInfo = [[]], schemaChange = true },
     [flexi_SplitProperty] = { shortInfo = '', fullInfo = [[]], schemaChange = true },
     [flexi_MergeProperty] = { shortInfo = '', fullInfo = [[]], schemaChange = true },
-    [DBContext.flexi_Schema] = { shortInfo = '', fullInfo = [[]] },
-    [DBContext.flexi_Help] = { shortInfo = '', fullInfo = [[]] },
+    [DBContext.flexi_Schema] = { shortInfo = '', fullInfo = [[]], readOnly = true },
+    [DBContext.flexi_Help] = { shortInfo = '', fullInfo = [[]], readOnly = true },
     [DBContext.flexi_LockClass] = { shortInfo = '', fullInfo = [[]] },
     [DBContext.flexi_UnlockClass] = { shortInfo = '', fullInfo = [[]] },
     [DBContext.flexi_vacuum] = { shortInfo = '', fullInfo = [[]] },
@@ -968,8 +1773,11 @@ flexiMeta = {
     [TriggerAPI.Drop] = { shortInfo = '', fullInfo = [[]], schemaChange = true },
     [TriggerAPI.Create] = { shortInfo = '', fullInfo = [[]], schemaChange = true },
     [flexi_DataUpdate.flexi_ImportData] = { shortInfo = '', fullInfo = [[]], schemaChange = true },
-    [DBContext.flexi_close] = { shortInfo = '', fullInfo = [[]], schemaChange = false },
-    [DBContext.debugger] = { shortInfo = '', fullInfo = [[]], schemaChange = false },
+    [flexi_Select] = { shortInfo = '', fullInfo = [[]], readOnly = true },
+    [DBContext.flexi_close] = { shortInfo = '', fullInfo = [[]], schemaChange = false, readOnly = true },
+    [DBContext.debugger] = { shortInfo = '', fullInfo = [[]], schemaChange = false, readOnly = true },
+    [DBContext.flexi_Stats] = { shortInfo = '', fullInfo = [[]], readOnly = true },
+    [DBContext.flexi_Commit] = { shortInfo = '', fullInfo = [[]], closeGroup = true },
 }
 
 -- Dictionary by action names
@@ -1056,6 +1864,8 @@ flexiFuncs = {
     ['load data'] = flexi_DataUpdate.flexi_ImportData,
     ['load'] = flexi_DataUpdate.flexi_ImportData,
 
+    ['select'] = flexi_Select,
+
     ['close'] = DBContext.flexi_close,
     ['reset'] = DBContext.flexi_close,
     ['flush'] = DBContext.flexi_close,
@@ -1063,6 +1873,11 @@ flexiFuncs = {
     ['debugger'] = DBContext.debugger,
     ['debug'] = DBContext.debugger,
 
+    ['stats'] = DBContext.flexi_Stats,
+    ['statistics'] = DBContext.flexi_Stats,
+
+    ['commit'] = DBContext.flexi_Commit,
+
 
     --[[
 
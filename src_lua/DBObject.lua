@@ -130,6 +130,7 @@ local CreatedVoidDBObject = VoidDBOV('Old object is not available in this contex
 ---so if property is not yet loaded, it will not be in the dictionary
 ---@field ctlo number @comment [.objects].ctlo
 ---@field vtypes number @comment [.objects].vtypes
+---@field cellMetaDataLoaded boolean @comment true if cell MetaData has been loaded from [.cell_metadata]
 local ReadOnlyDBOV = class()
 
 ---@param DBObject DBObject
@@ -148,7 +149,7 @@ end
 function ReadOnlyDBOV.Create(DBObject, ID, objRow)
     local result = ReadOnlyDBOV(DBObject, ID)
     if not objRow then
-        objRow = self.DBObject.DBContext:loadOneRow([[select * from [.objects] where ObjectID=:ObjectID;]], { ObjectID = self.ID })
+        objRow = DBObject.DBContext:loadOneRow([[select * from [.objects] where ObjectID=:ObjectID;]], { ObjectID = ID })
     end
     result:initFromObjectRow(objRow)
     return result
@@ -240,6 +241,53 @@ function ReadOnlyDBOV:initFromObjectRow(obj)
     end
 end
 
+-- Sets property value from [.ref-values] row loaded by batch prefetch (see DBContext:PrefetchObjects)
+---@param row table @comment [.ref-values] row
+function ReadOnlyDBOV:setPrefetchedValue(row)
+    local propDef = self.ClassDef.DBContext.ClassProps[row.PropertyID]
+    if not propDef then
+        return
+    end
+
+    local prop = self.props[propDef.Name.text]
+    if not prop then
+        prop = DBProperty(self, propDef)
+        self.props[propDef.Name.text] = prop
+    end
+
+    if prop.loadedCount == Constants.MAX_INTEGER then
+        -- Already fully loaded
+        return
+    end
+
+    prop.values = prop.values or {}
+    if not prop.values[row.PropIndex] then
+        prop.values[row.PropIndex] = DBValue.FromRow(row, self.ClassDef.DBContext)
+    end
+end
+
+-- Marks all class properties as fully loaded, so that DBProperty:GetValue will not
+-- query [.ref-values] for missing values. Called after batch prefetch
+function ReadOnlyDBOV:setAllPropsLoaded()
+    ---@param propDef PropertyDef
+    local function setLoaded(propDef)
+        local prop = self.props[propDef.Name.text]
+        if not prop then
+            prop = DBProperty(self, propDef)
+            self.props[propDef.Name.text] = prop
+        end
+        prop.values = prop.values or {}
+        prop.loadedCount = Constants.MAX_INTEGER
+    end
+
+    for _, propDef in pairs(self.ClassDef.Properties) do
+        setLoaded(propDef)
+    end
+    for _, propDef in pairs(self.ClassDef.MixinProperties) do
+        setLoaded(propDef)
+    end
+end
+
 ---@param propName string
 ---@return DBProperty | nil
 function ReadOnlyDBOV:getProp(propName)
@@ -277,6 +325,43 @@ function ReadOnlyDBOV:getPropValue(propName, propIndex, returnNil)
     return NullDBValue
 end
 
+--[[ Loads cell MetaData for all values of this object from [.cell_metadata] (single query) and assigns
+it to DBValue.MetaData. Cell MetaData is not loaded together with values, as it is rarely needed
+]]
+function ReadOnlyDBOV:loadCellMetaData()
+    if self.cellMetaDataLoaded then
+        return
+    end
+
+    local DBContext = self.ClassDef.DBContext
+    for row in DBContext:loadRows([[select PropertyID, PropIndex, MetaData from [.cell_metadata]
+        where ObjectID = :ObjectID;]], { ObjectID = self.ID }) do
+        local propDef = DBContext.ClassProps[row.PropertyID]
+        if propDef then
+            local dbv = self:getPropValue(propDef.Name.text, row.PropIndex, true)
+            if not rawequal(dbv, NullDBValue) then
+                dbv.MetaData = JSON.decode(row.MetaData)
+            end
+        end
+    end
+
+    self.cellMetaDataLoaded = true
+end
+
+-- Returns cell MetaData (font/color/format etc.) of property value. MetaData is loaded on first request
+---@param propName string
+---@param propIndex number @comment optional, if not set, 1 is assumed
+---@return table | nil
+function ReadOnlyDBOV:getCellMetaData(propName, propIndex)
+    local dbv = self:getPropValue(propName, propIndex or 1, true)
+    if rawequal(dbv, NullDBValue) then
+        return nil
+    end
+
+    self:loadCellMetaData()
+    return dbv.MetaData
+end
+
 -- Ensures that user has required permissions for class level
 ---@param op string @comment 'C' or 'U' or 'D'
 function ReadOnlyDBOV:checkClassAccess(op)
@@ -445,7 +530,7 @@ function WritableDBOV:saveCreate(ctx)
     -- New object
     self.ClassDef.DBContext:execStatement([[insert into [.objects] (ClassID, ctlo, vtypes,
         A, B, C, D, E, F, G, H, I, J, K, L, M, N, O, P, MetaData) values (
-        :ClassID, :ctlo, :vtypes, :A, :B, :C, :D, :E, :F, :G, :H, :I, :J, :J, :K, :L, :M, :N, :O, :P);]],
+        :ClassID, :ctlo, :vtypes, :A, :B, :C, :D, :E, :F, :G, :H, :I, :J, :K, :L, :M, :N, :O, :P, :MetaData);]],
             params)
     -- TODO process deferred links
     self.ClassDef.DBContext.Objects[self.ID] = nil
@@ -456,6 +541,8 @@ function WritableDBOV:saveCreate(ctx)
         prop:SaveToDB(ctx)
     end
 
+    self:saveAccessRules()
+
     -- Save multi-key index if applicable
     self.DBObject:saveMultiKeyIndexes(Constants.OPERATION.CREATE)
 
@@ -487,15 +574,68 @@ function WritableDBOV:saveCreate(ctx)
     --self:saveNestedObjects()
 end
 
+-- Returns set of IDs of properties which have changed values
+---@return table<number, boolean>
+function WritableDBOV:getDirtyPropIDs()
+    local result = {}
+    for _, prop in pairs(self.props) do
+        if prop.isDirty and prop:isDirty() then
+            result[prop.PropDef.ID] = true
+        end
+    end
+    return result
+end
+
+--[[ Checks if any of given properties has changed. Used to skip index updates when indexed values
+are the same. propRefs may be array of property IDs or property references (with ID or Name).
+Property which cannot be resolved is treated as changed
+]]
+---@param dirtyIDs table<number, boolean> @comment result of getDirtyPropIDs
+---@param propRefs table | nil
+---@return boolean
+function WritableDBOV:hasDirtyProps(dirtyIDs, propRefs)
+    if not propRefs then
+        return false
+    end
+
+    for _, ref in pairs(propRefs) do
+        local propID = ref
+        if type(ref) == 'table' then
+            propID = ref.ID or ref.id
+            if not propID and ref.Name then
+                local propDef = self.ClassDef:hasProperty(ref.Name.text)
+                propID = propDef and propDef.ID
+            end
+        end
+
+        if propID == nil or dirtyIDs[propID] then
+            return true
+        end
+    end
+
+    return false
+end
+
 -- Updates existing object
+-- Only changed values are written to [.ref-values]. [.objects] row and indexes ([.full_text_data],
+-- [.range_data_N], [.multi_keyN]) are updated only if their input values have changed
 ---@param ctx PropertySaveContext
 function WritableDBOV:saveUpdate(ctx)
+    local DBContext = self.ClassDef.DBContext
+    local dirtyIDs = self:getDirtyPropIDs()
+
     self:setObjectMetaData()
     local params = { ClassID = self.ClassDef.ClassID, ctlo = self.ctlo, vtypes = self.ClassDef.vtypes,
                      MetaData = JSON.encode(self.MetaData) }
 
     self:applyMappedColumnValues(params)
 
+    local origVer = self.DBObject.origVer
+    local objectChanged = params.ctlo ~= origVer.ctlo or params.vtypes ~= origVer.vtypes
+            or self.ID ~= origVer.ID or self.ClassDef ~= origVer.ClassDef
+            or params.MetaData ~= JSON.encode(origVer.MetaData)
+            or (self.ClassDef.ColMapActive and self:hasDirtyProps(dirtyIDs, self.ClassDef.propColMap))
+
     --[[
     update .objects
     insert/update/delete .ref-values
@@ -507,33 +647,47 @@ function WritableDBOV:saveUpdate(ctx)
     ]]
     -- Existing object
     params.ID = self.ID
-    self.ClassDef.DBContext:execStatement([[update [.objects] set ClassID=:ClassID, ctlv=:ctlv,
-         vtypes=:vtypes, A=:A, B=:B, C=:C, D=:D, E=:E, F=:F, G=:G, H=:H, J=:J, K=:K, L=:L,
+    if objectChanged then
+        DBContext:execStatement([[update [.objects] set ClassID=:ClassID, ctlo=:ctlo,
+         vtypes=:vtypes, A=:A, B=:B, C=:C, D=:D, E=:E, F=:F, G=:G, H=:H, I=:I, J=:J, K=:K, L=:L,
          M=:M, N=:N, O=:O, P=:P, MetaData=:MetaData where ObjectID = :ID]], params)
+    else
+        DBContext:countSkippedWrites(1)
+    end
 
     for _, prop in pairs(self.props) do
         prop:SaveToDB(ctx)
     end
 
+    self:saveAccessRules()
+
     -- Save multi-key index if applicable
-    self.DBObject:saveMultiKeyIndexes(Constants.OPERATION.UPDATE)
+    if self:hasDirtyProps(dirtyIDs, self.ClassDef.indexes and self.ClassDef.indexes.multiKeyIndexing) then
+        self.DBObject:saveMultiKeyIndexes(Constants.OPERATION.UPDATE)
+    else
+        DBContext:countSkippedWrites(1)
+    end
 
     -- Save full text index, if applicable
     local fts = {}
-    if self:getParamsForSaveFullText(fts) then
-        self.ClassDef.DBContext:execStatement([[
+    if not self:hasDirtyProps(dirtyIDs, self.ClassDef.fullTextIndexing) then
+        DBContext:countSkippedWrites(1)
+    elseif self:getParamsForSaveFullText(fts) then
+        DBContext:execStatement([[
             update [.full_text_data] set ClassID = :ClassID, X1 = :X1, X2 = :X2, X3 = :X3, X4 = :X4, X5 = :X5
                 where docid = :docid;]], fts)
     end
 
     -- Save rtree if applicable
     local rangeParams = {}
-    if self:getParamsForSaveRangeIndex(rangeParams) then
+    if not self:hasDirtyProps(dirtyIDs, self.ClassDef.rangeIndex) then
+        DBContext:countSkippedWrites(1)
+    elseif self:getParamsForSaveRangeIndex(rangeParams) then
         local sql = string.format([[update [.range_data_%d] set
                 [A0] = :A0, [A1] = :A1,  [B0] = :B0, [B1]= :B1,  [C0] =:C0,
                 [C1] = :C1,  [D0] =:D0, [D1] = :D1, [E0] = :E0, [E1] = :E1
                 where ObjectID = :ObjectID;]], self.ClassDef.ClassID)
-        self.ClassDef.DBContext:execStatement(sql, rangeParams)
+        DBContext:execStatement(sql, rangeParams)
     end
 end
 
@@ -547,8 +701,9 @@ function WritableDBOV:getParamsForSaveFullText(params)
     params.ClassID = self.ClassDef.ClassID
     params.docid = self.ID
 
+    -- Compressed values get uncompressed on access to DBValue.Value, so FTS is always fed with plain text
     for key, propRef in pairs(self.ClassDef.fullTextIndexing) do
-        local vv = self:getProp(propRef.Name.text, 1)
+        local vv = self:getPropValue(propRef.Name.text, 1, true)
         if vv then
             local v = vv.Value
             -- TODO Check type and value?
@@ -654,6 +809,21 @@ function WritableDBOV:setObjectMetaData()
     self.ctlo = ctlo
 end
 
+-- Synchronizes row level access rules in [.object_access] with MetaData.accessRules
+-- If MetaData was not set for this version, access rules are treated as not changed
+function WritableDBOV:saveAccessRules()
+    if self.MetaData == nil then
+        return
+    end
+
+    local accessRules = self.MetaData.accessRules
+    if accessRules == nil and self.DBObject.state == Constants.OPERATION.CREATE then
+        return
+    end
+
+    self.ClassDef.DBContext.AccessControl:saveObjectAccessRules(self.ID, accessRules)
+end
+
 -- Returns data of all changed properties
 ---@return table
 function WritableDBOV:getChangedDataPayload()
@@ -903,6 +1073,48 @@ function DBObject:ImportData(data)
     end
 end
 
+---@class ExportIncludeSpec
+---@field depth number @comment number of reference levels to expand below the object. 0 - references are exported as object IDs
+---@field properties table<string, boolean | ExportIncludeSpec> | nil @comment names of reference properties to expand.
+---If not set, all reference properties are expanded. Nested spec may be set per property
+
+-- Returns include spec for objects referenced by propDef, or nil if referenced objects should be exported as IDs.
+-- If include is not set, refDef.autoFetchDepth of the property is used
+---@param include ExportIncludeSpec | nil
+---@param propDef PropertyDef
+---@return ExportIncludeSpec | nil
+function DBObject.GetRefIncludeSpec(include, propDef)
+    if not propDef:isReference() or propDef:GetVType() == Constants.vtype.enum then
+        return nil
+    end
+
+    if include == nil then
+        local depth = propDef.D.refDef and propDef.D.refDef.autoFetchDepth or 0
+        if depth > 0 then
+            return { depth = depth - 1 }
+        end
+        return nil
+    end
+
+    if (include.depth or 0) <= 0 then
+        return nil
+    end
+
+    local nested = true
+    if include.properties then
+        nested = include.properties[propDef.Name.text]
+        if not nested then
+            return nil
+        end
+    end
+
+    if type(nested) == 'table' then
+        return { depth = nested.depth or include.depth - 1, properties = nested.properties }
+    end
+
+    return { depth = include.depth - 1 }
+end
+
 -- Builds table with all non null property values
 -- Includes nested objects. Does not include links
 --[[ Loads specific property values. propIDs can be:
@@ -912,21 +1124,58 @@ end
 ]]
 ---@param propIDs table <number, number> | number[] | number @comment single property ID or array of property IDs
 -- or map of property IDs to fetch count
+---@param include ExportIncludeSpec | nil @comment defines which referenced objects are exported as nested data
+---@param prefetched boolean | nil @comment true if referenced objects have been already loaded by DBContext:PrefetchObjects
 ---@return table @comment JSON-compatible payload with property names
-function DBObject:ExportData(propIDs)
+function DBObject:ExportData(propIDs, include, prefetched)
     if self.state == Constants.OPERATION.DELETE then
         error(string.format('Cannot get data of deleted object %d', self.origVer.ID))
     end
 
+    if include and not prefetched and self.state ~= Constants.OPERATION.CREATE then
+        -- Load entire graph of referenced objects level by level
+        self.DBContext:PrefetchObjects({ self.origVer.ID }, include)
+    end
+
     local result = {}
 
     local function export_prop_values(propID, fetchCount)
         local propDef = self.curVer.ClassDef.DBContext.ClassProps[propID]
-        local pp = self.curVer:getProp(propDef.ID)
+        local pp = self.curVer:getProp(propDef.Name.text, Constants.OPERATION.READ)
+        local refInclude = DBObject.GetRefIncludeSpec(include, propDef)
         local vv = {}
         result[propDef.Name.text] = vv
-        for idx = 1, fetchCount or Constants.MAX_INTEGER do
-            table_insert(vv, pp.PropDef:ExportDBValue(self, pp:GetValue(idx)))
+
+        -- Collections may be sparse (e.g. after value deletion), so only actually loaded indexes are exported
+        local indexes, seen = {}, {}
+        local function addIndexes(prop)
+            if prop and prop.values then
+                for idx in pairs(prop.values) do
+                    if not seen[idx] and idx <= (fetchCount or Constants.MAX_INTEGER) then
+                        seen[idx] = true
+                        table_insert(indexes, idx)
+                    end
+                end
+            end
+        end
+        addIndexes(pp)
+        if pp and pp.getOriginalProperty then
+            addIndexes(pp:getOriginalProperty())
+        end
+
+        -- Existing values go first, in order of index, then new (negative index) values, in order of adding
+        table.sort(indexes, function(a, b)
+            if (a > 0) == (b > 0) then
+                return math.abs(a) < math.abs(b)
+            end
+            return a > 0
+        end)
+
+        for _, idx in ipairs(indexes) do
+            local dbv = pp:GetValue(idx)
+            if dbv ~= DBValue.Null and dbv.Value ~= nil then
+                table_insert(vv, pp.PropDef:ExportDBValue(self, dbv, refInclude))
+            end
         end
     end
 
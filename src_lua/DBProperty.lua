@@ -17,6 +17,7 @@ local DBValue = require 'DBValue'
 local tablex = require 'pl.tablex'
 local Constants = require 'Constants'
 local JSON = cjson or require 'cjson'
+local bits = type(jit) == 'table' and require('bit') or require('bit32')
 
 local table_insert = table.insert
 
@@ -33,6 +34,7 @@ Provides access to simple values (both scalar and vector)
 ---@class DBProperty
 ---@field DBOV ReadOnlyDBOV @comment DB Object Version
 ---@field PropDef PropertyDef
+---@field loadedCount number | nil @comment values with index up to this number have been loaded from database
 local DBProperty = class()
 
 ---@class DBPropertyBoxed: DBValueBoxed
@@ -115,6 +117,11 @@ function DBProperty:GetValue(idx)
         return v
     end
 
+    if self.loadedCount and idx <= self.loadedCount then
+        -- Already loaded (possibly by batch prefetch), value does not exist
+        return DBValue.Null
+    end
+
     -- load from db
     local sql = [[select * from [.ref-values]
             where ObjectID = :ObjectID and PropertyID = :PropertyID and PropIndex <= :PropIndex
@@ -122,8 +129,11 @@ function DBProperty:GetValue(idx)
     for row in self.DBOV.ClassDef.DBContext:loadRows(sql, { ObjectID = self.DBOV.ID,
                                                             PropertyID = self.PropDef.ID, PropIndex = idx }) do
         -- TODO what if index 1 is set in .ref-values and in .objects[A..P]? Override? Ignore?
-        table_insert(self.values, row.PropIndex, DBValue(row))
+        if not self.values[row.PropIndex] then
+            self.values[row.PropIndex] = DBValue.FromRow(row, self.DBOV.ClassDef.DBContext)
+        end
     end
+    self.loadedCount = idx
 
     if not self.values[idx] then
         return DBValue.Null
@@ -188,6 +198,7 @@ Used by WritableDBOV (DBObject.curVer)
 ---@field PropDef PropertyDef
 ---@field values table<number, DBValue>
 ---@field appendIndex number @comment auto-decrement value used for appended values
+---@field dirty table<number, boolean> | nil @comment indexes of values which differ from original ones
 local ChangedDBProperty = class(DBProperty)
 
 function ChangedDBProperty:_init(DBOV, propDef)
@@ -236,7 +247,7 @@ function ChangedDBProperty:SetValue(idx, val)
         DBContext.AccessControl:ensureCurrentUserAccessForProperty(
                 self.PropDef.ID, self.DBOV.DBObject.state)
         local prop = self:getOriginalProperty()
-        if prop then
+        if prop and prop.values and prop.values[idx] then
             result = prop:cloneValue(idx)
         else
             result = DBValue {  }
@@ -253,6 +264,33 @@ function ChangedDBProperty:SetValue(idx, val)
         result = DBValue { Value = val }
         self.values[idx] = result
     end
+
+    self:updateDirtyState(idx, result)
+end
+
+-- Marks value as dirty if it differs from the original one. Values which are not loaded from
+-- original object, and values with deferred save action are always treated as dirty
+---@param idx number
+---@param dbv DBValue
+function ChangedDBProperty:updateDirtyState(idx, dbv)
+    if not self.dirty then
+        self.dirty = {}
+    end
+
+    if dbv.deferredSaveAction ~= nil then
+        self.dirty[idx] = true
+        return
+    end
+
+    local orig = self:getOriginalProperty()
+    local origValue = orig and orig.values and orig.values[idx]
+    self.dirty[idx] = (origValue == nil or origValue.Value ~= dbv.Value) or nil
+end
+
+-- Returns true if any value differs from the original one
+---@return boolean
+function ChangedDBProperty:isDirty()
+    return self.dirty ~= nil and next(self.dirty) ~= nil
 end
 
 ---@param idx number @comment 1 based index
@@ -324,6 +362,66 @@ function ChangedDBProperty:SaveToDB(ctx)
         valWrapper = string.format('cast(:Value as %s)', nativeType)
     end
 
+    local compressThreshold = self.PropDef:getCompressThreshold()
+    if compressThreshold and not DBContext:isCompressionSupported() then
+        compressThreshold = nil
+    end
+
+    local dedupThreshold = self.PropDef:getDedupThreshold()
+    if dedupThreshold and not DBContext:isDedupSupported() then
+        dedupThreshold = nil
+    end
+
+    --[[ Returns SQL expression for Value and ctlv to be saved. Long values are either put to [.value_store]
+    (and then [.ref-values] gets value hash), or stored compressed
+    ]]
+    ---@param dbv DBValue
+    ---@return string, number
+    local function prepareValue(dbv)
+        local v = dbv.Value
+        if type(v) == 'string' then
+            if dedupThreshold and #v >= dedupThreshold then
+                -- RefCount is incremented by trigger on [.ref-values]
+                DBContext:execStatement(string.format([[insert or ignore into [.value_store] (Hash, [Value])
+                    values (sha3(:Value), %s);]], valWrapper), { Value = v })
+                return 'sha3(:Value)', bits.bor(propCtlv, Constants.CTLV_FLAGS.DEDUP)
+            end
+
+            if compressThreshold and #v >= compressThreshold then
+                return 'compress(:Value)', bits.bor(propCtlv, Constants.CTLV_FLAGS.COMPRESSED)
+            end
+        end
+        return valWrapper, propCtlv
+    end
+
+    --[[ Saves cell MetaData to [.cell_metadata]. MetaData is written only if it was loaded or assigned
+    (see ReadOnlyDBOV:loadCellMetaData), so that not loaded MetaData is kept as is. JSON null removes MetaData
+    ]]
+    ---@param params table @comment ObjectID, PropertyID, PropIndex
+    ---@param dbv DBValue
+    local function saveMetaData(params, dbv)
+        local metaData = dbv.MetaData
+        if metaData == nil then
+            return
+        end
+
+        if metaData == JSON.null then
+            DBContext:execStatement([[delete from [.cell_metadata]
+                where ObjectID = :ObjectID and PropertyID = :PropertyID and PropIndex = :PropIndex;]], params)
+        elseif params.PropIndex < 0 then
+            -- Appended value. Actual index has been assigned on insert
+            DBContext:execStatement([[insert or replace into [.cell_metadata] (ObjectID, PropertyID, PropIndex, MetaData)
+                select :ObjectID, :PropertyID, max(PropIndex), :MetaData from [.ref-values]
+                where ObjectID = :ObjectID and PropertyID = :PropertyID;]],
+                    { ObjectID = params.ObjectID, PropertyID = params.PropertyID, MetaData = JSON.encode(metaData) })
+        else
+            DBContext:execStatement([[insert or replace into [.cell_metadata] (ObjectID, PropertyID, PropIndex, MetaData)
+                values (:ObjectID, :PropertyID, :PropIndex, :MetaData);]],
+                    { ObjectID = params.ObjectID, PropertyID = params.PropertyID, PropIndex = params.PropIndex,
+                      MetaData = JSON.encode(metaData) })
+        end
+    end
+
     ---@param idx number
     ---@param dbv DBValue
     local function saveDBValue(idx, dbv)
@@ -336,32 +434,33 @@ function ChangedDBProperty:SaveToDB(ctx)
         if op == Constants.OPERATION.CREATE then
             if dbv.Value ~= nil then
                 --  insert
+                local valueExpr, ctlv = prepareValue(dbv)
                 local params = {
                     ObjectID = self.DBOV.ID,
                     PropertyID = self.PropDef.ID,
                     PropIndex = idx,
                     Value = dbv.Value,
-                    ctlv = propCtlv,
-                    MetaData = dbv.MetaData and JSON.encode(dbv.MetaData) or nil }
+                    ctlv = ctlv }
 
                 if idx < 0 then
                     -- Append new value
                     DBContext:execStatement(string.format(
                     ---@language sqlite
                             [[insert into [.ref-values]
-                    (ObjectID, PropertyID, PropIndex, [Value], ctlv, MetaData) values
+                    (ObjectID, PropertyID, PropIndex, [Value], ctlv) values
                     (:ObjectID, :PropertyID,
                     coalesce((select max(PropIndex) from [.ref-values] where ObjectID = :ObjectID and PropertyID = :PropertyID limit 1), 0) + 1,
-                    %d, :ctlv, :MetaData);]], valWrapper)
+                    %s, :ctlv);]], valueExpr)
                     , params)
                 else
                     -- Add or update value with known index
                     DBContext:execStatement(string.format([[insert into [.ref-values]
-                    (ObjectID, PropertyID, PropIndex, [Value], ctlv, MetaData) values
-                    (:ObjectID, :PropertyID, :PropIndex, %s, :ctlv, :MetaData);]], valWrapper)
+                    (ObjectID, PropertyID, PropIndex, [Value], ctlv) values
+                    (:ObjectID, :PropertyID, :PropIndex, %s, :ctlv);]], valueExpr)
                     , params)
                 end
 
+                saveMetaData(params, dbv)
             end
         else
             if dbv.Value == nil then
@@ -372,6 +471,8 @@ function ChangedDBProperty:SaveToDB(ctx)
                         { old_ObjectID = orig_prop.DBOV.ID,
                           old_PropertyID = orig_prop.PropDef.ID,
                           old_PropIndex = idx })
+                saveMetaData({ ObjectID = orig_prop.DBOV.ID, PropertyID = orig_prop.PropDef.ID, PropIndex = idx },
+                        { MetaData = JSON.null })
             else
 
                 if self ~= orig_prop and (self.DBOV.ID ~= orig_prop.DBOV.ID or self.PropDef.ID ~= orig_prop.PropDef.ID) then
@@ -379,38 +480,57 @@ function ChangedDBProperty:SaveToDB(ctx)
                     -- TODO
                 else
                     -- Regular insert/update
+                    local valueExpr, ctlv = prepareValue(dbv)
                     local params = {
                         ObjectID = self.DBOV.ID,
                         PropertyID = self.PropDef.ID,
                         PropIndex = idx,
                         Value = dbv.Value,
-                        ctlv = propCtlv,
-                        MetaData = dbv.MetaData and JSON.encode(dbv.MetaData) or nil }
+                        ctlv = ctlv }
 
                     if idx < 0 then
                         -- Append new value
                         DBContext:execStatement(([[insert or replace into [.ref-values]
-                    (ObjectID, PropertyID, PropIndex, [Value], ctlv, MetaData) values
+                    (ObjectID, PropertyID, PropIndex, [Value], ctlv) values
                     (:ObjectID, :PropertyID,
                     coalesce((select max(PropIndex) from [.ref-values] where ObjectID = :ObjectID and PropertyID = :PropertyID limit 1), 0) + 1,
-                    %s, :ctlv, :MetaData);]]):format(valWrapper), params)
+                    %s, :ctlv);]]):format(valueExpr), params)
                     else
+                        if dedupThreshold then
+                            -- Replaced row would not fire delete trigger, and RefCount of its stored value
+                            -- would not be decremented. So, old value is deleted explicitly
+                            DBContext:execStatement([[delete from [.ref-values]
+                            where ObjectID = :ObjectID and PropertyID = :PropertyID and PropIndex = :PropIndex;]],
+                                    params)
+                        end
+
                         -- Add or update value with known index
                         DBContext:execStatement(([[insert or replace into [.ref-values]
-                    (ObjectID, PropertyID, PropIndex, [Value], ctlv, MetaData) values
-                    (:ObjectID, :PropertyID, :PropIndex, %s, :ctlv, :MetaData);]]):format(valWrapper), params)
+                    (ObjectID, PropertyID, PropIndex, [Value], ctlv) values
+                    (:ObjectID, :PropertyID, :PropIndex, %s, :ctlv);]]):format(valueExpr), params)
                     end
+
+                    saveMetaData(params, dbv)
                 end
             end
         end
     end
 
+    -- Unchanged values of existing object are not written
+    local skipClean = op == Constants.OPERATION.UPDATE
+
     for idx, dbv in pairs(self.values) do
-        if dbv.deferredSaveAction ~= nil then
-            DBContext.ActionQueue:enqueue(function(params)
-                params.dbv.deferredSaveAction()
-                saveDBValue(params.idx, params.dbv)
-            end, { dbv = dbv, idx = idx })
+        if skipClean and not (self.dirty and self.dirty[idx]) then
+            DBContext:countSkippedWrites(1)
+        elseif dbv.deferredSaveAction ~= nil then
+            -- Value gets resolved later (e.g. reference by UDID), together with other deferred values,
+            -- and is then either written in bulk or saved individually via save()
+            ---@type DeferredDBValue
+            local target = { dbv = dbv, ObjectID = self.DBOV.ID, PropertyID = self.PropDef.ID, PropIndex = idx,
+                             ctlv = propCtlv, save = function()
+                    saveDBValue(idx, dbv)
+                end }
+            dbv.deferredSaveAction(target)
         else
             saveDBValue(idx, dbv)
         end
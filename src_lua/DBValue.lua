@@ -23,6 +23,13 @@ Value
 MetaData
 ctlv
 
+Compressed values (ctlv has CTLV_FLAGS.COMPRESSED flag) and values kept in [.value_store] (CTLV_FLAGS.DEDUP)
+are loaded as PackedDBValue, which keeps raw data (compressed value or hash) and unpacks it on first access
+to Value field.
+
+MetaData is kept in [.cell_metadata] and is not loaded together with Value. It gets assigned on demand by
+ReadOnlyDBOV:loadCellMetaData
+
 For the sake of memory saving and easier data consistency property ID/class, object and property index
 are not fields of DBValue. Instead, DBProperty and propIndex are passed to all DBValue's functions as
 first 2 parameters. Thus DBObject is accessed from DBProperty.DBObject, PropertyDef from DBProperty.PropDef
@@ -39,6 +46,15 @@ local Constants = require 'Constants'
 ---@field ctlv number
 ---@field MetaData table | string
 
+-- Target [.ref-values] row for value with deferred save action
+---@class DeferredDBValue
+---@field dbv DBValue
+---@field ObjectID number
+---@field PropertyID number
+---@field PropIndex number
+---@field ctlv number
+---@field save function @comment saves dbv individually, as regular value
+
 ---@class DBValue
 ---@field Value any
 ---@field ctlv number
@@ -200,6 +216,62 @@ function DBValue:afterSaveToDB(DBProperty, propIndex)
 
 end
 
+--[[
+PackedDBValue
+Value loaded from compressed or deduplicated [.ref-values] row. Raw data is kept in 'packed' field,
+and gets unpacked on first read of Value. Assigning Value discards packed data
+]]
+---@class PackedDBValue : DBValue
+---@field packed string
+---@field unpack function @comment function(packed) returning actual value (see DBContext.unpackValue, DBContext.loadStoredValue)
+local PackedDBValue = class(DBValue)
+
+---@param row DBValueCtorParams
+---@param unpack function
+function PackedDBValue:_init(row, unpack)
+    self:super(row)
+    self.packed = self.Value
+    self.unpack = unpack
+    self.Value = nil
+end
+
+PackedDBValue.__index = function(self, key)
+    if key == 'Value' then
+        local packed = rawget(self, 'packed')
+        if packed == nil then
+            return nil
+        end
+        local result = self.unpack(packed)
+        rawset(self, 'Value', result)
+        rawset(self, 'packed', nil)
+        rawset(self, 'unpack', nil)
+        return result
+    end
+    return PackedDBValue[key]
+end
+
+PackedDBValue.__newindex = function(self, key, value)
+    if key == 'Value' then
+        rawset(self, 'packed', nil)
+        rawset(self, 'unpack', nil)
+    end
+    rawset(self, key, value)
+end
+
+-- Creates DBValue from [.ref-values] row. Packed values are not unpacked till they are actually read
+---@param row DBValueCtorParams
+---@param DBContext DBContext
+---@return DBValue
+function DBValue.FromRow(row, DBContext)
+    local ctlv = row.ctlv or 0
+    if bits.band(ctlv, Constants.CTLV_FLAGS.DEDUP) ~= 0 then
+        return PackedDBValue(row, DBContext.loadStoredValue)
+    elseif bits.band(ctlv, Constants.CTLV_FLAGS.COMPRESSED) ~= 0 then
+        return PackedDBValue(row, DBContext.unpackValue)
+    end
+    return DBValue(row)
+end
+
 -- Singleton constant Null DBValue. All operations with Null value result in null
 ---@class NullDBValue
 local NullDBValue
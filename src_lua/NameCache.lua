@@ -0,0 +1,127 @@
+--[[
+Intern table of symbol names ([.sym_names]): name text <-> name ID.
+
+Names are loaded on first access (or all at once by preload(), see config.preloadNames) and are kept
+for the lifetime of DBContext. Records in [.sym_names] are never deleted, so cached entries do not
+become stale. The only exception is names inserted by a transaction (or group commit savepoint) which
+then gets rolled back: such names are tracked in 'pending' list and removed from the cache on rollback.
+C side keeps its own cache for decoding names in virtual tables and flexi_json_agg (see src/misc/sym_names.c),
+which is reset at the same time.
+
+Misses are not cached, as names can be added by other connections at any time.
+]]
+
+local class = require 'pl.class'
+
+---@class NameCache
+---@field DBContext DBContext
+---@field byValue table<string, number>
+---@field byID table<number, string>
+---@field pending string[] @comment names inserted by current transaction
+---@field preloaded boolean
+local NameCache = class()
+
+---@param DBContext DBContext
+function NameCache:_init(DBContext)
+    self.DBContext = DBContext
+    self.byValue = {}
+    self.byID = {}
+    self.pending = {}
+    self.preloaded = false
+end
+
+---@param id number
+---@param value string
+function NameCache:put(id, value)
+    self.byValue[value] = id
+    self.byID[id] = value
+end
+
+-- Loads all names in one pass
+function NameCache:preload()
+    for row in self.DBContext:loadRows([[select ID, [Value] from [.sym_names] where [Value] is not null;]], {}) do
+        self:put(row.ID, row.Value)
+    end
+    self.preloaded = true
+end
+
+--- Returns name ID, or nil if name does not exist
+---@param name string
+---@return number | nil
+function NameCache:getID(name)
+    local result = self.byValue[name]
+    if result == nil then
+        local row = self.DBContext:loadOneRow([[select ID from [.sym_names] where [Value] = :v limit 1;]],
+                { v = name })
+        if row then
+            result = row.ID
+            self:put(result, name)
+        end
+    end
+    return result
+end
+
+--- Returns name text by its ID, or nil if name does not exist
+---@param id number
+---@return string | nil
+function NameCache:getValue(id)
+    local result = self.byID[id]
+    if result == nil then
+        local row = self.DBContext:loadOneRow([[select [Value] from [.sym_names] where ID = :v limit 1;]],
+                { v = id })
+        if row and row.Value ~= nil then
+            result = row.Value
+            self:put(id, result)
+        end
+    end
+    return result
+end
+
+--- Returns ID of existing name, or inserts new name and returns its ID
+---@param name string
+---@return number
+function NameCache:ensure(name)
+    local result = self:getID(name)
+    if result == nil then
+        self.DBContext:execStatement([[insert into [.sym_names] ([Value]) values (:v);]], { v = name })
+        result = self.DBContext.db:last_insert_rowid()
+        self:put(result, name)
+        table.insert(self.pending, name)
+    end
+    return result
+end
+
+--- Returns current position in list of pending names, to be passed to rollback()
+---@return number
+function NameCache:mark()
+    return #self.pending
+end
+
+--- Removes names inserted after given mark (0 - all pending names) from the cache
+---@param mark number
+function NameCache:rollback(mark)
+    mark = mark or 0
+    if #self.pending <= mark then
+        return
+    end
+
+    for i = #self.pending, mark + 1, -1 do
+        local name = table.remove(self.pending, i)
+        local id = self.byValue[name]
+        self.byValue[name] = nil
+        if id then
+            self.byID[id] = nil
+        end
+    end
+    self.preloaded = false
+    self.DBContext.db:exec [[select flexi_sym_names_reset();]]
+end
+
+-- Pending names become permanent, after transaction has been committed
+function NameCache:commit()
+    if #self.pending > 0 then
+        self.pending = {}
+    end
+end
+
+return NameCache
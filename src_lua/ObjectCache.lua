@@ -0,0 +1,204 @@
+--[[
+Eviction order for DBContext.Objects cache.
+
+Objects are kept in DBContext.Objects map (by object ID), as before. ObjectCache only tracks
+usage order and decides which objects to drop when number of tracked objects exceeds capacity.
+
+Uses segmented LRU, which is resistant to large scans: newly loaded objects go to 'probation' segment,
+and get promoted to 'protected' segment on second access. Eviction starts from the least recently used
+object in probation segment, so single pass over millions of objects does not push out objects which
+are used repeatedly (e.g. reference data).
+
+Only clean objects (in 'R' state and not in DBContext.DirtyObjects) get evicted. Objects which are
+being created, edited or deleted are pinned: they are removed from tracking and stay in DBContext.Objects
+until end of request.
+]]
+
+local class = require 'pl.class'
+local Constants = require 'Constants'
+
+-- Doubly linked list of object IDs, with O(1) push, remove and pop
+---@class ObjectCacheSegment
+---@field prev table<number, number>
+---@field next table<number, number>
+---@field head number
+---@field tail number
+---@field count number
+local Segment = class()
+
+function Segment:_init()
+    self:clear()
+end
+
+function Segment:clear()
+    self.prev = {}
+    self.next = {}
+    self.head = nil
+    self.tail = nil
+    self.count = 0
+end
+
+---@param id number
+function Segment:has(id)
+    return self.head == id or self.prev[id] ~= nil
+end
+
+-- Adds id as the most recently used
+---@param id number
+function Segment:push(id)
+    if self.head then
+        self.prev[self.head] = id
+        self.next[id] = self.head
+    else
+        self.tail = id
+    end
+    self.head = id
+    self.count = self.count + 1
+end
+
+---@param id number
+function Segment:remove(id)
+    local p, n = self.prev[id], self.next[id]
+    if p then
+        self.next[p] = n
+    else
+        self.head = n
+    end
+    if n then
+        self.prev[n] = p
+    else
+        self.tail = p
+    end
+    self.prev[id] = nil
+    self.next[id] = nil
+    self.count = self.count - 1
+end
+
+-- Removes and returns the least recently used id
+---@return number
+function Segment:pop()
+    local id = self.tail
+    if id then
+        self:remove(id)
+    end
+    return id
+end
+
+---@class ObjectCacheStats
+---@field entries number
+---@field peakEntries number
+---@field peakMemoryKB number
+---@field hits number
+---@field misses number
+---@field evictions number
+
+---@class ObjectCache
+---@field capacity number @comment max number of tracked objects, 0 - unlimited
+---@field probation ObjectCacheSegment
+---@field protected ObjectCacheSegment
+---@field stats ObjectCacheStats
+local ObjectCache = class()
+
+-- Share of protected segment in total capacity
+local PROTECTED_RATIO = 0.8
+
+---@param capacity number
+function ObjectCache:_init(capacity)
+    self.capacity = capacity or 0
+    self.probation = Segment()
+    self.protected = Segment()
+    self.stats = { entries = 0, peakEntries = 0, peakMemoryKB = 0, hits = 0, misses = 0, evictions = 0 }
+end
+
+---@return number
+function ObjectCache:count()
+    return self.probation.count + self.protected.count
+end
+
+-- Registers newly loaded object
+---@param id number
+function ObjectCache:add(id)
+    self.stats.misses = self.stats.misses + 1
+    if self.capacity <= 0 or self.probation:has(id) or self.protected:has(id) then
+        return
+    end
+
+    self.probation:push(id)
+    local count = self:count()
+    if count > self.stats.peakEntries then
+        self.stats.peakEntries = count
+    end
+end
+
+-- Registers access to already loaded object
+---@param id number
+function ObjectCache:touch(id)
+    self.stats.hits = self.stats.hits + 1
+    if self.capacity <= 0 then
+        return
+    end
+
+    if self.probation:has(id) then
+        self.probation:remove(id)
+        self.protected:push(id)
+
+        -- Demote least recently used protected objects back to probation
+        local maxProtected = math.floor(self.capacity * PROTECTED_RATIO)
+        while self.protected.count > maxProtected do
+            self.probation:push(self.protected:pop())
+        end
+    elseif self.protected:has(id) then
+        self.protected:remove(id)
+        self.protected:push(id)
+    end
+end
+
+---@param id number
+function ObjectCache:remove(id)
+    if self.probation:has(id) then
+        self.probation:remove(id)
+    elseif self.protected:has(id) then
+        self.protected:remove(id)
+    end
+end
+
+-- Removes least recently used clean objects from objects map, until number of tracked objects fits capacity
+---@param objects table<number, DBObject>
+---@param dirtyObjects table<number, DBObject>
+function ObjectCache:evict(objects, dirtyObjects)
+    if self.capacity <= 0 then
+        return
+    end
+
+    while self:count() > self.capacity do
+        local id = self.probation:pop() or self.protected:pop()
+        local obj = objects[id]
+        -- Dirty objects are not tracked anymore, and stay in objects map till end of request
+        if obj and obj.state == Constants.OPERATION.READ and not (dirtyObjects and dirtyObjects[id]) then
+            objects[id] = nil
+            self.stats.evictions = self.stats.evictions + 1
+        end
+    end
+end
+
+-- Updates peak memory usage
+function ObjectCache:sampleMemory()
+    local kb = collectgarbage('count')
+    if kb > self.stats.peakMemoryKB then
+        self.stats.peakMemoryKB = kb
+    end
+end
+
+-- Resets tracking. Statistics are preserved
+function ObjectCache:clear()
+    self.probation:clear()
+    self.protected:clear()
+end
+
+---@return ObjectCacheStats
+function ObjectCache:getStats()
+    self.stats.entries = self:count()
+    return self.stats
+end
+
+return ObjectCache
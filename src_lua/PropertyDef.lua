@@ -105,6 +105,8 @@ PropertyDef
 ---@field accessRules table
 ---@field indexing string
 ---@field defaultValue any
+---@field compress boolean | number @comment store long values compressed. true - use config.compressThreshold, number - threshold in bytes
+---@field dedup boolean | number @comment store long values once in [.value_store]. true - use config.dedupThreshold, number - threshold in bytes
 
 ---@class PropertyDefCtorParams
 ---@field ClassDef ClassDef
@@ -235,28 +237,47 @@ function PropertyDef:saveToDB()
     -- Set ctlv
     self.ctlv = self:GetCTLV()
 
+    -- Property attributes are duplicated in [.class_props] columns for fast lookup
+    local rules = self.D.rules or {}
+
     if self.ID and tonumber(self.ID) > 0 then
         -- Update existing
         self.ClassDef.DBContext:execStatement([[update [.class_props]
-        set NameID = :nameID, ctlv = :ctlv, ctlvPlan = :ctlvPlan, ColMap = :ColMap
+        set NameID = :nameID, ctlv = :ctlv, ctlvPlan = :ctlvPlan, ColMap = :ColMap,
+            [Name] = :Name, [Type] = :Type, MinOccurrences = :MinOccurrences, MaxOccurrences = :MaxOccurrences,
+            MaxLength = :MaxLength, IndexType = :IndexType
         where ID = :id]],
                 {
                     nameID = self.Name.id,
                     ctlv = self.ctlv,
                     ctlvPlan = self.ctlvPlan,
                     ColMap = self.ColMap,
+                    Name = self.Name.text,
+                    Type = rules.type,
+                    MinOccurrences = rules.minOccurrences or 0,
+                    MaxOccurrences = rules.maxOccurrences or 1,
+                    MaxLength = rules.maxLength,
+                    IndexType = self.D.index,
                     id = self.ID
                 })
     else
         -- Insert new
         self.ClassDef.DBContext:execStatement(
-                [[insert into [.class_props] (ClassID, NameID, ctlv, ctlvPlan, ColMap)
-                    values (:ClassID, :NameID, :ctlv, :ctlvPlan, :ColMap);]], {
+                [[insert into [.class_props] (ClassID, NameID, ctlv, ctlvPlan, ColMap,
+                    [Name], [Type], MinOccurrences, MaxOccurrences, MaxLength, IndexType)
+                    values (:ClassID, :NameID, :ctlv, :ctlvPlan, :ColMap,
+                    :Name, :Type, :MinOccurrences, :MaxOccurrences, :MaxLength, :IndexType);]], {
                     ClassID = self.ClassDef.ClassID,
                     NameID = self.Name.id,
                     ctlv = self.ctlv,
                     ctlvPlan = self.ctlvPlan,
-                    ColMap = self.ColMap
+                    ColMap = self.ColMap,
+                    Name = self.Name.text,
+                    Type = rules.type,
+                    MinOccurrences = rules.minOccurrences or 0,
+                    MaxOccurrences = rules.maxOccurrences or 1,
+                    MaxLength = rules.maxLength,
+                    IndexType = self.D.index
                 })
 
         self.ID = self.ClassDef.DBContext.db:last_insert_rowid()
@@ -326,6 +347,89 @@ function PropertyDef:GetCTLV()
     return result
 end
 
+-- true if values of this property may be stored packed, i.e. compressed or deduplicated.
+-- Only text, JSON and blob values stored in [.ref-values] can be packed
+---@return boolean
+function PropertyDef:supportsPackedValues()
+    if self.ColMap then
+        return false
+    end
+
+    local vtype = self:GetVType()
+    if vtype ~= Constants.vtype.default and vtype ~= Constants.vtype.json then
+        return false
+    end
+
+    local nativeType = self:getNativeType()
+    return nativeType == '' or nativeType == 'text' or nativeType == 'blob'
+end
+
+--[[ Returns min length (in bytes) of value to be stored compressed, or nil if values of this property
+are never compressed. Compression is enabled by 'compress' attribute of property definition.
+Indexed properties are never compressed, as their indexes are built on stored values
+]]
+---@return number | nil
+function PropertyDef:getCompressThreshold()
+    local compress = self.D.compress
+    if not compress or self:getCtlvIndexMask() ~= 0 or not self:supportsPackedValues() then
+        return nil
+    end
+
+    if type(compress) == 'number' then
+        return compress
+    end
+    return self.ClassDef.DBContext.config.compressThreshold
+end
+
+--[[ Returns min length (in bytes) of value to be stored in [.value_store], or nil if values of this property
+are always stored in [.ref-values]. Enabled by 'dedup' attribute of property definition.
+Deduplicated values are indexed by their hashes, so only equality search is supported by index
+]]
+---@return number | nil
+function PropertyDef:getDedupThreshold()
+    local dedup = self.D.dedup
+    if not dedup or not self:supportsPackedValues() then
+        return nil
+    end
+
+    if type(dedup) == 'number' then
+        return dedup
+    end
+    return self.ClassDef.DBContext.config.dedupThreshold
+end
+
+-- Returns SQL expression to access [.ref-values].Value of this property.
+-- Values of compressed properties are unpacked by flexi_unpack. If compression functions are not registered,
+-- packed value is returned as is, and is to be unpacked by caller (see DBContext.unpackValue)
+---@param alias string | nil @comment optional alias of [.ref-values] table
+---@return string
+function PropertyDef:GetRefValueExpression(alias)
+    local prefix = alias and (alias .. '.') or ''
+    local result = prefix .. '[Value]'
+    if self.D.compress and self.ClassDef.DBContext:isCompressionSupported() then
+        result = string.format('flexi_unpack(%s[Value], %sctlv%s)', prefix, prefix,
+                self:getNativeType() == 'blob' and ', 1' or '')
+    end
+    if self.D.dedup then
+        result = string.format(
+                '(case when %sctlv & %d <> 0 then (select vs.[Value] from [.value_store] vs where vs.Hash = %s[Value]) else %s end)',
+                prefix, Constants.CTLV_FLAGS.DEDUP, prefix, result)
+    end
+    return result
+end
+
+-- Returns SQL condition on [.ref-values].Value of this property.
+-- Equality of deduplicated values is checked by comparing hashes, without access to [.value_store]
+---@param cond string @comment =, <, <=, >, >=
+---@param val string @comment SQL expression (literal or parameter)
+---@return string
+function PropertyDef:GetRefValueCondition(cond, val)
+    if self.D.dedup and not self.D.compress and cond == '=' then
+        return string.format('[Value] in (%s, sha3(%s))', val, val)
+    end
+    return string.format('%s %s %s', self:GetRefValueExpression(), cond, val)
+end
+
 --Applies property definition to the database. Called on property save
 function PropertyDef:beforeSaveToDB()
     self.ClassDef:assignColMappingForProperty(self)
@@ -388,12 +492,12 @@ end
 function PropertyDef:GetColumnExpression(first)
     if self.ColMap then
         return string.format(
-                '%s coalesce([%s], (select [Value] from [.ref-values] where ClassID=%d and PropertyID=%d and PropIndex=0 limit 1)) as [%s]',
-                first and ' ' or ',', self.ColMap, self.ClassDef.ClassID, self.ID, self.Name.text)
+                '%s coalesce([%s], (select %s from [.ref-values] where ClassID=%d and PropertyID=%d and PropIndex=0 limit 1)) as [%s]',
+                first and ' ' or ',', self.ColMap, self:GetRefValueExpression(), self.ClassDef.ClassID, self.ID, self.Name.text)
     else
         return string.format(
-                '%s (select [Value] from [.ref-values] where ClassID=%d and PropertyID=%d and PropIndex=0 limit 1) as [%s]',
-                first and '' or ',', self.ClassDef.ClassID, self.ID, self.Name.text)
+                '%s (select %s from [.ref-values] where ClassID=%d and PropertyID=%d and PropIndex=0 limit 1) as [%s]',
+                first and '' or ',', self:GetRefValueExpression(), self.ClassDef.ClassID, self.ID, self.Name.text)
     end
 end
 
@@ -420,8 +524,9 @@ end
 -- Sets dbv.Value from source data v, with possible conversion and/or validation
 ---@param dbv DBValue
 ---@param v any
----@return nil | function @comment If function is returned, it will be treated as pending action to be
----called at the second step of updates. Returning nil meand that dbv.Value was set successfully
+---@return nil | fun(target: DeferredDBValue) @comment If function is returned, it will be treated as pending action
+---to be called on save, with target [.ref-values] row. Action is responsible for resolving dbv.Value and saving it
+---(see RefDataManager). Returning nil means that dbv.Value was set successfully
 function PropertyDef:ImportDBValue(dbv, v)
     dbv.Value = v
 end
@@ -903,6 +1008,21 @@ function ReferencePropertyDef:ImportDBValue(dbv, v)
     return self.ClassDef.DBContext.RefDataManager:importReferenceValue(self, dbv, v)
 end
 
+-- Returns referenced object ID, or, if include spec is set, referenced object data
+---@param dbo DBObject
+---@param dbv DBValue
+---@param include ExportIncludeSpec | nil @comment include spec for referenced object
+---@return any
+function ReferencePropertyDef:ExportDBValue(dbo, dbv, include)
+    if include == nil or type(dbv.Value) ~= 'number' then
+        return dbv.Value
+    end
+
+    -- Referenced object is expected to be already prefetched by DBContext:PrefetchObjects
+    local refObj = self.ClassDef.DBContext:LoadObject(dbv.Value)
+    return refObj:ExportData(nil, include, true)
+end
+
 --[[
 ===============================================================================
 EnumPropertyDef
@@ -1418,6 +1538,8 @@ PropertyDef.Schema = schema.AllOf(schema.Record {
 
     index = schema.OneOf(schema.Nil, 'index', 'unique', 'range', 'fulltext'),
     noTrackChanges = schema.Optional(schema.Boolean),
+    compress = schema.Optional(schema.OneOf(schema.Boolean, schema.AllOf(schema.Integer, schema.PositiveNumber))),
+    dedup = schema.Optional(schema.OneOf(schema.Boolean, schema.AllOf(schema.Integer, schema.PositiveNumber))),
 
     enumDef = schema.Case('rules.type',
             { schema.OneOf('enum', 'fkey', 'foreignkey'),
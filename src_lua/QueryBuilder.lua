@@ -17,8 +17,11 @@ At the end, all found rows are scanned and expression is applied in the context
 Index(es) are applied only when the following conditions are met:
 
 - filter is only 'and' expression at the top level (Prop1 == 123 and Prop2 == 'abc').
-'or', 'not' will fall back to full scan (e.g. Prop1 == 123 or Prop2 == 'abc')
-- any branches with 'or', 'not' will exclude entire branch from using index
+- branches with 'or', 'not' are processed as sets of object IDs (see src/misc/idset.c):
+'or' is union of sets for both sides, 'and' inside of 'or' is intersection, 'not' is difference.
+(e.g. Prop1 == 123 or Prop2 == 'abc' -> union of 2 index lookups).
+Sets may be supersets of matching objects (e.g. for 'and' with non indexable side), as filter expression
+is applied to all found objects anyway. 'or' with non indexable side, and 'not' over superset, fall back to full scan.
 
 Running query is done in the following steps:
 
@@ -102,6 +105,7 @@ local DBValue = require 'DBValue'
 local Constants = require 'Constants'
 local bit52 = require('Util').bit52
 local Sandbox = require 'sandbox'
+local JSON = cjson or require 'cjson'
 
 ---@class QueryBuilderIndexItem
 ---@field propID number
@@ -109,6 +113,12 @@ local Sandbox = require 'sandbox'
 ---@field val nil | boolean | number | string | table @comment params.Name
 ---@field processed number @comment Counter of how many times property was included into index search
 
+-- Set of object IDs, as SQL expression returning flexi_idset BLOB
+---@class IdSetExpr
+---@field sql string
+---@field exact boolean @comment true if set has exactly objects matching expression, false if it is superset
+---@field negated boolean @comment true if expression matches objects which are NOT in the set
+
 ---@class FilterDef
 ---@field ClassDef ClassDef
 ---@field Expression string
@@ -117,6 +127,7 @@ local Sandbox = require 'sandbox'
 ---@field params table
 ---@field matchCallCount number @comment Number of MATCH function calls
 ---@field callCount number @comment Total umber of function calls
+---@field idSets IdSetExpr[] @comment sets for 'or' and 'not' branches of top level 'and' expression
 local FilterDef = class()
 
 ---@class ASTToken
@@ -165,6 +176,7 @@ function FilterDef:process_token(astToken)
     elseif self:is_prop_expression(astToken) then
     elseif self:is_match_call(astToken) then
         -- TODO
+    elseif self:is_or_not_expr(astToken) then
     end
 end
 
@@ -277,8 +289,10 @@ local directConditions = {
     le = '<=',
 }
 
+-- Checks if astToken is comparison of property with constant value
 ---@param astToken ASTToken
-function FilterDef:is_prop_expression(astToken)
+---@return QueryBuilderIndexItem | nil
+function FilterDef:parse_prop_expression(astToken)
     astToken = skip_parens(astToken)
 
     if astToken.tag == 'Op' and (astToken[1] == 'lt' or astToken[1] == 'le' or astToken[1] == 'eq') then
@@ -286,21 +300,170 @@ function FilterDef:is_prop_expression(astToken)
         local propVal = self:is_valid_value(prop, astToken[3])
 
         if prop and propVal then
-            table.insert(self.indexedItems, { propID = prop.ID,
-                                              cond = directConditions[astToken[1]], val = propVal })
-            return true
+            return { propID = prop.ID, cond = directConditions[astToken[1]], val = propVal }
         end
         prop = self:is_property_name(astToken[3])
         propVal = self:is_valid_value(prop, astToken[2])
         if prop and propVal then
-            table.insert(self.indexedItems, { propID = prop.ID,
-                                              cond = reversedConditions[astToken[1]], val = propVal })
-            return true
+            return { propID = prop.ID, cond = reversedConditions[astToken[1]], val = propVal }
         end
     end
+    return nil
+end
+
+---@param astToken ASTToken
+function FilterDef:is_prop_expression(astToken)
+    local item = self:parse_prop_expression(astToken)
+    if item then
+        table.insert(self.indexedItems, item)
+        return true
+    end
     return false
 end
 
+-- Processes 'or' and 'not' branches of top level 'and' expression as sets of object IDs
+---@param astToken ASTToken
+function FilterDef:is_or_not_expr(astToken)
+    astToken = skip_parens(astToken)
+    if astToken.tag == 'Op' and (astToken[1] == 'or' or astToken[1] == 'not') then
+        local idSet = self.ClassDef.DBContext:isIdSetSupported() and self:build_id_set(astToken)
+        if idSet then
+            table.insert(self.idSets, idSet)
+        end
+        return true
+    end
+
+    return false
+end
+
+-- Builds set of object IDs for property comparison, using the same lookup as process_single_properties
+---@param item QueryBuilderIndexItem
+---@return IdSetExpr | nil
+function FilterDef:prop_id_set(item)
+    local propDef = self.ClassDef.DBContext.ClassProps[item.propID]
+    if not propDef then
+        return nil
+    end
+
+    local sql
+    if self.ClassDef.ColMapActive and propDef.ColMap ~= nil then
+        sql = string.format('(select flexi_idset(ObjectID) from [.objects] where ClassID = %d and [%s] %s %s)',
+                self.ClassDef.ClassID, string.upper(propDef.ColMap), item.cond, item.val)
+    else
+        sql = string.format('(select flexi_idset(ObjectID) from [.ref-values] where PropertyID = %d and %s',
+                propDef.ID, propDef:GetRefValueCondition(item.cond, item.val))
+        local propIdxMask = propDef:getIndexMask()
+        if propIdxMask ~= 0 then
+            sql = sql .. string.format(' and (ctlv & %d) = %d', propIdxMask, propIdxMask)
+        end
+        sql = sql .. ')'
+    end
+
+    -- Objects without value may still match because of default value. Collections are compared by Lua rules
+    local exact = propDef.D.defaultValue == nil
+            and ((propDef.D.rules and propDef.D.rules.maxOccurrences) or 1) <= 1
+    return { sql = sql, exact = exact, negated = false }
+end
+
+---@param left IdSetExpr | nil
+---@param right IdSetExpr | nil
+---@return IdSetExpr | nil
+local function and_id_sets(left, right)
+    if not left or not right then
+        -- Non indexable side: other side is superset of result
+        local result = left or right
+        if result then
+            return { sql = result.sql, exact = false, negated = result.negated }
+        end
+        return nil
+    end
+
+    if left.negated and right.negated then
+        -- not A and not B == not (A or B)
+        return { sql = string.format('flexi_idset_union(%s, %s)', left.sql, right.sql),
+                 exact = left.exact and right.exact, negated = true }
+    end
+
+    if left.negated or right.negated then
+        -- A and not B == A except B
+        local pos, neg = left, right
+        if left.negated then
+            pos, neg = right, left
+        end
+        -- Superset of B would remove too many objects, so B must be exact too
+        return { sql = string.format('flexi_idset_except(%s, %s)', pos.sql, neg.sql),
+                 exact = pos.exact and neg.exact, negated = false }
+    end
+
+    return { sql = string.format('flexi_idset_intersect(%s, %s)', left.sql, right.sql),
+             exact = left.exact and right.exact, negated = false }
+end
+
+---@param left IdSetExpr | nil
+---@param right IdSetExpr | nil
+---@return IdSetExpr | nil
+local function or_id_sets(left, right)
+    if not left or not right then
+        return nil
+    end
+
+    if left.negated and right.negated then
+        -- not A or not B == not (A and B)
+        return { sql = string.format('flexi_idset_intersect(%s, %s)', left.sql, right.sql),
+                 exact = left.exact and right.exact, negated = true }
+    end
+
+    if left.negated or right.negated then
+        -- A or not B == not (B except A)
+        local pos, neg = left, right
+        if left.negated then
+            pos, neg = right, left
+        end
+        return { sql = string.format('flexi_idset_except(%s, %s)', neg.sql, pos.sql),
+                 exact = pos.exact and neg.exact, negated = true }
+    end
+
+    return { sql = string.format('flexi_idset_union(%s, %s)', left.sql, right.sql),
+             exact = left.exact and right.exact, negated = false }
+end
+
+-- Builds set of object IDs for expression. Returns nil if expression cannot be resolved by indexes
+---@param astToken ASTToken
+---@return IdSetExpr | nil
+function FilterDef:build_id_set(astToken)
+    astToken = skip_parens(astToken)
+    if astToken.tag == 'Op' then
+        local op = astToken[1]
+        if op == 'and' then
+            return and_id_sets(self:build_id_set(astToken[2]), self:build_id_set(astToken[3]))
+        elseif op == 'or' then
+            return or_id_sets(self:build_id_set(astToken[2]), self:build_id_set(astToken[3]))
+        elseif op == 'not' then
+            -- Complement of superset would miss some objects
+            local idSet = self:build_id_set(astToken[2])
+            if idSet and idSet.exact then
+                return { sql = idSet.sql, exact = true, negated = not idSet.negated }
+            end
+            return nil
+        end
+    end
+
+    local item = self:parse_prop_expression(astToken)
+    if item then
+        return self:prop_id_set(item)
+    end
+
+    return nil
+end
+
+---@param sql string[] @comment pl.List
+function FilterDef:process_id_sets(sql)
+    for _, idSet in ipairs(self.idSets) do
+        sql:append(string.format(' and ObjectID %s (select value from flexi_idset_each(%s))',
+                idSet.negated and 'not in' or 'in', idSet.sql))
+    end
+end
+
 -- Finds first matching index item, byt property ID. Starts from (optional) startIndex
 -- If (optional) ignoreProcessed == true and item is marked as processed, item gets skipped
 ---@param propID number
@@ -467,7 +630,7 @@ function FilterDef:process_single_properties(sql)
                 propSql:append(string.format(' %s %s %s', propDef.ColMap, v.cond, v.val))
             else
                 -- Treat as .ref-values row
-                propSql:append(string.format(' Value %s %s', v.cond, v.val))
+                propSql:append(' ' .. propDef:GetRefValueCondition(v.cond, v.val))
             end
 
             --if not v.processed then
@@ -513,6 +676,7 @@ end
 function FilterDef:build_index_query()
     self.matchCallCount = 0
     self.callCount = 0
+    self.idSets = {}
 
     -- Skip external wrapper and 'Return' tag - they will be always there
     self:process_token(self.ast[1][1])
@@ -522,6 +686,13 @@ function FilterDef:build_index_query()
     result:append(string.format('select * from [.objects] where ClassID = %d',
             self.ClassDef.ClassID))
 
+    -- 0) row level access rules, so that unauthorized objects are not fetched at all
+    local AccessControl = self.ClassDef.DBContext.AccessControl
+    self.params = self.params or {}
+    self.params.__AccessSubjects = AccessControl:getCurrentUserAccessSubjects()
+    result:append(' and ' .. AccessControl.getRowAccessPredicate('[.objects]', Constants.OPERATION.READ,
+            ':__AccessSubjects'))
+
     -- 1) multi key unique indexes
     self:process_multi_key_index(result)
 
@@ -534,6 +705,9 @@ function FilterDef:build_index_query()
     -- 4) single property search - indexed or not
     self:process_single_properties(result)
 
+    -- 4a) 'or' and 'not' branches - via sets of object IDs
+    self:process_id_sets(result)
+
     -- 5. For all 'indexable' tokens (i.e. those which meet criteria to search by index)
     -- and are column-mapped generate SQL 'where' clause to apply to .objects fields directly
     -- TODO
@@ -559,11 +733,25 @@ function QueryBuilder:apply_filter()
 
 end
 
--- Returns list of object IDs, according to reference propDef and filter
+-- Returns list of distinct object IDs, referenced by propDef from the given source objects.
+-- All source objects are processed by single scan on [.ref-values]
 ---@param propDef PropertyDef
----@param filter FilterDef
-function QueryBuilder:GetReferencedObjects(propDef, filter)
+---@param objectIDs number[] @comment source object IDs
+---@return number[]
+function QueryBuilder:GetReferencedObjects(propDef, objectIDs)
+    local result = {}
+    if not objectIDs or #objectIDs == 0 then
+        return result
+    end
 
+    local sql = [[select distinct [Value] from [.ref-values]
+        where PropertyID = :PropertyID and ObjectID in (select value from json_each(:ObjectIDs))
+        and [Value] is not null;]]
+    for row in self.DBContext:loadRows(sql, { PropertyID = propDef.ID, ObjectIDs = JSON.encode(objectIDs) }) do
+        table.insert(result, row.Value)
+    end
+
+    return result
 end
 
 -- TODO
@@ -576,26 +764,136 @@ Takes class definition, filter expression and parameters.
 Uses FilterDef to build SQL. Executes SQL, iterates over all found [.objects],
 uses sandbox for running compiled expression
 applies expression to filter out objects. Stores found object IDs in ObjectIDs array property.
+
+Optionally, takes limit, offset and order by. Order by is always applied in SQL. Filter expression which does not
+depend on object (e.g. '1 == 1' or 'false') is evaluated only once: if it is false, no objects are found, otherwise
+limit and offset are applied in SQL. For other filters limit and offset are applied to objects
+which passed filter, and SQL cursor is closed as soon as limit is reached.
+Found objects can be also consumed one by one, via Iterate(), without collecting all IDs.
 ]]
+
+---@class DBQueryOrderByItem
+---@field prop string @comment property name
+---@field desc boolean
+
+---@class DBQueryOptions
+---@field limit number | nil
+---@field offset number | nil
+---@field orderBy (string | DBQueryOrderByItem)[] | nil @comment property names or {prop=, desc=} items
+
 ---@class DBQuery
 ---@field ObjectIDs number[]
 ---@field _filterDef FilterDef
+---@field options DBQueryOptions
 local DBQuery = class()
 
 ---@param ClassDef ClassDef
 ---@param expr string
 ---@param params table
-function DBQuery:_init(ClassDef, expr, params)
+---@param options DBQueryOptions | nil
+function DBQuery:_init(ClassDef, expr, params, options)
     self._filterDef = FilterDef(ClassDef, expr, params)
     self.ObjectIDs = {}
+    self.options = options or {}
 end
 
----@return boolean @comment true if any objects were found
-function DBQuery:Run()
-    -- Reset result
-    self.ObjectIDs = {}
+-- AST tags which make expression dependent on object being filtered
+local nonConstantTags = { Id = true, Call = true, Invoke = true, Index = true, Dots = true }
+
+---@param astToken table
+---@return boolean @comment true if expression does not refer to any properties or functions
+local function is_constant_expr(astToken)
+    if type(astToken) ~= 'table' then
+        return true
+    end
+
+    if nonConstantTags[astToken.tag] then
+        return false
+    end
+
+    for _, tok in ipairs(astToken) do
+        if not is_constant_expr(tok) then
+            return false
+        end
+    end
+
+    return true
+end
+
+-- Returns SQL expression to sort [.objects] by given property
+---@param orderItem string | DBQueryOrderByItem
+---@return string
+function DBQuery:getOrderByExpr(orderItem)
+    if type(orderItem) == 'string' then
+        orderItem = { prop = orderItem }
+    end
+
+    local classDef = self._filterDef.ClassDef
+    local propDef = classDef:getProperty(orderItem.prop)
+    local result
+    if classDef.ColMapActive and propDef.ColMap then
+        result = string.format('[.objects].[%s]', string.upper(propDef.ColMap))
+    else
+        result = string.format([[(select [Value] from [.ref-values] v where v.ObjectID = [.objects].ObjectID
+            and v.PropertyID = %d order by v.PropIndex limit 1)]], propDef.ID)
+    end
 
-    local sql = self._filterDef:build_index_query()
+    return result .. (orderItem.desc and ' desc' or '')
+end
+
+-- Evaluates filter expression which does not depend on object being filtered (e.g. '1 == 1' or 'false').
+-- Returns nil if filter depends on object
+---@return boolean | nil
+function DBQuery:evalConstantFilter()
+    if not is_constant_expr(self._filterDef.ast[1][1]) then
+        return nil
+    end
+
+    local filterCallback = assert(load(self._filterDef.Expression))
+    return Sandbox.run(filterCallback, { env = {} }) and true or false
+end
+
+-- Builds SQL for the query. Second returned value is true if limit and offset are included into SQL,
+-- i.e. if filter is constant true. Third returned value is true if filter is constant false, and there is no need
+-- to run SQL at all
+---@return string, boolean, boolean
+function DBQuery:buildSql()
+    local sql = List()
+    sql:append(self._filterDef:build_index_query())
+
+    local orderBy = self.options.orderBy
+    if orderBy and #orderBy > 0 then
+        local items = {}
+        for _, item in ipairs(orderBy) do
+            table.insert(items, self:getOrderByExpr(item))
+        end
+        table.insert(items, '[.objects].ObjectID')
+        sql:append(' order by ' .. table.concat(items, ', '))
+    end
+
+    local constResult = self:evalConstantFilter()
+    local limitInSql = constResult == true
+    if limitInSql and (self.options.limit or self.options.offset) then
+        sql:append(string.format(' limit %d offset %d', self.options.limit or -1, self.options.offset or 0))
+    end
+
+    return sql:join('\n'), limitInSql, constResult == false
+end
+
+--[[ Returns iterator over found objects. Objects are loaded and filtered lazily, as iterator is called.
+Iteration stops after options.limit objects were returned.
+Usage:
+for obj in query:Iterate() do ... end
+]]
+---@return function @comment iterator which returns DBObject and its ID
+function DBQuery:Iterate()
+    local DBContext = self._filterDef.ClassDef.DBContext
+    local sql, limitInSql, noResult = self:buildSql()
+    if noResult then
+        return function()
+            return nil
+        end
+    end
 
     -- TODO set env.quote?
 
@@ -604,20 +902,113 @@ function DBQuery:Run()
         -- TODO error (err)
     end
 
-    -- objRow is [.objects]
-    for objRow in self._filterDef.ClassDef.DBContext:LoadAdhocRows(sql, self._filterDef.params) do
-        local dbobj = self._filterDef.ClassDef.DBContext:LoadObject(objRow.ObjectID, nil, false, objRow)
-        assert(dbobj)
-        local boxed = dbobj:GetSandBoxed(Constants.DBOBJECT_SANDBOX_MODE.FILTER)
+    local limit = self.options.limit
+    local toSkip = (not limitInSql and self.options.offset) or 0
+    local found = 0
+
+    -- Statement is finalized when iteration is completed, or by DBContext at the end of flexi call,
+    -- if caller stopped iteration earlier
+    local stmt = DBContext:getAdhocStmt(sql, self._filterDef.params)
+    DBContext:registerCursor(stmt)
+    local nextRow, state = stmt:nrows()
 
-        local sandbox_options = { env = boxed }
-        local ok = Sandbox.run(filterCallback, sandbox_options)
-        if ok then
-            table.insert(self.ObjectIDs, objRow.ObjectID)
+    local function close()
+        if stmt then
+            DBContext:closeCursor(stmt)
+            stmt = nil
         end
     end
 
+    return function()
+        if not stmt then
+            return nil
+        end
+
+        if limit and found >= limit then
+            close()
+            return nil
+        end
+
+        -- objRow is [.objects]
+        local objRow = nextRow(state)
+        while objRow do
+            DBContext:budgetRowScanned()
+            local dbobj = DBContext:LoadObject(objRow.ObjectID, nil, false, objRow)
+            assert(dbobj)
+
+            local ok = limitInSql
+            if not ok then
+                local boxed = dbobj:GetSandBoxed(Constants.DBOBJECT_SANDBOX_MODE.FILTER)
+                local sandbox_options = { env = boxed }
+                ok = Sandbox.run(filterCallback, sandbox_options)
+            end
+
+            if ok then
+                if toSkip > 0 then
+                    toSkip = toSkip - 1
+                else
+                    found = found + 1
+                    return dbobj, objRow.ObjectID
+                end
+            end
+
+            objRow = nextRow(state)
+        end
+
+        close()
+        return nil
+    end
+end
+
+---@return boolean @comment true if any objects were found
+function DBQuery:Run()
+    -- Reset result
+    self.ObjectIDs = {}
+
+    for _, objectID in self:Iterate() do
+        table.insert(self.ObjectIDs, objectID)
+    end
+
     return #self.ObjectIDs > 0
 end
 
+-- Returns IDs of found objects. If filter does not depend on object, IDs are taken directly from SQL,
+-- without loading objects
+---@return number[]
+function DBQuery:GetObjectIDs()
+    local sql, limitInSql, noResult = self:buildSql()
+    if noResult then
+        self.ObjectIDs = {}
+        return self.ObjectIDs
+    end
+
+    if not limitInSql then
+        self:Run()
+        return self.ObjectIDs
+    end
+
+    local DBContext = self._filterDef.ClassDef.DBContext
+    self.ObjectIDs = {}
+    for objRow in DBContext:LoadAdhocRows(sql, self._filterDef.params) do
+        DBContext:budgetRowScanned()
+        table.insert(self.ObjectIDs, objRow.ObjectID)
+    end
+    return self.ObjectIDs
+end
+
+-- Exports data of all found objects. Referenced objects are loaded in batches, level by level,
+-- according to include spec
+---@param include ExportIncludeSpec | nil
+---@return table[]
+function DBQuery:ExportData(include)
+    local DBContext = self._filterDef.ClassDef.DBContext
+    DBContext:PrefetchObjects(self.ObjectIDs, include)
+
+    local result = {}
+    for _, objectID in ipairs(self.ObjectIDs) do
+        table.insert(result, DBContext:LoadObject(objectID):ExportData(nil, include, true))
+    end
+    return result
+end
+
 return { QueryBuilder = QueryBuilder, FilterDef = FilterDef, DBQuery = DBQuery }
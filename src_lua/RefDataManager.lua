@@ -219,85 +219,108 @@ function RefDataManager:UpsertEnumItems(cls, items)
     end
 end
 
--- Imports reference value (in user defined ID format)
+--[[ Resolves batch of deferred reference values, collected for the same referenced class (and so, the same
+UDID property). Object IDs for all UDIDs are looked up with single query, and then [.ref-values] rows are written
+in bulk. Values with MetaData or appended values (negative index) are saved individually
+]]
 ---@param self RefDataManager
----@param propDef ReferencePropertyDef
----@param classRef ClassNameRef
----@param dbv DBValue
----@param v any
-local function _importReferenceValue(self, propDef, classRef, dbv, v)
-    local className = classRef.text
-    local refClassDef = self.DBContext:getClassDef(className, true)
+---@param className string
+---@param targets DeferredDBValue[]
+local function resolveReferenceValues(self, className, targets)
+    local DBContext = self.DBContext
+    local refClassDef = DBContext:getClassDef(className, true)
+    local udidPropDef = refClassDef:getUdidProp()
+    if udidPropDef == nil then
+        error(string.format('UDID property is not defined for class [%s]', refClassDef.Name.text))
+    end
 
-    self.DBContext.ActionQueue:enqueue(function(v)
-        local obj = refClassDef:getObjectByUdid(v, true)
-        if obj then
-            -- TODO insert/replace .ref-values entry
-            return true
+    local udids, seen = {}, {}
+    for _, target in ipairs(targets) do
+        local v = target.dbv.Value
+        if not seen[v] then
+            seen[v] = true
+            table.insert(udids, v)
         end
-        return false
-    end,
-            v)
+    end
+
+    local objectIDs = refClassDef:lookupObjectIDsByProperty(udidPropDef, udids)
+
+    local rows = {}
+    for _, target in ipairs(targets) do
+        local dbv = target.dbv
+        local objectID = objectIDs[dbv.Value]
+        if objectID == nil then
+            error(string.format('Object with UDID %s not found in class [%s]', tostring(dbv.Value),
+                    refClassDef.Name.text))
+        end
+
+        dbv.Value = objectID
+        dbv.deferredSaveAction = nil
+        if target.PropIndex > 0 and dbv.MetaData == nil then
+            table.insert(rows, { target.ObjectID, target.PropertyID, target.PropIndex, objectID, target.ctlv })
+        else
+            target.save()
+        end
+    end
+
+    if #rows > 0 then
+        DBContext:execStatement([[insert or replace into [.ref-values] (ObjectID, PropertyID, PropIndex, [Value], ctlv)
+            select json_extract([value], '$[0]'), json_extract([value], '$[1]'), json_extract([value], '$[2]'),
+            json_extract([value], '$[3]'), json_extract([value], '$[4]') from json_each(:rows);]],
+                { rows = json.encode(rows) })
+    end
+end
+
+--[[ Imports reference value (in user defined ID format). Resolving of UDID to object ID is deferred till
+the end of request (so that referenced objects can be imported in the same request), and is done for all values
+referencing the same class at once
+]]
+---@param self RefDataManager
+---@param classRef ClassNameRef
+---@param target DeferredDBValue
+local function _importReferenceValue(self, classRef, target)
+    local className = classRef.text
+    self.DBContext.ActionQueue:enqueueBatch('ref:' .. string.lower(className), function(targets)
+        resolveReferenceValues(self, className, targets)
+    end, target)
 end
 
 -- Imports reference value (in user defined ID format)
 ---@param propDef ReferencePropertyDef
 ---@param dbv DBValue
 ---@param v any
----@return boolean, function @comment true, function if import was handled, false, nil, if not handled
+---@return nil | fun(target: DeferredDBValue) @comment deferred save action, if value needs to be resolved
 function RefDataManager:importReferenceValue(propDef, dbv, v)
+    --Pre-set user value
+    PropertyDef.ImportDBValue(propDef, dbv, v)
 
     if v == nil then
-        PropertyDef.ImportDBValue(propDef, dbv, nil)
-        return true, nil
+        return nil
     end
 
-    --Pre-set user value
-    PropertyDef.ImportDBValue(propDef, dbv, v)
-
-    local processed = false
-    -- First, try refDef
+    -- First, try refDef, then enumDef
     local classRef = propDef.D.refDef and propDef.D.refDef.classRef or nil
-
-    local function deferredImport()
-        _importReferenceValue(self, propDef, classRef, dbv, v)
+    if not classRef then
+        classRef = propDef.D.enumDef and propDef.D.enumDef.classRef or nil
     end
 
-    if classRef then
-        _importReferenceValue(self, propDef, classRef, dbv, v)
-        return true, deferredImport
-    else
-        -- Then, try enumDef
-        classRef = propDef.D.enumDef and propDef.D.enumDef.classRef or nil
-        if classRef then
-            _importReferenceValue(self, propDef, classRef, dbv, v)
-            PropertyDef.ImportDBValue(propDef, dbv, v)
-            return true, deferredImport
-        end
+    if not classRef then
+        return nil
     end
 
-    return false, nil
+    return function(target)
+        _importReferenceValue(self, classRef, target)
+    end
 end
 
--- Imports reference value (in user defined ID format)
----@param propDef ReferencePropertyDef
+-- Imports enum value (in user defined ID format)
+---@param propDef EnumPropertyDef
 ---@param dbv DBValue
 ---@param v any
----@return function
+---@return nil | fun(target: DeferredDBValue)
 function RefDataManager:importEnumValue(propDef, dbv, v)
-    local processed, deferredAction = self:importReferenceValue(propDef, dbv, v)
-    if processed then
-        return deferredAction
-    end
-
-    local function deferredImport()
-        -- TODO change to _importEnumValue (not yet implemented)
-        _importReferenceValue(self, propDef, classRef, dbv, v)
-    end
-
     -- TODO apply enum items
-    PropertyDef.ImportDBValue(propDef, dbv, v)
-    return true, deferredImport
+    return self:importReferenceValue(propDef, dbv, v)
 end
 
 return RefDataManager
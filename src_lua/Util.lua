@@ -200,6 +200,81 @@ local function normalizeSqlName(n)
     return result
 end
 
+--[[ Encodes value to JSON with keys of objects sorted, so that equal payloads always produce the same text
+(cjson emits keys in hash order). Used for content hashing. Tables with keys 1..n are encoded as arrays
+]]
+---@param value any
+---@return string
+local function canonicalJSON(value)
+    local json = cjson or require 'cjson'
+    if type(value) ~= 'table' or value == json.null then
+        return json.encode(value)
+    end
+
+    local keys, count = {}, 0
+    for k in pairs(value) do
+        count = count + 1
+        keys[count] = k
+    end
+
+    local len = #value
+    local parts = {}
+    if len > 0 and len == count then
+        for i = 1, len do
+            parts[i] = canonicalJSON(value[i])
+        end
+        return '[' .. table.concat(parts, ',') .. ']'
+    end
+
+    for i = 1, count do
+        keys[i] = tostring(keys[i])
+    end
+    table.sort(keys)
+    for i, k in ipairs(keys) do
+        local v = value[k]
+        if v == nil then
+            v = value[tonumber(k)]
+        end
+        parts[i] = json.encode(k) .. ':' .. canonicalJSON(v)
+    end
+    return '{' .. table.concat(parts, ',') .. '}'
+end
+
+--[[ Returns monotonic wall clock time in seconds (with fractions). os.clock measures CPU time only, so
+it cannot be used for timeouts and waiting for locks, and realtime clock may jump when system time is adjusted.
+With LuaJIT uses clock_gettime(CLOCK_MONOTONIC) on Linux and macOS and QueryPerformanceCounter on Windows, via FFI.
+Without FFI falls back to os.clock
+]]
+local wallClock = os.clock
+if type(jit) == 'table' then
+    local ok, ffi = pcall(require, 'ffi')
+    if ok and ffi.os == 'Windows' then
+        pcall(ffi.cdef, [[
+        int QueryPerformanceCounter(int64_t *lpPerformanceCount);
+        int QueryPerformanceFrequency(int64_t *lpFrequency);
+        ]])
+        local counter = ffi.new('int64_t[1]')
+        ffi.C.QueryPerformanceFrequency(counter)
+        local frequency = tonumber(counter[0])
+        wallClock = function()
+            ffi.C.QueryPerformanceCounter(counter)
+            return tonumber(counter[0]) / frequency
+        end
+    elseif ok then
+        pcall(ffi.cdef, [[
+        typedef struct { long tv_sec; long tv_nsec; } flexi_timespec_t;
+        int clock_gettime(int clk_id, flexi_timespec_t *tp);
+        ]])
+        local ts = ffi.new('flexi_timespec_t')
+        -- Value of CLOCK_MONOTONIC is platform specific. On other systems CLOCK_REALTIME (0) is used
+        local clockID = ({ Linux = 1, OSX = 6 })[ffi.os] or 0
+        wallClock = function()
+            ffi.C.clock_gettime(clockID, ts)
+            return tonumber(ts.tv_sec) + tonumber(ts.tv_nsec) / 1000000000
+        end
+    end
+end
+
 local export = {
     -- Bit operations on 52-bit values
     -- (52 bit integer are natively supported by Lua's number)
@@ -218,6 +293,8 @@ local export = {
     stringifyDateTimeInfo = stringifyDateTimeInfo,
     DictCI = DictCI,
     normalizeSqlName = normalizeSqlName,
+    wallClock = wallClock,
+    canonicalJSON = canonicalJSON,
 }
 
 return export
@@ -23,6 +23,8 @@ return {
     ['flexi_DropProperty'] = 'src_lua/flexi_DropProperty.lua',
     ['flexi_StructuralMerge'] = 'src_lua/flexi_StructuralMerge.lua',
     ['DBContext'] = 'src_lua/DBContext.lua',
+    ['ObjectCache'] = 'src_lua/ObjectCache.lua',
+    ['NameCache'] = 'src_lua/NameCache.lua',
     ['PropertyDef'] = 'src_lua/PropertyDef.lua',
     ['flexi_AlterProperty'] = 'src_lua/flexi_AlterProperty.lua',
     ['flexi_DataBestIndex'] = 'src_lua/flexi_DataBestIndex.lua',
@@ -37,6 +39,7 @@ return {
     ['Triggers'] = 'src_lua/Triggers.lua',
     ['flexi_ConvertCustomEAV'] = 'src_lua/flexi_ConvertCustomEAV.lua',
     ['flexi_DataUpdate'] = 'src_lua/flexi_DataUpdate.lua',
+    ['flexi_Select'] = 'src_lua/flexi_Select.lua',
     ['flexi_PropToObject'] = 'src_lua/flexi_PropToObject.lua',
     ['DBObject'] = 'src_lua/DBObject.lua',
     ['Constants'] = 'src_lua/Constants.lua',
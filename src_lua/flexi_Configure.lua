@@ -4,6 +4,127 @@
 ---
 
 local json = cjson or require('cjson')
+local Constants = require 'Constants'
+
+--[[
+Adds columns which were introduced after database was created. Must be called before schema script,
+as schema script creates views and indexes which depend on these columns
+]]
+---@param self DBContext
+local function upgradeSchema(self)
+    local hasClassProps, hasPropAttrs = false, false
+    for row in self.db:nrows [[pragma table_info([.class_props]);]] do
+        hasClassProps = true
+        if row.name == 'Type' then
+            hasPropAttrs = true
+        end
+    end
+
+    if hasClassProps and not hasPropAttrs then
+        -- Denormalized property attributes. Initial values are copied from class definitions
+        local result = self.db:exec [[
+        alter table [.class_props] add column [Name] TEXT NULL;
+        alter table [.class_props] add column [Type] TEXT NULL;
+        alter table [.class_props] add column MinOccurrences INTEGER NOT NULL DEFAULT 0;
+        alter table [.class_props] add column MaxOccurrences INTEGER NOT NULL DEFAULT 1;
+        alter table [.class_props] add column MaxLength INTEGER NULL;
+        alter table [.class_props] add column IndexType TEXT NULL;
+
+        update [.class_props] set
+            [Name] = (select [Value] from [.sym_names] where ID = [.class_props].NameID limit 1),
+            [Type] = (select json_extract(c.Data, printf('$.properties.%d.rules.type', [.class_props].ID))
+                from [.classes] c where c.ClassID = [.class_props].ClassID),
+            MinOccurrences = coalesce((select json_extract(c.Data, printf('$.properties.%d.rules.minOccurrences', [.class_props].ID))
+                from [.classes] c where c.ClassID = [.class_props].ClassID), 0),
+            MaxOccurrences = coalesce((select json_extract(c.Data, printf('$.properties.%d.rules.maxOccurrences', [.class_props].ID))
+                from [.classes] c where c.ClassID = [.class_props].ClassID), 1),
+            MaxLength = (select json_extract(c.Data, printf('$.properties.%d.rules.maxLength', [.class_props].ID))
+                from [.classes] c where c.ClassID = [.class_props].ClassID),
+            IndexType = (select json_extract(c.Data, printf('$.properties.%d.index', [.class_props].ID))
+                from [.classes] c where c.ClassID = [.class_props].ClassID);
+
+        drop view if exists [flexi_prop];
+        ]]
+        if result ~= 0 then
+            error(string.format("%d: %s", self.db:error_code(), self.db:error_message()))
+        end
+    end
+
+    local hasClasses, hasClassVersion = false, false
+    for row in self.db:nrows [[pragma table_info([.classes]);]] do
+        hasClasses = true
+        if row.name == 'Version' then
+            hasClassVersion = true
+        end
+    end
+
+    if hasClasses and not hasClassVersion then
+        -- Class version is maintained by triggers created by schema script. trigClassesAfterUpdate gets recreated
+        -- for specific columns, so that it does not run on version changes
+        local result = self.db:exec [[
+        alter table [.classes] add column [Version] INTEGER NOT NULL DEFAULT 0;
+        drop trigger if exists [trigClassesAfterUpdate];
+        ]]
+        if result ~= 0 then
+            error(string.format("%d: %s", self.db:error_code(), self.db:error_message()))
+        end
+    end
+end
+
+--[[
+Moves cell MetaData from [.ref-values] (databases created before [.cell_metadata] was introduced)
+to [.cell_metadata]. Must be called after schema script. Column itself is kept, as SQLite cannot drop columns,
+but gets cleared, so that it does not take space in value rows
+]]
+---@param self DBContext
+local function moveCellMetaData(self)
+    local hasCellMetaData = false
+    for row in self.db:nrows [[pragma table_info([.ref-values]);]] do
+        if row.name == 'MetaData' then
+            hasCellMetaData = true
+        end
+    end
+
+    if hasCellMetaData then
+        local result = self.db:exec [[
+        insert or replace into [.cell_metadata] (ObjectID, PropertyID, PropIndex, MetaData)
+            select ObjectID, PropertyID, PropIndex, MetaData from [.ref-values] where MetaData is not null;
+        update [.ref-values] set MetaData = null where MetaData is not null;
+        ]]
+        if result ~= 0 then
+            error(string.format("%d: %s", self.db:error_code(), self.db:error_message()))
+        end
+    end
+end
+
+--[[
+Fills [.object_access] for objects which have access rules in MetaData, but were saved before row level
+access rules were introduced. Such objects have CTLO_FLAGS.HAS_ACCESS_RULES set, and without rows in
+[.object_access] they would not be available to anybody. If MetaData has no applicable rules, flag gets cleared.
+Must be called after schema script
+]]
+---@param self DBContext
+local function fillObjectAccess(self)
+    local sql = string.format([[select ObjectID, MetaData from [.objects] o where (o.ctlo & %d) <> 0
+        and not exists (select 1 from [.object_access] oa where oa.ObjectID = o.ObjectID);]],
+            Constants.CTLO_FLAGS.HAS_ACCESS_RULES)
+    local objects = {}
+    for row in self.db:nrows(sql) do
+        table.insert(objects, row)
+    end
+
+    for _, row in ipairs(objects) do
+        local metaData = row.MetaData and json.decode(row.MetaData)
+        local accessRules = type(metaData) == 'table' and metaData.accessRules or nil
+        self.AccessControl:saveObjectAccessRules(row.ObjectID, accessRules)
+
+        if not self:loadOneRow([[select 1 as found from [.object_access] where ObjectID = :ObjectID limit 1;]],
+                { ObjectID = row.ObjectID }) then
+            self:execStatement(string.format([[update [.objects] set ctlo = ctlo & ~%d where ObjectID = :ObjectID;]],
+                    Constants.CTLO_FLAGS.HAS_ACCESS_RULES), { ObjectID = row.ObjectID })
+        end
+    end
+end
 
 ---@param self DBContext
 ---@param sOptions string | nil @comment
@@ -12,12 +133,17 @@ local function Configure(self, sOptions, sSchema)
     -- Get SQL script to execute
     local sql_dbschema = require 'sql.dbschema'
 
+    upgradeSchema(self)
+
     local result = self.db:exec(sql_dbschema)
     if result ~= 0 then
         local errMsg = string.format("%d: %s", self.db:error_code(), self.db:error_message())
         error(errMsg)
     end
 
+    moveCellMetaData(self)
+    fillObjectAccess(self)
+
     if sOptions then
         -- default culture
         -- default JSON output mode for flexi_data
@@ -25,8 +151,22 @@ local function Configure(self, sOptions, sSchema)
         -- supportedCultures
         -- defaultUser
 
+        -- busyTimeout, busyRetries
+        -- groupCommit, groupCommitMaxBatch, groupCommitMaxDelay
+        -- budgetTime, budgetRows, budgetObjects, budgetCheckSteps
+        -- objectCacheSize, crossRequestCache, preloadNames
+        -- compressThreshold, dedupThreshold
+
         local options = json.decode(sOptions)
-        -- TODO process options
+
+        -- Apply options which are known to DBContext config. Other options are ignored for now
+        -- TODO process other options
+        for k, v in pairs(options) do
+            if self.config[k] ~= nil and type(self.config[k]) == type(v) then
+                self.config[k] = v
+            end
+        end
+        self.ObjectCache.capacity = self.config.objectCacheSize
     end
 
     if sSchema then
@@ -5,11 +5,150 @@
 
 --[[
 Implementation of flexi_data virtual table BestIndex API
+
+Columns of virtual table are class properties, as returned by ClassDef:getDataColumns. Rowid is ObjectID.
+Hidden column 'ids' follows property columns. EQ constraint on it takes JSON array of object IDs.
+indexInfo has the same fields as sqlite3_index_info (see flexi_data_vtable.lua), with Lua arrays:
+aConstraint - list of { iColumn, op, usable }
+aOrderBy - list of { iColumn, desc }
+colUsed - mask of columns used by statement (nil - all columns)
+On return, aConstraintUsage (list of { argvIndex, omit }), idxNum, idxStr, orderByConsumed and estimatedCost are set.
+
+idxStr is scan plan in JSON, which is passed to flexi_DataFilter:
+u - indexes of columns to be returned. Values of other columns are not read
+c - list of { column index, op } of pushed down constraints, in order of their argvIndex.
+Column index -1 is rowid, #columns is ids. Constraint values are passed to flexi_DataFilter in args
+o - { column index, desc } of ORDER BY consumed by scan from property value index
+
+ORDER BY single column is consumed if scan can return rows in its order without sorting: rowid in ascending order
+(default scan order), or scalar property which is mapped to [.objects] column or has value index. Values of
+compressed or deduplicated properties are stored in index not in order of their actual values.
 ]]
 
+local json = cjson or require 'cjson'
+local bit52 = require('Util').bit52
+local Constants = require 'Constants'
+
+local OP = Constants.INDEX_CONSTRAINT
+
+-- Estimated cost of full scan of class objects
+local FULL_SCAN_COST = 1000000
+
+-- Operators which can be pushed down to property columns
+local PROP_OPS = {
+    [OP.EQ] = true, [OP.GT] = true, [OP.LE] = true, [OP.LT] = true, [OP.GE] = true, [OP.NE] = true,
+    [OP.LIKE] = true, [OP.GLOB] = true, [OP.ISNULL] = true, [OP.ISNOTNULL] = true,
+}
+
+-- Returns true if column may be needed by statement. Mask bits above 52 cannot be tested in Lua number,
+-- so such columns are treated as used
+---@param colUsed number | nil
+---@param col number @comment column index, starting from 0
+---@return boolean
+local function isColumnUsed(colUsed, col)
+    return colUsed == nil or col >= 52 or bit52.band(colUsed, bit52.lshift(1, col)) ~= 0
+end
+
+-- Returns estimated cost of scan by given constraint
+---@param classDef ClassDef
+---@param col number
+---@param propDef PropertyDef | nil
+---@param op number
+---@return number
+local function constraintCost(classDef, col, propDef, op)
+    if not propDef then
+        return col == -1 and 1 or 10 -- rowid or ids
+    end
+
+    if op == OP.ISNULL then
+        return FULL_SCAN_COST / 2
+    end
+
+    local indexed = propDef:getIndexMask() ~= 0
+    if op == OP.EQ and (indexed or (classDef.ColMapActive and propDef.ColMap)) then
+        return 10
+    end
+    if not indexed then
+        return FULL_SCAN_COST / 10
+    end
+    if op == OP.GT or op == OP.GE or op == OP.LT or op == OP.LE or op == OP.LIKE or op == OP.GLOB then
+        return 1000
+    end
+    return 10000
+end
+
+-- Returns true if rows can be returned in order of given ORDER BY term
+---@param classDef ClassDef
+---@param columns PropertyDef[]
+---@param orderBy table @comment { iColumn, desc }
+---@return boolean
+local function canConsumeOrderBy(classDef, columns, orderBy)
+    if orderBy.iColumn == -1 then
+        return not orderBy.desc
+    end
+
+    local propDef = orderBy.iColumn >= 0 and columns[orderBy.iColumn + 1]
+    if not propDef or propDef.D.compress or propDef.D.dedup
+            or ((propDef.D.rules and propDef.D.rules.maxOccurrences) or 1) > 1 then
+        return false
+    end
+
+    if classDef.ColMapActive and propDef.ColMap then
+        return true
+    end
+    return propDef:getCtlvIndexMask() ~= 0
+end
+
 ---@param self DBContext
-local flexi_DataBestIndex = function(self)
+---@param className string
+---@param indexInfo table
+---@return table @comment indexInfo with output fields set
+local flexi_DataBestIndex = function(self, className, indexInfo)
+    local classDef = self:getClassDef(className, true)
+    local columns = classDef:getDataColumns()
+
+    local plan = { u = {} }
+    for i = 1, #columns do
+        if isColumnUsed(indexInfo.colUsed, i - 1) then
+            table.insert(plan.u, i - 1)
+        end
+    end
+
+    -- Usable constraints are passed to filter. Constraints on property columns are checked again by SQLite,
+    -- as values are compared with property type affinity
+    plan.c = {}
+    local cost = FULL_SCAN_COST
+    indexInfo.aConstraintUsage = {}
+    for i, constr in ipairs(indexInfo.aConstraint or {}) do
+        local usage = { argvIndex = 0, omit = false }
+        indexInfo.aConstraintUsage[i] = usage
+
+        local col = constr.iColumn
+        local propDef = col >= 0 and columns[col + 1]
+        local usable = constr.usable and ((propDef and PROP_OPS[constr.op])
+                or ((col == -1 or col == #columns) and constr.op == OP.EQ))
+        if usable then
+            table.insert(plan.c, { col, constr.op })
+            usage.argvIndex = #plan.c
+            usage.omit = not propDef
+            cost = math.min(cost, constraintCost(classDef, col, propDef or nil, constr.op))
+        end
+    end
+
+    indexInfo.orderByConsumed = false
+    local orderBy = indexInfo.aOrderBy or {}
+    if #orderBy == 1 and canConsumeOrderBy(classDef, columns, orderBy[1]) then
+        indexInfo.orderByConsumed = true
+        if orderBy[1].iColumn >= 0 then
+            plan.o = { orderBy[1].iColumn, orderBy[1].desc and true or false }
+        end
+    end
+
+    indexInfo.idxNum = #plan.c
+    indexInfo.idxStr = json.encode(plan)
+    indexInfo.estimatedCost = cost
 
+    return indexInfo
 end
 
-return flexi_DataBestIndex
\ No newline at end of file
+return flexi_DataBestIndex
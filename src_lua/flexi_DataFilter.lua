@@ -4,13 +4,390 @@
 ---
 
 --[[
-Implementation of flexi_data virtual table Filter API. Uses QueryBuilder to generate
-SQL from query JSON
+Implementation of flexi_data virtual table Filter API. Scan plan is built by flexi_DataBestIndex and passed in idxStr.
+
+Returns cursor, i.e. iterator which returns object ID and row of every found object. Row is a table by
+column index (starting from 0). The same table is reused for all rows, and only columns listed in plan (u) are set.
+
+Rows are assembled by merge join on ObjectID: found objects are read from [.objects] in ObjectID order,
+and values of used properties are read by single scan of [.ref-values] in its primary key order
+(ObjectID, PropertyID, PropIndex). So every table is read once, without seek and statement reset per row.
+Values of mapped columns are taken from [.objects] row.
+Values of properties with maxOccurrences > 1 are returned as JSON array.
+
+Constraints pushed down by plan (c) are applied to [.objects] scan. Conditions on properties stored in
+[.ref-values] are checked by subqueries on PropertyID and Value, which can use value indexes. For LIKE and GLOB
+with constant prefix, range condition on prefix is added.
+
+If plan has ORDER BY property (o), objects are read in order of property value, from its index: objects without
+value first (or last, for descending order), as SQLite sorts NULLs first. Merge join is not possible then,
+so values of every object are read by reused statement.
 ]]
 
+local json = cjson or require 'cjson'
+local List = require 'pl.List'
+local tablex = require 'pl.tablex'
+local Constants = require 'Constants'
+local bit52 = require('Util').bit52
+
+local OP = Constants.INDEX_CONSTRAINT
+
+-- SQL operators by constraint operator
+local SQL_OPS = {
+    [OP.EQ] = '=', [OP.GT] = '>', [OP.LE] = '<=', [OP.LT] = '<', [OP.GE] = '>=', [OP.NE] = '<>',
+    [OP.LIKE] = 'like', [OP.GLOB] = 'glob',
+}
+
+---@param propDef PropertyDef
+---@return boolean
+local function isArrayProp(propDef)
+    return ((propDef.D.rules and propDef.D.rules.maxOccurrences) or 1) > 1
+end
+
+-- Returns constant prefix of LIKE or GLOB pattern, or nil if pattern starts with wildcard.
+-- LIKE is case insensitive, so prefix with letters cannot be used for range
+---@param op number
+---@param pattern string
+---@return string | nil
+local function patternPrefix(op, pattern)
+    if type(pattern) ~= 'string' then
+        return nil
+    end
+    local prefix
+    if op == OP.GLOB then
+        prefix = string.match(pattern, '^[^*?[]*')
+    else
+        prefix = string.match(pattern, '^[^%%_]*')
+        if string.find(prefix, '%a') then
+            return nil
+        end
+    end
+    if prefix == '' then
+        return nil
+    end
+    return prefix
+end
+
+-- Returns upper bound (exclusive) of strings which start with prefix
+---@param prefix string
+---@return string | nil
+local function prefixUpperBound(prefix)
+    local last = prefix:byte(#prefix)
+    if last == 255 then
+        return nil
+    end
+    return prefix:sub(1, #prefix - 1) .. string.char(last + 1)
+end
+
+-- Returns SQL condition which repeats WHERE clause of partial index on property values (idxObjectsByX,
+-- idxValuesByPropValue or idxValuesByPropUniqueValue), as SQLite uses partial index only when query has the same
+-- term. Returns nil if property is not indexed
+---@param classDef ClassDef
+---@param propDef PropertyDef
+---@return string | nil
+local function indexCondition(classDef, propDef)
+    if classDef.ColMapActive and propDef.ColMap then
+        if string.lower(propDef.D.index or '') ~= 'index' then
+            return nil
+        end
+        return string.format('(ctlo AND (1 << %d)) <> 0 AND [%s] IS NOT NULL',
+                propDef:ColMapIndex() + Constants.CTLO_FLAGS.INDEX_SHIFT, string.upper(propDef.ColMap))
+    end
+
+    local mask = propDef:getCtlvIndexMask()
+    if bit52.band(mask, Constants.CTLV_FLAGS.UNIQUE) ~= 0 then
+        return '([ctlv] & 8)'
+    elseif mask ~= 0 then
+        return '([ctlv] & 0xF0)'
+    end
+    return nil
+end
+
+-- Builds SQL condition on [.objects] for constraint of plan.
+-- Values of constraints are bound to parameters :a1, :a2...
+---@param classDef ClassDef
+---@param columns PropertyDef[]
+---@param col number
+---@param op number
+---@param argIndex number
+---@param params table
+---@return string
+local function constraintCondition(classDef, columns, col, op, argIndex, params)
+    local param = ':a' .. argIndex
+    if col == -1 then
+        return 'ObjectID = ' .. param
+    end
+
+    local propDef = columns[col + 1]
+    if not propDef then
+        return string.format('ObjectID in (select value from json_each(%s))', param)
+    end
+
+    local prefix = (op == OP.LIKE or op == OP.GLOB) and patternPrefix(op, params['a' .. argIndex])
+    local upper = prefix and prefixUpperBound(prefix)
+
+    if classDef.ColMapActive and propDef.ColMap then
+        local colName = string.format('[%s]', string.upper(propDef.ColMap))
+        if op == OP.ISNULL then
+            return colName .. ' is null'
+        elseif op == OP.ISNOTNULL then
+            return colName .. ' is not null'
+        end
+        local result = string.format('%s %s %s', colName, SQL_OPS[op], param)
+        if upper then
+            params['a' .. argIndex .. 'lo'] = prefix
+            params['a' .. argIndex .. 'hi'] = upper
+            result = string.format('%s and %s >= %slo and %s < %shi', result, colName, param, colName, param)
+        end
+        local idxCond = indexCondition(classDef, propDef)
+        if idxCond then
+            result = string.format('%s and %s', result, idxCond)
+        end
+        return result
+    end
+
+    if op == OP.ISNULL or op == OP.ISNOTNULL then
+        return string.format('ObjectID %s (select ObjectID from [.ref-values] where PropertyID = %d)',
+                op == OP.ISNULL and 'not in' or 'in', propDef.ID)
+    end
+
+    local sql = string.format('ObjectID in (select ObjectID from [.ref-values] where PropertyID = %d and %s',
+            propDef.ID, propDef:GetRefValueCondition(SQL_OPS[op], param))
+    if upper then
+        params['a' .. argIndex .. 'lo'] = prefix
+        params['a' .. argIndex .. 'hi'] = upper
+        local valueExpr = propDef:GetRefValueExpression()
+        sql = string.format('%s and %s >= %slo and %s < %shi', sql, valueExpr, param, valueExpr, param)
+    end
+    local idxCond = indexCondition(classDef, propDef)
+    if idxCond then
+        local propIdxMask = propDef:getIndexMask()
+        sql = string.format('%s and (ctlv & %d) = %d and %s', sql, propIdxMask, propIdxMask, idxCond)
+    end
+    return sql .. ')'
+end
+
+-- Returns SQL statements which return found objects ordered by property value, in order of their execution
+---@param classDef ClassDef
+---@param propDef PropertyDef
+---@param desc boolean
+---@param objCols string @comment list of [.objects] columns, with alias o
+---@param conditions List @comment conditions on [.objects], including class
+---@return string[]
+local function orderedObjectQueries(classDef, propDef, desc, objCols, conditions)
+    local objWhere = conditions:join(' and ')
+    local direction = desc and 'desc' or 'asc'
+    local idxCond = indexCondition(classDef, propDef)
+    local nullSql, valueSql
+
+    if classDef.ColMapActive and propDef.ColMap then
+        local colName = string.format('[%s]', string.upper(propDef.ColMap))
+        nullSql = string.format('select %s from [.objects] o where %s and %s is null order by o.ObjectID %s;',
+                objCols, objWhere, colName, direction)
+        valueSql = string.format('select %s from [.objects] o where %s and %s order by %s %s;',
+                objCols, objWhere, idxCond or (colName .. ' is not null'), colName, direction)
+    else
+        nullSql = string.format([[select %s from [.objects] o where %s and not exists
+            (select 1 from [.ref-values] where ObjectID = o.ObjectID and PropertyID = %d) order by o.ObjectID %s;]],
+                objCols, objWhere, propDef.ID, direction)
+
+        -- Values are joined with found objects. Other constraints than class are checked by subquery,
+        -- as their conditions refer to [.objects] columns without alias
+        local objFilter = ''
+        if #conditions > 1 then
+            objFilter = string.format(' and o.ObjectID in (select ObjectID from [.objects] where %s)', objWhere)
+        end
+        local propIdxMask = propDef:getIndexMask()
+        valueSql = string.format([[select %s from [.ref-values] v join [.objects] o on o.ObjectID = v.ObjectID
+            where v.PropertyID = %d and (v.ctlv & %d) = %d and %s and o.ClassID = :ClassID%s
+            order by v.[Value] %s;]],
+                objCols, propDef.ID, propIdxMask, propIdxMask, idxCond, objFilter, direction)
+    end
+
+    if desc then
+        return { valueSql, nullSql }
+    end
+    return { nullSql, valueSql }
+end
+
 ---@param self DBContext
-local function flexi_DataFilter(self)
+---@param className string
+---@param idxNum number
+---@param idxStr string @comment scan plan in JSON (see flexi_DataBestIndex)
+---@param args any[] @comment values of constraints, by argvIndex
+---@return function @comment iterator which returns object ID and row
+local function flexi_DataFilter(self, className, idxNum, idxStr, args)
+    local classDef = self:getClassDef(className, true)
+    local columns = classDef:getDataColumns()
+    local plan = idxStr and json.decode(idxStr) or {}
+    if not plan.u then
+        plan.u = {}
+        for i = 1, #columns do
+            plan.u[i] = i - 1
+        end
+    end
+
+    -- Mapped columns are read from [.objects], others - from [.ref-values]
+    local objCols = List { 'o.ObjectID as ObjectID' }
+    local mappedCols = {}
+    local propCols = {}
+    local valueExprs = List()
+    for _, col in ipairs(plan.u) do
+        local propDef = columns[col + 1]
+        if propDef then
+            if classDef.ColMapActive and propDef.ColMap then
+                objCols:append(string.format('o.[%s] as [c%d]', string.upper(propDef.ColMap), col))
+                mappedCols[col] = 'c' .. col
+            else
+                propCols[propDef.ID] = { col = col, array = isArrayProp(propDef) }
+                valueExprs:append(string.format('when %d then %s', propDef.ID, propDef:GetRefValueExpression('v')))
+            end
+        end
+    end
+
+    local params = { ClassID = classDef.ClassID }
+    local conditions = List { 'ClassID = :ClassID' }
+    for i, constr in ipairs(plan.c or {}) do
+        params['a' .. i] = args[i]
+        conditions:append(constraintCondition(classDef, columns, constr[1], constr[2], i, params))
+    end
+    local objWhere = conditions:join(' and ')
+
+    local orderPropDef = plan.o and columns[plan.o[1] + 1]
+    local objSqls
+    if orderPropDef then
+        objSqls = orderedObjectQueries(classDef, orderPropDef, plan.o[2], objCols:join(', '), conditions)
+    else
+        objSqls = { string.format('select %s from [.objects] o where %s order by o.ObjectID;',
+                objCols:join(', '), objWhere) }
+    end
+
+    -- Without compression functions compressed values are selected packed (see PropertyDef:GetRefValueExpression)
+    local unpackedBySql = self:isCompressionSupported()
+    local valStmt
+    local nextVal, valState
+    local valRow
+    if #valueExprs > 0 then
+        local valueWhere = orderPropDef and 'v.ObjectID = :ObjectID'
+                or string.format('v.ObjectID in (select ObjectID from [.objects] where %s)', objWhere)
+        valStmt = self:getAdhocStmt(string.format([[select v.ObjectID, v.PropertyID, v.ctlv,
+            case v.PropertyID %s end as [Value]
+            from [.ref-values] v where %s
+            and v.PropertyID in (%s) order by v.ObjectID, v.PropertyID, v.PropIndex;]],
+                valueExprs:join(' '), valueWhere, table.concat(tablex.keys(propCols), ',')),
+                not orderPropDef and params or nil)
+        self:registerCursor(valStmt)
+        if not orderPropDef then
+            nextVal, valState = valStmt:nrows()
+            valRow = nextVal(valState)
+        end
+    end
+
+    local objStmt
+    local nextObj, objState
+    local objSqlIndex = 0
+
+    -- Opens next statement of found objects. Returns false if there are no more statements
+    local function openObjStmt()
+        if objStmt then
+            self:closeCursor(objStmt)
+            objStmt = nil
+        end
+        objSqlIndex = objSqlIndex + 1
+        if not objSqls[objSqlIndex] then
+            return false
+        end
+        objStmt = self:getAdhocStmt(objSqls[objSqlIndex], params)
+        self:registerCursor(objStmt)
+        nextObj, objState = objStmt:nrows()
+        return true
+    end
+
+    openObjStmt()
+
+    -- Row and value lists of array properties are reused for all rows
+    local row = {}
+    local arrays = {}
+    for _, propCol in pairs(propCols) do
+        if propCol.array then
+            arrays[propCol.col] = {}
+        end
+    end
+
+    local function close()
+        if objStmt then
+            self:closeCursor(objStmt)
+            objStmt = nil
+        end
+        if valStmt then
+            self:closeCursor(valStmt)
+            valStmt = nil
+        end
+    end
+
+    return function()
+        if not objStmt then
+            return nil
+        end
+
+        local objRow = nextObj(objState)
+        while not objRow do
+            if not openObjStmt() then
+                close()
+                return nil
+            end
+            objRow = nextObj(objState)
+        end
+
+        self:budgetRowScanned()
+        local objectID = objRow.ObjectID
+
+        for _, col in ipairs(plan.u) do
+            row[col] = nil
+        end
+        for _, values in pairs(arrays) do
+            for i = #values, 1, -1 do
+                values[i] = nil
+            end
+        end
+        for col, alias in pairs(mappedCols) do
+            row[col] = objRow[alias]
+        end
+
+        if orderPropDef and valStmt then
+            valStmt:reset()
+            self:checkSqlite(valStmt:bind_names({ ObjectID = objectID }))
+            nextVal, valState = valStmt:nrows()
+            valRow = nextVal(valState)
+        end
+
+        -- Values of objects which were not found are skipped
+        while valRow and valRow.ObjectID < objectID do
+            valRow = nextVal(valState)
+        end
+
+        while valRow and valRow.ObjectID == objectID do
+            local propCol = propCols[valRow.PropertyID]
+            local value = valRow.Value
+            if not unpackedBySql and bit52.band(valRow.ctlv, Constants.CTLV_FLAGS.COMPRESSED) ~= 0 then
+                value = self.unpackValue(value)
+            end
+            if propCol.array then
+                table.insert(arrays[propCol.col], value)
+            elseif row[propCol.col] == nil then
+                row[propCol.col] = value
+            end
+            valRow = nextVal(valState)
+        end
+
+        for col, values in pairs(arrays) do
+            if #values > 0 then
+                row[col] = json.encode(values)
+            end
+        end
 
+        return objectID, row
+    end
 end
 
-return flexi_DataFilter
\ No newline at end of file
+return flexi_DataFilter
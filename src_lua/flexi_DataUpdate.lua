@@ -19,6 +19,7 @@ local QueryBuilder = require('QueryBuilder').QueryBuilder
 local Constants = require 'Constants'
 local DictCI = require('Util').DictCI
 local SqliteTable = require 'SqliteTable'
+local Util = require 'Util'
 local pretty = require('pl.pretty')
 
 --[[
@@ -109,6 +110,217 @@ function SaveObjectHelper:saveObject(className, oldRowID, newRowID, data)
     end
 end
 
+-- Converts value returned by flexi_json_cells to the same value as would be decoded by cjson
+---@param value any
+---@param vtype string
+local function cellValue(value, vtype)
+    if vtype == 'true' then
+        return true
+    elseif vtype == 'false' then
+        return false
+    elseif vtype == 'null' then
+        return json.null
+    elseif vtype == 'object' or vtype == 'array' then
+        return json.decode(value)
+    end
+    return value
+end
+
+--[[
+Inserts objects from classless payload ({"Class1": [{...}, {...}], "Class2": [...]}).
+Payload is decoded by native flexi_json_cells function into flat list of property values, ordered by class and object,
+so full Lua table tree for the payload is not built. Only nested objects and arrays (references, mixed arrays)
+are decoded by cjson, as single values
+]]
+---@param dataJSON string
+function SaveObjectHelper:importCells(dataJSON)
+    local DBContext = self.DBContext
+    local stmt = DBContext:getStatement [[select Class, ObjectIndex, Property, Value, VType, InArray
+        from flexi_json_cells(:json);]]
+    DBContext:checkSqlite(stmt:bind_names { json = dataJSON })
+
+    -- Object being imported: { className, obj: DBObject | nil, data: table | nil, lists: table | nil }
+    local cur
+
+    local function setValue(propName, value)
+        if cur.obj then
+            cur.obj.curVer:setPropValue(propName, 1, value)
+        else
+            cur.data[propName] = value
+        end
+    end
+
+    local function flush()
+        if cur then
+            if cur.lists then
+                for propName, list in pairs(cur.lists) do
+                    setValue(propName, list)
+                end
+            end
+
+            if cur.obj then
+                cur.obj:saveToDB()
+            else
+                -- Not a Flexilite class
+                self:saveObject(cur.className, nil, nil, cur.data)
+            end
+            cur = nil
+        end
+    end
+
+    local function importRows()
+        local curClass, curIndex
+        for className, objIndex, propName, value, vtype, inArray in stmt:urows() do
+            if objIndex == nil then
+                error(string.format('Invalid data for class %s: array of objects expected', className))
+            end
+
+            if className ~= curClass or objIndex ~= curIndex then
+                flush()
+                curClass, curIndex = className, objIndex
+            end
+
+            if propName == nil then
+                -- Entire item which is not a regular object
+                self:saveObject(className, nil, nil, cellValue(value, vtype))
+            else
+                if not cur then
+                    cur = { className = className }
+                    local classDef = DBContext:getClassDef(className, false)
+                    if classDef then
+                        cur.obj = DBContext:NewObject(classDef, nil)
+                    else
+                        cur.data = {}
+                    end
+                end
+
+                if inArray == 1 then
+                    -- Items of array are passed to property as one value, as if payload was decoded by cjson
+                    cur.lists = cur.lists or {}
+                    local list = cur.lists[propName]
+                    if not list then
+                        list = {}
+                        cur.lists[propName] = list
+                    end
+                    table.insert(list, cellValue(value, vtype))
+                else
+                    setValue(propName, cellValue(value, vtype))
+                end
+            end
+        end
+
+        flush()
+    end
+
+    local ok, errMsg = pcall(importRows)
+
+    -- Statement is cached, so payload copy held by binding is released, and statement is not left in the middle of
+    -- iteration if import failed
+    stmt:reset()
+    stmt:bind_names { json = nil }
+
+    if not ok then
+        error(errMsg, 0)
+    end
+end
+
+--[[
+Upserts objects from classless payload ({"Class1": [{...}, {...}], "Class2": [...]}) by user defined ID
+(specialProperties.uid), which must be defined for all classes in payload. Incoming objects are matched against
+UDID index with single query per class, and split into new (created), changed (updated) and unchanged (skipped)
+objects. Unchanged objects are detected by comparing SHA3 hash of canonical JSON of object payload with the hash
+saved by previous upsert (in [.content_hashes]), in single query per class too, so that they are neither loaded nor
+written. On update, properties missing in payload are kept intact
+]]
+---@param data table
+---@param hashSupported boolean @comment true if sha3 function and [.content_hashes] are available
+---@return table @comment number of inserted, updated and unchanged objects
+function SaveObjectHelper:upsertObjects(data, hashSupported)
+    local DBContext = self.DBContext
+    local result = { inserted = 0, updated = 0, unchanged = 0 }
+
+    -- Pairs of object ID and canonical payload of saved objects
+    local savedPayloads = {}
+
+    for className, items in pairs(data) do
+        if type(items) ~= 'table' or (#items == 0 and next(items) ~= nil) then
+            error(string.format('Invalid data for class %s: array of objects expected', className))
+        end
+
+        local classDef = DBContext:getClassDef(className, true)
+        local udidPropDef = classDef:getUdidProp()
+        if udidPropDef == nil then
+            error(string.format('UDID property is not defined for class [%s]', classDef.Name.text))
+        end
+        local udidName = udidPropDef.Name.text
+
+        local udids = {}
+        for i, item in ipairs(items) do
+            local udid = item[udidName]
+            if udid == nil or udid == json.null then
+                error(string.format('Object #%d of class [%s] does not have value of %s', i, classDef.Name.text,
+                        udidName))
+            end
+            udids[i] = udid
+        end
+
+        local objectIDs = classDef:lookupObjectIDsByProperty(udidPropDef, udids)
+
+        local payloads, matched = {}, {}
+        for i, item in ipairs(items) do
+            payloads[i] = Util.canonicalJSON(item)
+            local objectID = objectIDs[udids[i]]
+            if objectID and hashSupported then
+                table.insert(matched, { objectID, payloads[i] })
+            end
+        end
+
+        local unchanged = {}
+        if #matched > 0 then
+            for row in DBContext:loadRows([[select h.ObjectID from json_each(:items) j
+                join [.content_hashes] h on h.ObjectID = json_extract(j.[value], '$[0]')
+                where h.Hash = sha3(json_extract(j.[value], '$[1]'));]], { items = json.encode(matched) }) do
+                unchanged[row.ObjectID] = true
+            end
+        end
+
+        for i, item in ipairs(items) do
+            local objectID = objectIDs[udids[i]]
+            ---@type DBObject
+            local obj
+            if objectID == nil then
+                obj = DBContext:NewObject(classDef, item)
+                result.inserted = result.inserted + 1
+            elseif unchanged[objectID] then
+                result.unchanged = result.unchanged + 1
+            else
+                obj = DBContext:EditObject(objectID)
+                obj:ImportData(item)
+                result.updated = result.updated + 1
+            end
+
+            if obj then
+                obj:saveToDB()
+                if hashSupported then
+                    table.insert(savedPayloads, { obj.curVer.ID, payloads[i] })
+                end
+            end
+        end
+    end
+
+    if #savedPayloads > 0 then
+        -- Hashes are saved after deferred references are resolved, as any write to [.ref-values]
+        -- removes hash of its object
+        DBContext.ActionQueue:enqueue(function()
+            DBContext:execStatement([[insert or replace into [.content_hashes] (ObjectID, Hash)
+                select json_extract([value], '$[0]'), sha3(json_extract([value], '$[1]')) from json_each(:items);]],
+                    { items = json.encode(savedPayloads) })
+        end)
+    end
+
+    return result
+end
+
 ---@param self DBContext
 ---@param className string
 --- (optional) if not specified, must be defined in JSON payload
@@ -180,6 +392,47 @@ local function _dataUpdate(self, className, oldRowID, newRowID, data, queryJSON)
     self.ActionQueue:run()
 end
 
+---@param self DBContext
+---@param dataJSON string
+local function _importCells(self, dataJSON)
+    local saveHelper = SaveObjectHelper(self)
+    saveHelper:importCells(dataJSON)
+
+    -- resolve pending references
+    self.ActionQueue:run()
+end
+
+---@param self DBContext
+---@param data table
+---@param hashSupported boolean
+---@return table
+local function _upsertData(self, data, hashSupported)
+    local saveHelper = SaveObjectHelper(self)
+    local result = saveHelper:upsertObjects(data, hashSupported)
+
+    -- resolve pending references and save content hashes
+    self.ActionQueue:run()
+    return result
+end
+
+-- sha3 is registered by Flexilite extension. Without it, all matched objects are treated as changed on upsert
+local contentHashSupported = setmetatable({}, { __mode = 'k' })
+
+---@param self DBContext
+---@return boolean
+local function isContentHashSupported(self)
+    local result = contentHashSupported[self]
+    if result == nil then
+        local stmt = self.db:prepare [[select sha3(''), (select 1 from [.content_hashes] limit 1);]]
+        result = stmt ~= nil
+        if stmt then
+            stmt:finalize()
+        end
+        contentHashSupported[self] = result
+    end
+    return result
+end
+
 --[[
 Implementation of flexi_data virtual table xUpdate API: insert, update, delete
 ]]
@@ -218,6 +471,22 @@ Implementation of flexi_data virtual table xUpdate API: insert, update, delete
 ---@param queryJSON string
 --- filter to apply - optional, for update and delete
 local function flexi_DataUpdate(self, className, oldRowID, newRowID, dataJSON, queryJSON)
+    -- Pure insert of classless payload is decoded natively
+    if className == nil and oldRowID == nil and newRowID == nil and queryJSON == nil
+            and type(dataJSON) == 'string' and self:isJsonCellsSupported() then
+        local savedActQue = self.ActionQueue == nil and self:setActionQueue() or self.ActionQueue
+        local result, errMsg = pcall(_importCells, self, dataJSON)
+
+        if savedActQue ~= nil then
+            self:setActionQueue(savedActQue)
+        end
+
+        if not result then
+            error(errMsg)
+        end
+        return
+    end
+
     local data = json.decode(dataJSON)
 
     if type(data) ~= 'table' then
@@ -265,10 +534,37 @@ local function flexi_DataUpdate(self, className, oldRowID, newRowID, dataJSON, q
     end
 end
 
--- flexi('import data', 'data-as-json')
+-- flexi('import data', 'data-as-json' [, 'options-as-json'])
+-- options.mode: 'insert' (default) - all objects are created, 'upsert' - objects are matched by UDID
+-- and either created or updated (see SaveObjectHelper:upsertObjects)
 ---@param self DBContext
 ---@param jsonString string
-local function ImportData(self, jsonString)
+---@param options string | nil @comment JSON, e.g. {"mode": "upsert"}
+---@return nil | string @comment for upsert, JSON with number of inserted, updated and unchanged objects
+local function ImportData(self, jsonString, options)
+    local mode = options and json.decode(options).mode or 'insert'
+
+    if mode == 'upsert' then
+        local data = json.decode(jsonString)
+        if type(data) ~= 'table' or #data > 0 then
+            error('Invalid data: object with class names as keys expected')
+        end
+
+        local savedActQue = self.ActionQueue == nil and self:setActionQueue() or self.ActionQueue
+        local ok, result = pcall(_upsertData, self, data, isContentHashSupported(self))
+
+        if savedActQue ~= nil then
+            self:setActionQueue(savedActQue)
+        end
+
+        if not ok then
+            error(result)
+        end
+        return json.encode(result)
+    elseif mode ~= 'insert' then
+        error(string.format('Invalid import mode: %s. Expected insert or upsert', tostring(mode)))
+    end
+
     local result = flexi_DataUpdate(self, nil, nil, nil, jsonString, nil)
     return result
 end
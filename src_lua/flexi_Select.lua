@@ -0,0 +1,328 @@
+--[[
+flexi('select', className, filter, properties, mode, options)
+
+Returns found objects as JSON array (mode = 'json', default) or JSON Lines (mode = 'jsonl').
+Unlike export via DBObject:ExportData, JSON is built by flexi_json_agg aggregate function (see src/misc/json_select.c)
+directly from [.objects] and [.ref-values] rows, so no Lua objects are created for found objects and their values.
+Symbol names, datetime, money, JSON and BLOB values are decoded in C. Enum items are decoded by lookup in
+enum definition, passed as JSON.
+If flexi_json_agg is not registered (e.g. Lua code runs with plain SQLite connection, as in unit tests),
+the same rows are aggregated by JsonAgg in Lua, with the same output.
+
+className - name of class
+filter - Lua filter expression (see QueryBuilder). If empty, all objects of class are returned
+properties - JSON array of property names. If empty, all properties are returned
+options - JSON with limit, offset and orderBy (see DBQueryOptions)
+]]
+
+local json = cjson or require('cjson')
+local class = require 'pl.class'
+local base64 = require 'base64'
+local DBQuery = require('QueryBuilder').DBQuery
+local Constants = require 'Constants'
+local JulianDate = require 'JulianDate'
+local bits = type(jit) == 'table' and require('bit') or require('bit32')
+
+--[[ Lua version of flexi_json_agg aggregate function. Rows are passed to step() in the same order and
+with the same columns as to flexi_json_agg. Blob values cannot be distinguished from text in Lua, so
+they are detected by property map item's b flag ]]
+---@class JsonAgg
+---@field DBContext DBContext
+---@field blobProps table<number, boolean>
+---@field jsonLines boolean
+---@field items string[]
+---@field curOrd number | nil
+---@field curPropID number | nil
+---@field curArray boolean
+---@field propValues number
+local JsonAgg = class()
+
+---@param DBContext DBContext
+---@param blobProps table<number, boolean> @comment IDs of blob properties
+---@param mode string
+function JsonAgg:_init(DBContext, blobProps, mode)
+    self.DBContext = DBContext
+    self.blobProps = blobProps
+    self.jsonLines = string.lower(mode) == 'jsonl'
+    self.items = {}
+    self.objects = 0
+    self.propValues = 0
+end
+
+---@param value number
+---@return string
+local function formatNumber(value)
+    if value == math.floor(value) and math.abs(value) < 2 ^ 53 then
+        return string.format('%d', value)
+    end
+
+    local result = string.format('%.15g', value)
+    if not string.find(result, '[%.eEn]') then
+        result = result .. '.0'
+    end
+    return result
+end
+
+---@param row table
+function JsonAgg:appendValue(row)
+    local value, vtype = row.Value, bits.band(row.ctlv or 0, Constants.CTLV_FLAGS.VTYPE_MASK)
+    if vtype == Constants.vtype.enum and row.EnumText ~= nil then
+        value, vtype = row.EnumText, Constants.vtype.default
+    end
+
+    local result
+    if value == nil then
+        result = 'null'
+    elseif type(value) == 'number' then
+        if vtype == Constants.vtype.symbol then
+            local name = self.DBContext:getNameValueByID(value)
+            result = name and json.encode(name) or formatNumber(value)
+        elseif vtype == Constants.vtype.money then
+            local sign = value < 0 and '-' or ''
+            value = math.abs(value)
+            result = string.format('%s%d.%04d', sign, math.floor(value / 10000), value % 10000)
+        elseif vtype == Constants.vtype.datetime then
+            local dt = JulianDate.julianToDate(value)
+            result = string.format('"%.4d-%.2d-%.2dT%.2d:%.2d:%.2d"', dt.year, dt.month, dt.day,
+                    dt.hour, dt.minute, dt.second)
+        else
+            result = formatNumber(value)
+        end
+    elseif self.blobProps[row.PropertyID] then
+        result = json.encode(base64.encode(value))
+    elseif vtype == Constants.vtype.json then
+        result = value
+    else
+        result = json.encode(value)
+    end
+
+    table.insert(self.items, result)
+end
+
+function JsonAgg:closeProp()
+    if self.curPropID and self.curArray then
+        table.insert(self.items, ']')
+    end
+    self.curPropID = nil
+end
+
+function JsonAgg:closeObject()
+    if self.curOrd then
+        self:closeProp()
+        table.insert(self.items, self.jsonLines and '}\n' or '}')
+    end
+    self.curOrd = nil
+end
+
+---@param row table @comment Ord, ObjectID, PropertyID, Name, IsArray, Value, ctlv, EnumText
+function JsonAgg:step(row)
+    if row.Ord ~= self.curOrd then
+        self:closeObject()
+        if self.objects > 0 and not self.jsonLines then
+            table.insert(self.items, ',')
+        end
+        table.insert(self.items, string.format('{"id":%d', row.ObjectID))
+        self.curOrd = row.Ord
+        self.objects = self.objects + 1
+    end
+
+    -- Object header row
+    if row.PropertyID == nil then
+        return
+    end
+
+    if row.PropertyID ~= self.curPropID then
+        self:closeProp()
+        table.insert(self.items, ',' .. json.encode(row.Name) .. ':')
+        self.curArray = row.IsArray ~= 0
+        if self.curArray then
+            table.insert(self.items, '[')
+        end
+        self.curPropID = row.PropertyID
+        self.propValues = 0
+    elseif not self.curArray then
+        -- Scalar property: only first value is output
+        return
+    end
+
+    if self.propValues > 0 then
+        table.insert(self.items, ',')
+    end
+    self:appendValue(row)
+    self.propValues = self.propValues + 1
+end
+
+---@return string
+function JsonAgg:final()
+    self:closeObject()
+    local result = table.concat(self.items)
+    if self.jsonLines then
+        return result
+    end
+    return '[' .. result .. ']'
+end
+
+-- flexi_json_agg is registered by Flexilite extension
+local jsonAggSupported = setmetatable({}, { __mode = 'k' })
+
+---@param self DBContext
+---@return boolean
+local function isJsonAggSupported(self)
+    local result = jsonAggSupported[self]
+    if result == nil then
+        local stmt = self.db:prepare [[select flexi_json_agg(1, 1, null, null, 0, null, 0, null, 'json');]]
+        result = stmt ~= nil
+        if stmt then
+            stmt:finalize()
+        end
+        jsonAggSupported[self] = result
+    end
+    return result
+end
+
+-- Builds property map for flexi_json_agg: {[PropertyID] = {n = name, a = isArray, e = enum items, b = isBlob}}
+-- Column mapped properties are returned separately, as they are stored in [.objects]
+---@param self DBContext
+---@param classDef ClassDef
+---@param propNames string[] | nil
+---@return table, PropertyDef[]
+local function buildPropMap(self, classDef, propNames)
+    local propDefs = {}
+    if propNames and #propNames > 0 then
+        for _, name in ipairs(propNames) do
+            table.insert(propDefs, classDef:getProperty(name))
+        end
+    else
+        for _, propDef in pairs(classDef.Properties) do
+            table.insert(propDefs, propDef)
+        end
+    end
+
+    local propMap, colMapped = {}, {}
+    for _, propDef in ipairs(propDefs) do
+        self.AccessControl:ensureCurrentUserAccessForProperty(propDef.ID, Constants.OPERATION.READ)
+
+        local item = {
+            n = propDef.Name.text,
+            a = (propDef.D.rules and propDef.D.rules.maxOccurrences or 1) > 1 and 1 or 0,
+        }
+
+        -- Compressed blobs are unpacked as blobs, other compressed values - as text
+        if propDef:getNativeType() == 'blob' then
+            item.b = 1
+        end
+
+        local enumDef = propDef.D.enumDef
+        if enumDef and enumDef.items then
+            item.e = {}
+            for _, v in pairs(enumDef.items) do
+                if v.id then
+                    item.e[tostring(v.id)] = v.text
+                end
+            end
+        end
+
+        if classDef.ColMapActive and propDef.ColMap then
+            item.propDef = propDef
+            table.insert(colMapped, item)
+        else
+            propMap[tostring(propDef.ID)] = item
+        end
+    end
+
+    return propMap, colMapped
+end
+
+---@param self DBContext
+---@param className string
+---@param filter string | nil
+---@param properties string | nil @comment JSON array of property names
+---@param mode string | nil @comment 'json' or 'jsonl'
+---@param options string | nil @comment JSON of DBQueryOptions
+local function flexi_Select(self, className, filter, properties, mode, options)
+    local classDef = self:getClassDef(className, true)
+    self.AccessControl:ensureCurrentUserAccessForClass(classDef.ClassID, Constants.OPERATION.READ)
+
+    if filter == nil or filter == '' then
+        filter = 'true'
+    end
+
+    mode = string.lower(mode or 'json')
+
+    local query = DBQuery(classDef, filter, nil, options and json.decode(options) or nil)
+    local objectIDs = query:GetObjectIDs()
+
+    -- flexi_json_agg cannot know mode when there are no rows
+    if #objectIDs == 0 then
+        return mode == 'jsonl' and '' or '[]'
+    end
+
+    local propMap, colMapped = buildPropMap(self, classDef, properties and json.decode(properties) or nil)
+
+    -- Compressed values can be unpacked only if compression functions are registered.
+    -- Otherwise, there are no compressed values in database
+    local valueExpr = 'v.[Value]'
+    if self:isCompressionSupported() then
+        valueExpr = string.format([[case when v.ctlv & %d <> 0 then flexi_unpack(v.[Value], v.ctlv, json_extract(p.value, '$.b'))
+                else v.[Value] end]], Constants.CTLV_FLAGS.COMPRESSED)
+    end
+
+    -- Object header rows, values from [.ref-values] and values from mapped columns
+    local sql = {
+        [[select o.key as Ord, o.value as ObjectID, null as PropertyID, null as Name, 0 as IsArray,
+            null as Value, 0 as ctlv, null as EnumText, 0 as PropIndex
+            from json_each(:ObjectIDs) o]],
+        string.format([[select o.key, v.ObjectID, v.PropertyID, json_extract(p.value, '$.n'), json_extract(p.value, '$.a'),
+            case when v.ctlv & %d <> 0 then (select vs.[Value] from [.value_store] vs where vs.Hash = v.[Value])
+                else %s end, v.ctlv,
+            case when v.ctlv & 7 = 6 then json_extract(p.value, '$.e."' || v.[Value] || '"') end,
+            v.PropIndex
+            from json_each(:ObjectIDs) o
+            join [.ref-values] v on v.ObjectID = o.value
+            join json_each(:Props) p on v.PropertyID = cast(p.key as integer)]],
+                Constants.CTLV_FLAGS.DEDUP, valueExpr),
+    }
+
+    local params = { ObjectIDs = json.encode(objectIDs), Props = json.encode(propMap), Mode = mode }
+
+    for i, item in ipairs(colMapped) do
+        local propDef = item.propDef
+        local col = string.upper(propDef.ColMap)
+        local colIdx = propDef:ColMapIndex()
+        local enumParam = 'Enum' .. i
+        params[enumParam] = json.encode(item.e or {})
+        table.insert(sql, string.format([[select o.key, o.value, %d, %s, %d, obj.[%s], (obj.vtypes >> %d) & 7,
+            json_extract(:%s, '$."' || obj.[%s] || '"'), 1
+            from json_each(:ObjectIDs) o join [.objects] obj on obj.ObjectID = o.value
+            where obj.[%s] is not null]],
+                propDef.ID, string.format("'%s'", string.gsub(item.n, "'", "''")), item.a, col, colIdx * 3,
+                enumParam, col, col))
+    end
+
+    local rowsSql = string.format([[%s order by Ord, PropertyID, PropIndex]], table.concat(sql, '\nunion all\n'))
+
+    if not isJsonAggSupported(self) then
+        local blobProps = {}
+        for propID, item in pairs(propMap) do
+            blobProps[tonumber(propID)] = item.b == 1
+        end
+        for _, item in ipairs(colMapped) do
+            blobProps[item.propDef.ID] = item.b == 1
+        end
+
+        local agg = JsonAgg(self, blobProps, mode)
+        for row in self:LoadAdhocRows(rowsSql, params) do
+            agg:step(row)
+        end
+        return agg:final()
+    end
+
+    local fullSql = string.format([[select flexi_json_agg(Ord, ObjectID, PropertyID, Name, IsArray, Value, ctlv,
+        EnumText, :Mode) as Result from (%s);]], rowsSql)
+
+    for row in self:LoadAdhocRows(fullSql, params) do
+        return row.Result
+    end
+end
+
+return flexi_Select
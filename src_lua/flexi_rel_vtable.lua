@@ -146,11 +146,11 @@ local function generateView(self, tableName, className, propName, col1Name, col2
         insert into .ref-values select col1, col2, (select max(PropIndex) + 1)... from (select coalesce(col1), coalesce(col2))
         ]]
         sql:append(format(
-                [[insert into [.ref-values] (ObjectID, [Value], PropIndex, PropertyID, ctlv, Metadata)
+                [[insert into [.ref-values] (ObjectID, [Value], PropIndex, PropertyID, ctlv)
             select v.[%s], v.[%s], coalesce((select max(PropIndex) from [.ref-values] where ObjectID = v.[%s]
             and [Value] = v.[%s] and ctlv and %d <> 0), 0) + 1, ]],
                 col1Name, col2Name, col1Name, col2Name, Constants.CTLV_FLAGS.ALL_REFS_MASK))
-        sql:append(format('%d, %d, null ', fromPropDef.ID, fromPropDef.ctlv))
+        sql:append(format('%d, %d ', fromPropDef.ID, fromPropDef.ctlv))
 
         sql:append(' from (select ')
         appendUDIDtoTrigger(sql, fromClassDef, fromUDID, col1Name, 'new')
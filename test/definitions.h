@@ -43,6 +43,14 @@ void run_sql_tests(char *zBaseDir, const char *zJsonFile);
 
 int run_flexi_import_data_tests(sqlite3 *pDB);
 
+int run_json_select_tests(sqlite3 *pDB);
+
+int run_idset_tests(sqlite3 *pDB);
+
+int run_json_cells_tests(sqlite3 *pDB);
+
+int run_value_store_tests(sqlite3 *pDB);
+
 /*
  * prop_tests();
  */
@@ -0,0 +1,212 @@
+// Set of CMocka unit tests for sets of object IDs (src/misc/idset.c) and their use by flexi('select')
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include "definitions.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Temp table with IDs 1..6000, so that sets have single container with more than 4096 items (bitmap)
+ */
+#define IDSET_SEQ_TABLE \
+    "create temp table if not exists IdSetSeq as " \
+    "with recursive s(x) as (select 1 union all select x + 1 from s where x < 6000) select x from s;"
+
+#define IDSET_RANGE(where) "(select flexi_idset(x) from IdSetSeq where " where ")"
+
+static void idset_each(void **state)
+{
+    int result = 0;
+    sqlite3 *pDB = *state;
+    char *zIds = NULL;
+    sqlite3_int64 lValue = -1;
+
+    // IDs in different containers are returned in ascending order, without duplicates
+    CHECK_CALL(run_sql_text(pDB, "select group_concat(value) from flexi_idset_each(flexi_idset_union("
+            "(select flexi_idset(column1) from (values (140000), (1))), "
+            "(select flexi_idset(column1) from (values (70000), (3), (1)))));", &zIds));
+    assert_string_equal(zIds, "1,3,70000,140000");
+
+    // Empty set is returned for no rows
+    CHECK_CALL(run_sql_int64(pDB, "select flexi_idset_count(flexi_idset(ObjectID)) from [.objects] "
+            "where ObjectID < 0;", &lValue));
+    assert_int_equal(lValue, 0);
+
+    goto EXIT;
+
+    ONERROR:
+    assert_false(result);
+
+    EXIT:
+    sqlite3_free(zIds);
+}
+
+static void idset_operations(void **state)
+{
+    int result = 0;
+    sqlite3 *pDB = *state;
+    char *zIds = NULL;
+
+    CHECK_CALL(run_sql(pDB, IDSET_SEQ_TABLE));
+
+    CHECK_CALL(run_sql_text(pDB, "select group_concat(value) from flexi_idset_each(flexi_idset_union("
+            IDSET_RANGE("x <= 2") ", " IDSET_RANGE("x = 5") ", " IDSET_RANGE("x between 2 and 3") "));", &zIds));
+    assert_string_equal(zIds, "1,2,3,5");
+    sqlite3_free(zIds);
+    zIds = NULL;
+
+    CHECK_CALL(run_sql_text(pDB, "select group_concat(value) from flexi_idset_each(flexi_idset_intersect("
+            IDSET_RANGE("x <= 10") ", " IDSET_RANGE("x % 2 = 0") ", " IDSET_RANGE("x > 4") "));", &zIds));
+    assert_string_equal(zIds, "6,8,10");
+    sqlite3_free(zIds);
+    zIds = NULL;
+
+    CHECK_CALL(run_sql_text(pDB, "select group_concat(value) from flexi_idset_each(flexi_idset_except("
+            IDSET_RANGE("x <= 10") ", " IDSET_RANGE("x % 2 = 0") "));", &zIds));
+    assert_string_equal(zIds, "1,3,5,7,9");
+
+    goto EXIT;
+
+    ONERROR:
+    assert_false(result);
+
+    EXIT:
+    sqlite3_free(zIds);
+}
+
+/*
+ * Container with more than 4096 items is stored as bitmap (8 + 4 + 8192 bytes), smaller one - as array
+ * (8 + 4 + 2 bytes per item). Set operations convert containers both ways
+ */
+static void idset_container_conversion(void **state)
+{
+    int result = 0;
+    sqlite3 *pDB = *state;
+    char *zIds = NULL;
+    sqlite3_int64 lValue = 0;
+
+    CHECK_CALL(run_sql(pDB, IDSET_SEQ_TABLE));
+
+    CHECK_CALL(run_sql_int64(pDB, "select length(" IDSET_RANGE("x <= 4000") ");", &lValue));
+    assert_int_equal(lValue, 12 + 4000 * 2);
+
+    CHECK_CALL(run_sql_int64(pDB, "select length(" IDSET_RANGE("x <= 5000") ");", &lValue));
+    assert_int_equal(lValue, 12 + 8192);
+
+    // array + array -> bitmap
+    CHECK_CALL(run_sql_int64(pDB, "select length(s) * 10000 + flexi_idset_count(s) from (select flexi_idset_union("
+            IDSET_RANGE("x <= 3000") ", " IDSET_RANGE("x > 3000") ") as s);", &lValue));
+    assert_int_equal(lValue, (12 + 8192) * 10000 + 6000);
+
+    // bitmap - array -> array
+    CHECK_CALL(run_sql_int64(pDB, "select length(s) * 10000 + flexi_idset_count(s) from (select flexi_idset_except("
+            IDSET_RANGE("x <= 5000") ", " IDSET_RANGE("x <= 1000") ") as s);", &lValue));
+    assert_int_equal(lValue, (12 + 4000 * 2) * 10000 + 4000);
+
+    // bitmap * bitmap -> array
+    CHECK_CALL(run_sql_text(pDB, "select length(s) || ':' || (select group_concat(value) from flexi_idset_each(s)) "
+            "from (select flexi_idset_intersect(" IDSET_RANGE("x <= 5000") ", " IDSET_RANGE("x > 4997") ") as s);",
+                            &zIds));
+    assert_string_equal(zIds, "18:4998,4999,5000");
+
+    goto EXIT;
+
+    ONERROR:
+    assert_false(result);
+
+    EXIT:
+    sqlite3_free(zIds);
+}
+
+/*
+ * Sets flag if statement which reads set of object IDs was run
+ */
+static int idset_trace_callback(unsigned uMask, void *pCtx, void *pStmt, void *pSql)
+{
+    UNUSED_PARAM(uMask);
+    UNUSED_PARAM(pStmt);
+    if (strstr((const char *) pSql, "flexi_idset_each") != NULL)
+        *(int *) pCtx = 1;
+    return 0;
+}
+
+/*
+ * Runs flexi('select') with given filter and returns comma separated list of Rank of found objects.
+ * *pbIdSetUsed is set to 1 if query was resolved by sets of object IDs
+ */
+static int idset_select_ranks(sqlite3 *pDB, const char *zFilter, char **pzRanks, int *pbIdSetUsed)
+{
+    int result;
+    char *zSql = sqlite3_mprintf("select group_concat(json_extract(value, '$.Rank')) from json_each("
+                                         "flexi('select', 'IdSetItems', %Q, '[\"Rank\"]'));", zFilter);
+    *pbIdSetUsed = 0;
+    sqlite3_trace_v2(pDB, SQLITE_TRACE_STMT, idset_trace_callback, pbIdSetUsed);
+    result = run_sql_text(pDB, zSql, pzRanks);
+    sqlite3_trace_v2(pDB, 0, NULL, NULL);
+    sqlite3_free(zSql);
+    return result;
+}
+
+/*
+ * 'or' and 'not' filters of flexi('select') are resolved by sets of object IDs. 'not' over superset of matching
+ * objects falls back to full scan
+ */
+static void idset_select(void **state)
+{
+    int result = 0;
+    sqlite3 *pDB = *state;
+    char *zRanks = NULL;
+    int bIdSetUsed = 0;
+
+    CHECK_CALL(run_sql(pDB, "select flexi('create class', 'IdSetItems', '{\"properties\": {"
+            "\"Code\": {\"rules\": {\"type\": \"text\", \"maxOccurrences\": 1}, \"index\": \"index\"}, "
+            "\"Rank\": {\"rules\": {\"type\": \"integer\", \"maxOccurrences\": 1}}}}');"));
+    CHECK_CALL(run_sql(pDB, "select flexi('import data', '{\"IdSetItems\": [{\"Code\": \"A\", \"Rank\": 1}, "
+            "{\"Code\": \"B\", \"Rank\": 2}, {\"Code\": \"C\", \"Rank\": 3}, {\"Rank\": 4}]}');"));
+
+    CHECK_CALL(idset_select_ranks(pDB, "Code == 'A' or Rank > 2", &zRanks, &bIdSetUsed));
+    assert_string_equal(zRanks, "1,3,4");
+    assert_true(bIdSetUsed);
+    sqlite3_free(zRanks);
+    zRanks = NULL;
+
+    CHECK_CALL(idset_select_ranks(pDB, "not (Code == 'B')", &zRanks, &bIdSetUsed));
+    assert_string_equal(zRanks, "1,3,4");
+    assert_true(bIdSetUsed);
+    sqlite3_free(zRanks);
+    zRanks = NULL;
+
+    // (not B and X) is superset of its matching objects, so 'or' with it cannot be complemented
+    CHECK_CALL(idset_select_ranks(pDB, "not (Code == 'A' or (not (Code == 'B') and Rank % 4 == 0))", &zRanks,
+                                  &bIdSetUsed));
+    assert_string_equal(zRanks, "2,3");
+    assert_false(bIdSetUsed);
+
+    goto EXIT;
+
+    ONERROR:
+    assert_false(result);
+
+    EXIT:
+    sqlite3_free(zRanks);
+}
+
+int run_idset_tests(sqlite3 *pDB)
+{
+    const struct CMUnitTest tests[] = {
+            cmocka_unit_test_state(idset_each, pDB),
+            cmocka_unit_test_state(idset_operations, pDB),
+            cmocka_unit_test_state(idset_container_conversion, pDB),
+            cmocka_unit_test_state(idset_select, pDB),
+    };
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
+
+#ifdef __cplusplus
+}
+#endif
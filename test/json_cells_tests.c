@@ -0,0 +1,154 @@
+// Set of CMocka unit tests for flexi_json_cells table valued function (src/misc/json_cells.c) and import of
+// classless payload by flexi('import data'), which decodes payload by flexi_json_cells
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include "definitions.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+static void json_cells_decode(void **state)
+{
+    int result = 0;
+    sqlite3 *pDB = *state;
+    char *zCells = NULL;
+
+    // Scalar arrays are returned item by item, nested objects - as JSON, items which are not objects - without property
+    CHECK_CALL(run_sql_text(pDB, "select group_concat(ifnull(Class, '') || '|' || ifnull(ObjectIndex, '') || '|' "
+            "|| ifnull(Property, '') || '|' || ifnull(Value, '') || '|' || VType || '|' || InArray, ';') "
+            "from flexi_json_cells('{\"Items\": [{\"Name\": \"Apple\", \"Price\": 1.5, \"Tags\": [\"fruit\", \"red\"], "
+            "\"Note\": null}, {\"Note\": {\"Text\": \"Red\"}, \"Ok\": true}, 5]}');", &zCells));
+    assert_string_equal(zCells, "Items|1|Name|Apple|text|0;Items|1|Price|1.5|real|0;Items|1|Tags|fruit|text|1;"
+            "Items|1|Tags|red|text|1;Items|1|Note||null|0;Items|2|Note|{\"Text\":\"Red\"}|object|0;"
+            "Items|2|Ok|1|true|0;Items|3||5|integer|0");
+
+    goto EXIT;
+
+    ONERROR:
+    assert_false(result);
+
+    EXIT:
+    sqlite3_free(zCells);
+}
+
+/*
+ * Sets flag if statement which decodes payload by flexi_json_cells was run
+ */
+static int json_cells_trace_callback(unsigned uMask, void *pCtx, void *pStmt, void *pSql)
+{
+    UNUSED_PARAM(uMask);
+    UNUSED_PARAM(pStmt);
+    if (strstr((const char *) pSql, "flexi_json_cells") != NULL)
+        *(int *) pCtx = 1;
+    return 0;
+}
+
+/*
+ * Runs flexi('import data') with given payload. *pbCellsUsed is set to 1 if payload was decoded by flexi_json_cells
+ */
+static int json_cells_import(sqlite3 *pDB, const char *zData, int *pbCellsUsed)
+{
+    int result;
+    char *zResult = NULL;
+    char *zSql = sqlite3_mprintf("select flexi('import data', %Q);", zData);
+    *pbCellsUsed = 0;
+    sqlite3_trace_v2(pDB, SQLITE_TRACE_STMT, json_cells_trace_callback, pbCellsUsed);
+    result = run_sql_text(pDB, zSql, &zResult);
+    sqlite3_trace_v2(pDB, 0, NULL, NULL);
+    sqlite3_free(zResult);
+    sqlite3_free(zSql);
+    return result;
+}
+
+static void json_cells_import_data(void **state)
+{
+    int result = 0;
+    sqlite3 *pDB = *state;
+    int bCellsUsed = 0;
+    sqlite3_int64 lValue = 0;
+
+    CHECK_CALL(run_sql(pDB, "select flexi('create class', 'JsonCellsItems', '{\"properties\": {"
+            "\"Name\": {\"rules\": {\"type\": \"text\", \"maxOccurrences\": 1}}, "
+            "\"Price\": {\"rules\": {\"type\": \"number\", \"maxOccurrences\": 1}}, "
+            "\"Tags\": {\"rules\": {\"type\": \"text\", \"maxOccurrences\": 10}}, "
+            "\"Note\": {\"rules\": {\"type\": \"text\", \"maxOccurrences\": 1}}}}');"));
+    CHECK_CALL(run_sql(pDB, "create table if not exists JsonCellsNotes (Title text, Pages integer);"));
+
+    CHECK_CALL(json_cells_import(pDB, "{\"JsonCellsItems\": [{\"Name\": \"Apple\", \"Price\": 1.5, "
+            "\"Tags\": [\"fruit\", \"red\"]}, {\"Name\": \"Pear\", \"Note\": null}, {\"Price\": 2}], "
+            "\"JsonCellsNotes\": [{\"Title\": \"A\", \"Pages\": 10}, {\"Title\": \"B\", \"Pages\": 20}]}", &bCellsUsed));
+    assert_true(bCellsUsed);
+
+    CHECK_CALL(run_sql_int64(pDB, "select json_array_length(flexi('select', 'JsonCellsItems'));", &lValue));
+    assert_int_equal(lValue, 3);
+
+    CHECK_CALL(run_sql_int64(pDB, "select json_extract(s, '$[0].Name') = 'Apple' and json_extract(s, '$[0].Price') = 1.5 "
+            "and json_extract(s, '$[0].Tags') = '[\"fruit\",\"red\"]' and json_extract(s, '$[1].Name') = 'Pear' "
+            "and json_type(s, '$[1].Note') is null and json_extract(s, '$[2].Price') = 2 "
+            "from (select flexi('select', 'JsonCellsItems') as s);", &lValue));
+    assert_int_equal(lValue, 1);
+
+    // Rows of non-Flexilite tables are inserted into these tables
+    CHECK_CALL(run_sql_int64(pDB, "select sum(Pages) from JsonCellsNotes where Title in ('A', 'B');", &lValue));
+    assert_int_equal(lValue, 30);
+
+    goto EXIT;
+
+    ONERROR:
+    assert_false(result);
+
+    EXIT:
+    return;
+}
+
+/*
+ * Invalid payload fails import as a whole, so no objects are saved
+ */
+static void json_cells_import_errors(void **state)
+{
+    int result = 0;
+    sqlite3 *pDB = *state;
+    int bCellsUsed = 0;
+    sqlite3_int64 lCount = 0;
+    sqlite3_int64 lValue = 0;
+
+    CHECK_CALL(run_sql(pDB, "select flexi('create class', 'JsonCellsErrors', '{\"properties\": {"
+            "\"Name\": {\"rules\": {\"type\": \"text\", \"maxOccurrences\": 1}}}}');"));
+    CHECK_CALL(run_sql_int64(pDB, "select count(*) from [.objects];", &lCount));
+
+    assert_int_not_equal(json_cells_import(pDB, "{\"JsonCellsErrors\": [{\"Name\": \"Apple\"}], "
+            "\"JsonCellsUnknown\": [{\"Name\": \"Pear\"}]}", &bCellsUsed), SQLITE_OK);
+    assert_true(bCellsUsed);
+
+    assert_int_not_equal(json_cells_import(pDB, "{\"JsonCellsErrors\": {\"Name\": \"Apple\"}}", &bCellsUsed),
+                         SQLITE_OK);
+
+    CHECK_CALL(run_sql_int64(pDB, "select count(*) from [.objects];", &lValue));
+    assert_int_equal(lValue, lCount);
+
+    goto EXIT;
+
+    ONERROR:
+    assert_false(result);
+
+    EXIT:
+    return;
+}
+
+int run_json_cells_tests(sqlite3 *pDB)
+{
+    const struct CMUnitTest tests[] = {
+            cmocka_unit_test_state(json_cells_decode, pDB),
+            cmocka_unit_test_state(json_cells_import_data, pDB),
+            cmocka_unit_test_state(json_cells_import_errors, pDB),
+    };
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,146 @@
+// Set of CMocka unit tests for flexi_json_agg aggregate function (src/misc/json_select.c)
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include "definitions.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Rows of 2 objects, in the order expected by flexi_json_agg: object 10 with escaped text, NULL, BLOB,
+ * array of references and JSON values, and object 20 without values
+ */
+#define JSON_AGG_ROWS \
+    "select 1 as Ord, 10 as ObjectID, null as PropertyID, null as Name, 0 as IsArray, null as Value, " \
+    "0 as ctlv, null as EnumText, 0 as PropIndex " \
+    "union all select 1, 10, 1, 'Te\"xt', 0, 'a\"b\\c' || char(10) || char(1), 0, null, 0 " \
+    "union all select 1, 10, 2, 'Nothing', 0, null, 0, null, 0 " \
+    "union all select 1, 10, 3, 'Data', 0, x'00ff10', 0, null, 0 " \
+    "union all select 1, 10, 4, 'Refs', 1, 20, 7, null, 0 " \
+    "union all select 1, 10, 4, 'Refs', 1, 21, 7, null, 1 " \
+    "union all select 1, 10, 5, 'Doc', 0, '{\"a\":[1,{\"b\":null}]}', 5, null, 0 " \
+    "union all select 2, 20, null, null, 0, null, 0, null, 0 " \
+    "order by Ord, PropertyID, PropIndex"
+
+#define JSON_AGG_OBJECT_10 \
+    "{\"id\":10,\"Te\\\"xt\":\"a\\\"b\\\\c\\n\\u0001\",\"Nothing\":null,\"Data\":\"AP8Q\"," \
+    "\"Refs\":[20,21],\"Doc\":{\"a\":[1,{\"b\":null}]}}"
+
+static void json_agg_values(void **state)
+{
+    int result = 0;
+    sqlite3 *pDB = *state;
+    char *zJson = NULL;
+
+    CHECK_CALL(run_sql_text(pDB, "select flexi_json_agg(Ord, ObjectID, PropertyID, Name, IsArray, Value, ctlv, "
+            "EnumText, 'json') from (" JSON_AGG_ROWS ");", &zJson));
+    assert_string_equal(zJson, "[" JSON_AGG_OBJECT_10 ",{\"id\":20}]");
+
+    goto EXIT;
+
+    ONERROR:
+    assert_false(result);
+
+    EXIT:
+    sqlite3_free(zJson);
+}
+
+static void json_agg_lines(void **state)
+{
+    int result = 0;
+    sqlite3 *pDB = *state;
+    char *zJson = NULL;
+
+    CHECK_CALL(run_sql_text(pDB, "select flexi_json_agg(Ord, ObjectID, PropertyID, Name, IsArray, Value, ctlv, "
+            "EnumText, 'jsonl') from (" JSON_AGG_ROWS ");", &zJson));
+    assert_string_equal(zJson, JSON_AGG_OBJECT_10 "\n{\"id\":20}\n");
+
+    goto EXIT;
+
+    ONERROR:
+    assert_false(result);
+
+    EXIT:
+    sqlite3_free(zJson);
+}
+
+/*
+ * Only first value of scalar property is output. Enum is output as its text, if supplied
+ */
+static void json_agg_scalar_and_enum(void **state)
+{
+    int result = 0;
+    sqlite3 *pDB = *state;
+    char *zJson = NULL;
+
+    CHECK_CALL(run_sql_text(pDB, "select flexi_json_agg(Ord, ObjectID, PropertyID, Name, IsArray, Value, ctlv, "
+            "EnumText, 'json') from ("
+            "select 1 as Ord, 5 as ObjectID, 1 as PropertyID, 'Color' as Name, 0 as IsArray, 2 as Value, "
+            "6 as ctlv, 'Red' as EnumText, 0 as PropIndex "
+            "union all select 1, 5, 1, 'Color', 0, 3, 6, 'Blue', 1 "
+            "union all select 1, 5, 2, 'Size', 0, 7, 6, null, 0 "
+            "order by Ord, PropertyID, PropIndex);", &zJson));
+    assert_string_equal(zJson, "[{\"id\":5,\"Color\":\"Red\",\"Size\":7}]");
+
+    goto EXIT;
+
+    ONERROR:
+    assert_false(result);
+
+    EXIT:
+    sqlite3_free(zJson);
+}
+
+/*
+ * flexi('select') output is built by flexi_json_agg, so text values stored by import must come back unchanged
+ */
+static void json_select_escaping(void **state)
+{
+    int result = 0;
+    sqlite3 *pDB = *state;
+    sqlite3_int64 lValue = 0;
+
+    CHECK_CALL(run_sql(pDB, "select flexi('create class', 'JsonSelectItems', "
+            "'{\"properties\": {\"Name\": {\"rules\": {\"type\": \"text\", \"maxOccurrences\": 1}}}}');"));
+    CHECK_CALL(run_sql(pDB, "select flexi('import data', "
+            "'{\"JsonSelectItems\": [{\"Name\": \"a\\\"b\\\\c\\n\\t\"}, {\"Name\": null}]}');"));
+
+    CHECK_CALL(run_sql_int64(pDB, "select json_valid(flexi('select', 'JsonSelectItems'));", &lValue));
+    assert_int_equal(lValue, 1);
+
+    CHECK_CALL(run_sql_int64(pDB, "select json_extract(flexi('select', 'JsonSelectItems'), '$[0].Name') = "
+            "'a\"b\\c' || char(10) || char(9);", &lValue));
+    assert_int_equal(lValue, 1);
+
+    // Object without values is output with id only
+    CHECK_CALL(run_sql_int64(pDB, "select json_type(flexi('select', 'JsonSelectItems'), '$[1].Name') is null "
+            "and json_type(flexi('select', 'JsonSelectItems'), '$[1].id') = 'integer';", &lValue));
+    assert_int_equal(lValue, 1);
+
+    goto EXIT;
+
+    ONERROR:
+    assert_false(result);
+
+    EXIT:
+    return;
+}
+
+int run_json_select_tests(sqlite3 *pDB)
+{
+    const struct CMUnitTest tests[] = {
+            cmocka_unit_test_state(json_agg_values, pDB),
+            cmocka_unit_test_state(json_agg_lines, pDB),
+            cmocka_unit_test_state(json_agg_scalar_and_enum, pDB),
+            cmocka_unit_test_state(json_select_escaping, pDB),
+    };
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -74,6 +74,10 @@ int main(int argc, char **argv)
 
     // Run tests, essentially
     run_flexi_import_data_tests(pDB);
+    run_json_select_tests(pDB);
+    run_idset_tests(pDB);
+    run_json_cells_tests(pDB);
+    run_value_store_tests(pDB);
 
     //    run_sql_tests(zDir, "../../test/json/sql-test.class.json");
 
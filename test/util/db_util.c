@@ -145,3 +145,61 @@ int run_sql_from_file(sqlite3 *db, const char *zSQLPath)
     return result;
 }
 
+
+/*
+ * Runs SQL and returns copy of text of the first column of the first row in *pzResult.
+ * *pzResult is set to NULL if there are no rows or value is NULL. Must be freed by sqlite3_free
+ */
+int run_sql_text(sqlite3 *db, const char *zSql, char **pzResult)
+{
+    int result = 0;
+    *pzResult = NULL;
+
+    sqlite3_stmt *pStmt = NULL;
+    CHECK_STMT_PREPARE(db, zSql, &pStmt);
+    CHECK_STMT_STEP(pStmt, db);
+    if (result == SQLITE_ROW && sqlite3_column_type(pStmt, 0) != SQLITE_NULL)
+    {
+        *pzResult = sqlite3_mprintf("%s", sqlite3_column_text(pStmt, 0));
+        CHECK_NULL(*pzResult);
+    }
+    result = SQLITE_OK;
+
+    goto EXIT;
+
+    ONERROR:
+    printf("Error %d, %s\n", sqlite3_errcode(db), sqlite3_errmsg(db));
+
+    EXIT:
+    if (pStmt)
+        sqlite3_finalize(pStmt);
+
+    return result;
+}
+
+/*
+ * Runs SQL and returns integer value of the first column of the first row in *plResult (0 if there are no rows)
+ */
+int run_sql_int64(sqlite3 *db, const char *zSql, sqlite3_int64 *plResult)
+{
+    int result = 0;
+    *plResult = 0;
+
+    sqlite3_stmt *pStmt = NULL;
+    CHECK_STMT_PREPARE(db, zSql, &pStmt);
+    CHECK_STMT_STEP(pStmt, db);
+    if (result == SQLITE_ROW)
+        *plResult = sqlite3_column_int64(pStmt, 0);
+    result = SQLITE_OK;
+
+    goto EXIT;
+
+    ONERROR:
+    printf("Error %d, %s\n", sqlite3_errcode(db), sqlite3_errmsg(db));
+
+    EXIT:
+    if (pStmt)
+        sqlite3_finalize(pStmt);
+
+    return result;
+}
@@ -21,4 +21,8 @@ int run_sql(sqlite3 * db, const char* zSql);
 
 int run_sql_from_file(sqlite3 *db, const char *zSQLPath);
 
+int run_sql_text(sqlite3 *db, const char *zSql, char **pzResult);
+
+int run_sql_int64(sqlite3 *db, const char *zSql, sqlite3_int64 *plResult);
+
 #endif //FLEXILITE_DB_INIT_H
@@ -0,0 +1,230 @@
+// Set of CMocka unit tests for deduplicated values: [.value_store] reference counting by triggers on [.ref-values],
+// search by value hash and removal of unreferenced values by flexi('vacuum')
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include "definitions.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Class with single text property, values of 16 bytes and longer are kept in [.value_store]
+ */
+#define VALUE_STORE_CLASS(name) \
+    "select flexi('create class', '" name "', '{\"properties\": {\"Body\": " \
+    "{\"rules\": {\"type\": \"text\", \"maxOccurrences\": 1}, \"dedup\": 16}}}');"
+
+/*
+ * RefCount of stored value, -1 if value is not in [.value_store]
+ */
+#define VALUE_STORE_REF_COUNT(value) \
+    "select ifnull((select RefCount from [.value_store] where Hash = sha3('" value "')), -1);"
+
+static void value_store_ref_counts(void **state)
+{
+    int result = 0;
+    sqlite3 *pDB = *state;
+    sqlite3_int64 lValue = 0;
+
+#define REF_A "Lorem ipsum dolor sit amet"
+#define REF_B "Consectetur adipiscing elit"
+
+    CHECK_CALL(run_sql(pDB, VALUE_STORE_CLASS("ValueStoreItems")));
+    CHECK_CALL(run_sql(pDB, "select flexi('import data', '{\"ValueStoreItems\": [{\"Body\": \"" REF_A "\"}, "
+            "{\"Body\": \"" REF_A "\"}, {\"Body\": \"" REF_B "\"}, {\"Body\": \"Short\"}]}');"));
+
+    // Long values are replaced by hash, short ones are kept in [.ref-values]
+    CHECK_CALL(run_sql_int64(pDB, "select count(*) from [.ref-values] where ctlv & 8192 "
+            "and [Value] in (sha3('" REF_A "'), sha3('" REF_B "'));", &lValue));
+    assert_int_equal(lValue, 3);
+    CHECK_CALL(run_sql_int64(pDB, "select count(*) from [.ref-values] where [Value] = 'Short' and ctlv & 8192 = 0;",
+                             &lValue));
+    assert_int_equal(lValue, 1);
+    CHECK_CALL(run_sql_int64(pDB, "select [Value] = '" REF_A "' from [.value_store] where Hash = sha3('" REF_A "');",
+                             &lValue));
+    assert_int_equal(lValue, 1);
+
+    CHECK_CALL(run_sql_int64(pDB, VALUE_STORE_REF_COUNT(REF_A), &lValue));
+    assert_int_equal(lValue, 2);
+    CHECK_CALL(run_sql_int64(pDB, VALUE_STORE_REF_COUNT(REF_B), &lValue));
+    assert_int_equal(lValue, 1);
+
+    // Hash changed: old value loses reference, new one gets it
+    CHECK_CALL(run_sql(pDB, "update [.ref-values] set [Value] = sha3('" REF_B "') where [Value] = sha3('" REF_A "') "
+            "and ObjectID = (select min(ObjectID) from [.ref-values] where [Value] = sha3('" REF_A "'));"));
+    CHECK_CALL(run_sql_int64(pDB, VALUE_STORE_REF_COUNT(REF_A), &lValue));
+    assert_int_equal(lValue, 1);
+    CHECK_CALL(run_sql_int64(pDB, VALUE_STORE_REF_COUNT(REF_B), &lValue));
+    assert_int_equal(lValue, 2);
+
+    // Value moved back to [.ref-values]
+    CHECK_CALL(run_sql(pDB, "update [.ref-values] set [Value] = '" REF_B "', ctlv = ctlv & ~8192 "
+            "where [Value] = sha3('" REF_B "') "
+            "and ObjectID = (select max(ObjectID) from [.ref-values] where [Value] = sha3('" REF_B "'));"));
+    CHECK_CALL(run_sql_int64(pDB, VALUE_STORE_REF_COUNT(REF_B), &lValue));
+    assert_int_equal(lValue, 1);
+
+    // Deleted cell, stored value is kept till vacuum
+    CHECK_CALL(run_sql(pDB, "delete from [.ref-values] where [Value] = sha3('" REF_A "');"));
+    CHECK_CALL(run_sql_int64(pDB, VALUE_STORE_REF_COUNT(REF_A), &lValue));
+    assert_int_equal(lValue, 0);
+
+#undef REF_A
+#undef REF_B
+
+    goto EXIT;
+
+    ONERROR:
+    assert_false(result);
+
+    EXIT:
+    return;
+}
+
+/*
+ * Sets flag if statement which searches value by its hash was run
+ */
+static int value_store_trace_callback(unsigned uMask, void *pCtx, void *pStmt, void *pSql)
+{
+    UNUSED_PARAM(uMask);
+    UNUSED_PARAM(pStmt);
+    if (strstr((const char *) pSql, "sha3(") != NULL && strstr((const char *) pSql, "[Value] in (") != NULL)
+        *(int *) pCtx = 1;
+    return 0;
+}
+
+/*
+ * Runs flexi('select') on ValueStoreLookup with given filter and returns comma separated list of Body of found objects.
+ * *pbHashUsed is set to 1 if filter was checked by value hash
+ */
+static int value_store_select(sqlite3 *pDB, const char *zFilter, char **pzBodies, int *pbHashUsed)
+{
+    int result;
+    char *zSql = sqlite3_mprintf("select group_concat(json_extract(value, '$.Body')) from json_each("
+                                         "flexi('select', 'ValueStoreLookup', %Q, '[\"Body\"]'));", zFilter);
+    *pbHashUsed = 0;
+    sqlite3_trace_v2(pDB, SQLITE_TRACE_STMT, value_store_trace_callback, pbHashUsed);
+    result = run_sql_text(pDB, zSql, pzBodies);
+    sqlite3_trace_v2(pDB, 0, NULL, NULL);
+    sqlite3_free(zSql);
+    return result;
+}
+
+/*
+ * Equality filter matches both short values and hashes of stored ones, and stored values are returned as is
+ */
+static void value_store_lookup(void **state)
+{
+    int result = 0;
+    sqlite3 *pDB = *state;
+    char *zBodies = NULL;
+    int bHashUsed = 0;
+
+#define LOOKUP_A "Sed ut perspiciatis unde omnis"
+#define LOOKUP_B "Nemo enim ipsam voluptatem"
+
+    CHECK_CALL(run_sql(pDB, VALUE_STORE_CLASS("ValueStoreLookup")));
+    CHECK_CALL(run_sql(pDB, "select flexi('import data', '{\"ValueStoreLookup\": [{\"Body\": \"" LOOKUP_A "\"}, "
+            "{\"Body\": \"Short\"}, {\"Body\": \"" LOOKUP_B "\"}, {\"Body\": \"" LOOKUP_A "\"}]}');"));
+
+    CHECK_CALL(value_store_select(pDB, "Body == '" LOOKUP_A "'", &zBodies, &bHashUsed));
+    assert_string_equal(zBodies, LOOKUP_A "," LOOKUP_A);
+    assert_true(bHashUsed);
+    sqlite3_free(zBodies);
+    zBodies = NULL;
+
+    CHECK_CALL(value_store_select(pDB, "Body == 'Short'", &zBodies, &bHashUsed));
+    assert_string_equal(zBodies, "Short");
+    assert_true(bHashUsed);
+    sqlite3_free(zBodies);
+    zBodies = NULL;
+
+    // Other comparisons read values from [.value_store]
+    CHECK_CALL(value_store_select(pDB, "Body > 'Sed'", &zBodies, &bHashUsed));
+    assert_string_equal(zBodies, LOOKUP_A ",Short," LOOKUP_A);
+    assert_false(bHashUsed);
+
+#undef LOOKUP_A
+#undef LOOKUP_B
+
+    goto EXIT;
+
+    ONERROR:
+    assert_false(result);
+
+    EXIT:
+    sqlite3_free(zBodies);
+}
+
+/*
+ * flexi('vacuum') recounts references and removes values which are not referenced anymore
+ */
+static void value_store_vacuum(void **state)
+{
+    int result = 0;
+    sqlite3 *pDB = *state;
+    char *zResult = NULL;
+    sqlite3_int64 lValue = 0;
+
+#define VACUUM_KEPT "Ut enim ad minima veniam"
+#define VACUUM_DELETED "Quis autem vel eum iure"
+#define VACUUM_ORPHAN "Neque porro quisquam est"
+
+    CHECK_CALL(run_sql(pDB, VALUE_STORE_CLASS("ValueStoreVacuum")));
+    CHECK_CALL(run_sql(pDB, "select flexi('import data', '{\"ValueStoreVacuum\": [{\"Body\": \"" VACUUM_KEPT "\"}, "
+            "{\"Body\": \"" VACUUM_DELETED "\"}]}');"));
+
+    // Wrong reference counts are fixed by recount
+    CHECK_CALL(run_sql(pDB, "update [.value_store] set RefCount = 7 where Hash = sha3('" VACUUM_KEPT "');"));
+    CHECK_CALL(run_sql(pDB, "delete from [.ref-values] where [Value] = sha3('" VACUUM_DELETED "');"));
+    CHECK_CALL(run_sql(pDB, "insert into [.value_store] (Hash, [Value], RefCount) "
+            "values (sha3('" VACUUM_ORPHAN "'), '" VACUUM_ORPHAN "', 3);"));
+
+    CHECK_CALL(run_sql_text(pDB, "select flexi('vacuum');", &zResult));
+    assert_non_null(strstr(zResult, "unreferenced value(s) removed"));
+
+    CHECK_CALL(run_sql_int64(pDB, VALUE_STORE_REF_COUNT(VACUUM_KEPT), &lValue));
+    assert_int_equal(lValue, 1);
+    CHECK_CALL(run_sql_int64(pDB, VALUE_STORE_REF_COUNT(VACUUM_DELETED), &lValue));
+    assert_int_equal(lValue, -1);
+    CHECK_CALL(run_sql_int64(pDB, VALUE_STORE_REF_COUNT(VACUUM_ORPHAN), &lValue));
+    assert_int_equal(lValue, -1);
+
+    CHECK_CALL(run_sql_int64(pDB, "select count(*) from [.value_store] where RefCount <= 0;", &lValue));
+    assert_int_equal(lValue, 0);
+
+    // Referenced value is still accessible
+    CHECK_CALL(run_sql_int64(pDB, "select json_extract(flexi('select', 'ValueStoreVacuum', null, '[\"Body\"]'), "
+            "'$[0].Body') = '" VACUUM_KEPT "';", &lValue));
+    assert_int_equal(lValue, 1);
+
+#undef VACUUM_KEPT
+#undef VACUUM_DELETED
+#undef VACUUM_ORPHAN
+
+    goto EXIT;
+
+    ONERROR:
+    assert_false(result);
+
+    EXIT:
+    sqlite3_free(zResult);
+}
+
+int run_value_store_tests(sqlite3 *pDB)
+{
+    const struct CMUnitTest tests[] = {
+            cmocka_unit_test_state(value_store_ref_counts, pDB),
+            cmocka_unit_test_state(value_store_lookup, pDB),
+            cmocka_unit_test_state(value_store_vacuum, pDB),
+    };
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,41 @@
+--[[Test compiled access rules]]
+local AccessControl = require 'AccessControl'
+
+describe('access control', function()
+    local ac = AccessControl({})
+
+    local rules = {
+        roles = { reader = 'R', editor = 'RU', guest = 'N' },
+        users = { ['42'] = 'CRUD' }
+    }
+
+    it('should allow all when there are no rules', function()
+        assert.is_true(ac:checkUserPermission({ ID = 1, Roles = { 'reader' } }, nil, 'D'))
+    end)
+
+    it('should combine permissions of all roles', function()
+        assert.is_true(ac:checkUserPermission({ ID = 1, Roles = { 'reader', 'editor' } }, rules, 'U'))
+        assert.is_false(ac:checkUserPermission({ ID = 1, Roles = { 'reader' } }, rules, 'U'))
+    end)
+
+    it('should give priority to denied access', function()
+        assert.is_false(ac:checkUserPermission({ ID = 1, Roles = { 'editor', 'guest' } }, rules, 'R'))
+    end)
+
+    it('should apply user specific permissions', function()
+        assert.is_true(ac:checkUserPermission({ ID = 42, Roles = { 'reader' } }, rules, 'D'))
+    end)
+
+    it('should keep number of cached user permissions bounded', function()
+        local ac2 = AccessControl({})
+        for id = 1, AccessControl.MAX_CACHED_USERS * 3 do
+            ac2:getUserPermissions({ ID = id, Roles = { 'reader' } })
+        end
+        assert.is_true(ac2.UserPermissionsCount <= AccessControl.MAX_CACHED_USERS)
+        local count = 0
+        for _ in pairs(ac2.UserPermissions) do
+            count = count + 1
+        end
+        assert.are.equal(ac2.UserPermissionsCount, count)
+    end)
+end)
@@ -31,6 +31,9 @@ describe('/', function()
     _G.assert = assert
 
     require 'bit52'
+    require 'access_control'
+    require 'object_cache'
+    require 'name_cache'
     require 'bad_class_schema'
     require 'alter_prop'
     require 'classSchema'
@@ -38,4 +41,9 @@ describe('/', function()
     require 'misc'
     require 'object_schema'
     require 'prop_values'
+    require 'transactions'
+    require 'flexi_select'
+    require 'schema_cache'
+    require 'dbquery_test'
+    require 'flexi_data'
 end)
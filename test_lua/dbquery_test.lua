@@ -4,7 +4,9 @@
 --- DateTime: 2018-04-15 10:07 AM
 ---
 
--- todo
+local test_util = require 'test_util'
+local DBQuery = require('QueryBuilder').DBQuery
+local Constants = require 'Constants'
 
 describe('query tests', function()
 
@@ -30,4 +32,93 @@ describe('query tests', function()
     pending('should use range index', function()
 
     end)
+
+    describe('export', function()
+        local customersClassDef = [[{"properties": {
+            "Name": {"rules": {"type": "text", "maxOccurrences": 1}}}}]]
+        local ordersClassDef = [[{"properties": {
+            "Number": {"rules": {"type": "text", "maxOccurrences": 1}},
+            "Customer": {"rules": {"type": "ref", "maxOccurrences": 1}, "refDef": {"classRef": "Customers"}}}}]]
+
+        -- Creates 3 customers and 6 orders, which reference customers
+        ---@return DBContext
+        local function openDatabase()
+            local DBContext = test_util.openFlexiDatabaseInMem()
+            DBContext:ExecAdhocSql([[select flexi('create class', 'Customers', :def);]], { def = customersClassDef })
+            DBContext:ExecAdhocSql([[select flexi('create class', 'Orders', :def);]], { def = ordersClassDef })
+            DBContext:ExecAdhocSql([[select flexi('import data', :data);]], { data = [[{
+                "Customers": [{"Name": "C1"}, {"Name": "C2"}, {"Name": "C3"}],
+                "Orders": [{"Number": "O1"}, {"Number": "O2"}, {"Number": "O3"},
+                    {"Number": "O4"}, {"Number": "O5"}, {"Number": "O6"}]}]] })
+
+            -- Order N references customer (N - 1) % 3 + 1
+            local customerProp = DBContext:getClassDef('Orders'):getProperty('Customer')
+            DBContext:ExecAdhocSql([[insert into [.ref-values] (ObjectID, PropertyID, PropIndex, [Value], ctlv)
+                select o.ObjectID, :PropertyID, 1, c.ObjectID, :ctlv
+                from [.objects] o join [.objects] c
+                on c.ClassID = :CustomersClassID and o.ClassID = :OrdersClassID
+                and (o.ObjectID - (select min(ObjectID) from [.objects] where ClassID = o.ClassID)) % 3 =
+                    c.ObjectID - (select min(ObjectID) from [.objects] where ClassID = c.ClassID);]],
+                    { PropertyID = customerProp.ID,
+                      ctlv = Constants.vtype.reference + Constants.CTLV_FLAGS.REF_STD,
+                      CustomersClassID = DBContext:getClassDef('Customers').ClassID,
+                      OrdersClassID = DBContext:getClassDef('Orders').ClassID })
+            DBContext:flushDataCache()
+            return DBContext
+        end
+
+        -- Exports all orders with customers, and returns exported data and number of statements which
+        -- read [.objects] and [.ref-values]
+        ---@param DBContext DBContext
+        local function exportOrders(DBContext)
+            local qry = DBQuery(DBContext:getClassDef('Orders'), [[1 == 1]])
+            qry:GetObjectIDs()
+
+            local counts = { objects = 0, values = 0 }
+            DBContext.db:trace(function(_, sql)
+                if string.find(sql, 'from [.objects]', 1, true) then
+                    counts.objects = counts.objects + 1
+                end
+                if string.find(sql, 'from [.ref-values]', 1, true) then
+                    counts.values = counts.values + 1
+                end
+            end)
+            local ok, result = pcall(qry.ExportData, qry, { depth = 1 })
+            DBContext.db:trace(nil)
+            DBContext:releasePrefetchedObjects()
+            assert.is_true(ok, result)
+
+            table.sort(result, function(a, b)
+                return a.Number[1] < b.Number[1]
+            end)
+            return result, counts
+        end
+
+        local function assertExported(result)
+            assert.are.equal(6, #result)
+            for i, order in ipairs(result) do
+                assert.are.same({ 'O' .. i }, order.Number)
+                assert.are.same({ { Name = { 'C' .. ((i - 1) % 3 + 1) } } }, order.Customer)
+            end
+        end
+
+        it('should prefetch referenced objects level by level', function()
+            local DBContext = openDatabase()
+            local result, counts = exportOrders(DBContext)
+            assertExported(result)
+
+            -- One scan per level: orders, then customers
+            assert.are.equal(2, counts.objects)
+            assert.are.equal(2, counts.values)
+        end)
+
+        it('should not load prefetched objects again after eviction from cache', function()
+            local DBContext = openDatabase()
+            DBContext.ObjectCache.capacity = 2
+            local result, counts = exportOrders(DBContext)
+            assertExported(result)
+            assert.are.equal(2, counts.objects)
+            assert.are.equal(2, counts.values)
+        end)
+    end)
 end)
\ No newline at end of file
@@ -0,0 +1,275 @@
+--[[ Busted tests for flexi_data virtual table API implemented in Lua (flexi_DataBestIndex and flexi_DataFilter).
+Index info is passed as Lua table, the same way as it is passed from xBestIndex ]]
+
+local test_util = require 'test_util'
+local json = cjson or require 'cjson'
+local flexi_DataBestIndex = require 'flexi_DataBestIndex'
+local flexi_DataFilter = require 'flexi_DataFilter'
+local Constants = require 'Constants'
+
+local OP = Constants.INDEX_CONSTRAINT
+
+describe('flexi_data', function()
+    ---@type DBContext
+    local DBContext = test_util.openFlexiDatabaseInMem()
+
+    local itemsClassDef = [[{"properties": {
+        "Name": {"rules": {"type": "text", "maxOccurrences": 1}},
+        "Price": {"rules": {"type": "number", "maxOccurrences": 1}},
+        "Tags": {"rules": {"type": "text", "maxOccurrences": 10}}
+    }}]]
+
+    local data = [[{"DataItems": [{"Name": "Apple", "Price": 1.5, "Tags": ["fruit", "red"]},
+        {"Name": "Pear", "Price": 2}, {"Price": 3}, {"Name": "Plum", "Tags": ["blue"]}]}]]
+
+    DBContext:ExecAdhocSql([[select flexi('create class', 'DataItems', :def);]], { def = itemsClassDef })
+    DBContext:ExecAdhocSql([[select flexi('import data', :data);]], { data = data })
+
+    -- Column indexes by property name
+    local cols = {}
+    for i, propDef in ipairs(DBContext:getClassDef('DataItems'):getDataColumns()) do
+        cols[propDef.Name.text] = i - 1
+    end
+
+    ---@param names string[]
+    ---@return number
+    local function colMask(names)
+        local result = 0
+        for _, name in ipairs(names) do
+            result = result + 2 ^ cols[name]
+        end
+        return result
+    end
+
+    -- Runs best index and filter, and returns copies of found rows (by column name) and number of executed
+    -- statements which read [.ref-values]
+    ---@param indexInfo table
+    ---@param args any[]
+    local function scan(indexInfo, args)
+        indexInfo = flexi_DataBestIndex(DBContext, 'DataItems', indexInfo)
+
+        local valueScans = 0
+        DBContext.db:trace(function(_, sql)
+            if string.find(sql, 'from [.ref-values]', 1, true) then
+                valueScans = valueScans + 1
+            end
+        end)
+
+        local result = {}
+        local lastRow
+        for objectID, row in flexi_DataFilter(DBContext, 'DataItems', indexInfo.idxNum, indexInfo.idxStr, args) do
+            -- The same row table is reused
+            assert.is_true(lastRow == nil or lastRow == row)
+            lastRow = row
+            local item = { id = objectID }
+            for name, col in pairs(cols) do
+                item[name] = row[col]
+            end
+            table.insert(result, item)
+        end
+        DBContext.db:trace(nil)
+        return result, valueScans, indexInfo
+    end
+
+    -- Returns names of found rows (or '-' for rows without name)
+    ---@param rows table[]
+    ---@return string[]
+    local function names(rows)
+        local result = {}
+        for _, row in ipairs(rows) do
+            table.insert(result, row.Name or '-')
+        end
+        return result
+    end
+
+    -- Runs scan by single constraint on property column and returns names of found rows and index info
+    ---@param propName string
+    ---@param op number
+    ---@param value any
+    local function scanBy(propName, op, value)
+        local rows, _, indexInfo = scan({ aConstraint = { { iColumn = cols[propName], op = op, usable = true } },
+                                          colUsed = colMask { 'Name', 'Price' } }, { value })
+        return names(rows), indexInfo
+    end
+
+    it('should scan all objects with single pass over values', function()
+        local rows, valueScans = scan({ colUsed = colMask { 'Name', 'Price', 'Tags' } })
+        assert.are.equal(4, #rows)
+        assert.are.equal(1, valueScans)
+
+        assert.is_true(rows[1].id < rows[2].id and rows[2].id < rows[3].id and rows[3].id < rows[4].id)
+        assert.are.equal('Apple', rows[1].Name)
+        assert.are.equal(1.5, rows[1].Price)
+        assert.are.same({ 'fruit', 'red' }, json.decode(rows[1].Tags))
+        assert.is_nil(rows[2].Tags)
+        assert.is_nil(rows[3].Name)
+        assert.are.equal(3, rows[3].Price)
+        assert.are.same({ 'blue' }, json.decode(rows[4].Tags))
+    end)
+
+    it('should read only used columns', function()
+        local rows, valueScans = scan({ colUsed = colMask { 'Name' } })
+        assert.are.equal(4, #rows)
+        assert.are.equal(1, valueScans)
+        assert.are.equal('Apple', rows[1].Name)
+        assert.is_nil(rows[1].Price)
+        assert.is_nil(rows[1].Tags)
+
+        -- No property columns used: [.ref-values] is not read at all
+        rows, valueScans = scan({ colUsed = 0 })
+        assert.are.equal(4, #rows)
+        assert.are.equal(0, valueScans)
+        assert.is_nil(rows[1].Name)
+    end)
+
+    it('should push down rowid and object ID list constraints', function()
+        local allRows = scan({ colUsed = colMask { 'Name' } })
+
+        local rows, _, indexInfo = scan({ aConstraint = { { iColumn = -1, op = OP.EQ, usable = true } },
+                                          colUsed = colMask { 'Name' } }, { allRows[2].id })
+        assert.are.same({ 'Pear' }, names(rows))
+        assert.are.same({ argvIndex = 1, omit = true }, indexInfo.aConstraintUsage[1])
+        assert.are.equal(1, indexInfo.idxNum)
+        assert.are.equal(1, indexInfo.estimatedCost)
+
+        -- Hidden column 'ids' follows property columns
+        rows, _, indexInfo = scan({ aConstraint = { { iColumn = 3, op = OP.EQ, usable = true } },
+                                    colUsed = colMask { 'Name' } }, { json.encode { allRows[1].id, allRows[3].id } })
+        assert.are.same({ 'Apple', '-' }, names(rows))
+        assert.is_true(indexInfo.aConstraintUsage[1].omit)
+    end)
+
+    it('should push down comparison constraints on properties', function()
+        local rowNames, indexInfo = scanBy('Price', OP.EQ, 1.5)
+        assert.are.same({ 'Apple' }, rowNames)
+        assert.are.same({ argvIndex = 1, omit = false }, indexInfo.aConstraintUsage[1])
+        assert.is_true(indexInfo.estimatedCost < 1000000)
+
+        assert.are.same({ 'Pear', '-' }, (scanBy('Price', OP.GE, 2)))
+        assert.are.same({ 'Apple' }, (scanBy('Price', OP.LT, 2)))
+        assert.are.same({ 'Apple', 'Plum' }, (scanBy('Name', OP.NE, 'Pear')))
+    end)
+
+    it('should push down LIKE and GLOB constraints', function()
+        assert.are.same({ 'Pear', 'Plum' }, (scanBy('Name', OP.GLOB, 'P*')))
+        assert.are.same({ 'Pear' }, (scanBy('Name', OP.GLOB, 'Pe?r')))
+        assert.are.same({}, (scanBy('Name', OP.GLOB, 'p*')))
+
+        -- LIKE is case insensitive
+        assert.are.same({ 'Pear', 'Plum' }, (scanBy('Name', OP.LIKE, 'p%')))
+        assert.are.same({ 'Apple', 'Pear' }, (scanBy('Name', OP.LIKE, '%e%')))
+    end)
+
+    it('should push down IS NULL and IS NOT NULL constraints', function()
+        assert.are.same({ '-' }, (scanBy('Name', OP.ISNULL, nil)))
+        assert.are.same({ 'Apple', 'Pear', 'Plum' }, (scanBy('Name', OP.ISNOTNULL, nil)))
+        assert.are.same({ 'Pear', '-' }, (scanBy('Tags', OP.ISNULL, nil)))
+    end)
+
+    it('should not use constraints which are not usable', function()
+        local rows, _, indexInfo = scan({ aConstraint = { { iColumn = cols.Name, op = OP.EQ, usable = false },
+                                                          { iColumn = cols.Name, op = OP.MATCH, usable = true } },
+                                          colUsed = colMask { 'Name' } })
+        assert.are.equal(4, #rows)
+        assert.are.equal(0, indexInfo.aConstraintUsage[1].argvIndex)
+        assert.are.equal(0, indexInfo.aConstraintUsage[2].argvIndex)
+        assert.are.equal(0, indexInfo.idxNum)
+        assert.are.equal(1000000, indexInfo.estimatedCost)
+    end)
+
+    it('should use value index for constraints on indexed property', function()
+        DBContext:ExecAdhocSql([[select flexi('create class', 'IndexedItems', :def);]], { def = [[{"properties": {
+            "Code": {"rules": {"type": "text", "maxOccurrences": 1}, "index": "index"}}}]] })
+        DBContext:ExecAdhocSql([[select flexi('import data', :data);]],
+                { data = [[{"IndexedItems": [{"Code": "A"}, {"Code": "B"}, {"Code": "C"}]}]] })
+
+        local indexInfo = flexi_DataBestIndex(DBContext, 'IndexedItems',
+                { aConstraint = { { iColumn = 0, op = OP.EQ, usable = true } }, colUsed = 1 })
+        assert.are.equal(10, indexInfo.estimatedCost)
+
+        local objSql
+        DBContext.db:trace(function(_, sql)
+            if not objSql and string.find(sql, 'from [.objects]', 1, true) then
+                objSql = sql
+            end
+        end)
+        local found = {}
+        for _, row in flexi_DataFilter(DBContext, 'IndexedItems', indexInfo.idxNum, indexInfo.idxStr, { 'B' }) do
+            table.insert(found, row[0])
+        end
+        DBContext.db:trace(nil)
+        assert.are.same({ 'B' }, found)
+
+        local plan = {}
+        for row in DBContext:LoadAdhocRows('explain query plan ' .. objSql) do
+            table.insert(plan, row.detail)
+        end
+        assert.is_truthy(string.find(table.concat(plan, '\n'), 'idxValuesByPropValue', 1, true))
+    end)
+
+    describe('ORDER BY', function()
+        DBContext:ExecAdhocSql([[select flexi('create class', 'SortedItems', :def);]], { def = [[{"properties": {
+            "Code": {"rules": {"type": "text", "maxOccurrences": 1}, "index": "index"},
+            "Rank": {"rules": {"type": "number", "maxOccurrences": 1}, "index": "index"}}}]] })
+        DBContext:ExecAdhocSql([[select flexi('import data', :data);]], { data = [[{"SortedItems": [
+            {"Code": "B", "Rank": 2}, {"Rank": 1}, {"Code": "A", "Rank": 3}, {"Code": "C"}]}]] })
+
+        local sortedCols = {}
+        for i, propDef in ipairs(DBContext:getClassDef('SortedItems'):getDataColumns()) do
+            sortedCols[propDef.Name.text] = i - 1
+        end
+
+        -- Returns codes of found objects (or '-' for objects without code), ranks and index info
+        local function scanSorted(aOrderBy, aConstraint, args)
+            local indexInfo = flexi_DataBestIndex(DBContext, 'SortedItems',
+                    { aOrderBy = aOrderBy, aConstraint = aConstraint or {} })
+            local codes, ranks = {}, {}
+            for _, row in flexi_DataFilter(DBContext, 'SortedItems', indexInfo.idxNum, indexInfo.idxStr, args) do
+                table.insert(codes, row[sortedCols.Code] or '-')
+                table.insert(ranks, row[sortedCols.Rank] or 0)
+            end
+            return codes, ranks, indexInfo
+        end
+
+        it('should return objects in order of indexed property', function()
+            local codes, ranks, indexInfo = scanSorted({ { iColumn = sortedCols.Code, desc = false } })
+            assert.is_true(indexInfo.orderByConsumed)
+            assert.are.same({ '-', 'A', 'B', 'C' }, codes)
+            assert.are.same({ 1, 3, 2, 0 }, ranks)
+
+            codes, ranks, indexInfo = scanSorted({ { iColumn = sortedCols.Code, desc = true } })
+            assert.is_true(indexInfo.orderByConsumed)
+            assert.are.same({ 'C', 'B', 'A', '-' }, codes)
+            assert.are.same({ 0, 2, 3, 1 }, ranks)
+
+            codes = scanSorted({ { iColumn = sortedCols.Rank, desc = false } })
+            assert.are.same({ 'C', '-', 'B', 'A' }, codes)
+        end)
+
+        it('should return objects in order of indexed property with constraints', function()
+            local codes, _, indexInfo = scanSorted({ { iColumn = sortedCols.Code, desc = false } },
+                    { { iColumn = sortedCols.Rank, op = OP.GE, usable = true } }, { 2 })
+            assert.is_true(indexInfo.orderByConsumed)
+            assert.are.same({ 'A', 'B' }, codes)
+        end)
+
+        it('should consume ORDER BY only if rows are returned in its order', function()
+            -- rowid
+            local _, _, indexInfo = scanSorted({ { iColumn = -1, desc = false } })
+            assert.is_true(indexInfo.orderByConsumed)
+            _, _, indexInfo = scanSorted({ { iColumn = -1, desc = true } })
+            assert.is_false(indexInfo.orderByConsumed)
+
+            -- more than one term
+            _, _, indexInfo = scanSorted({ { iColumn = sortedCols.Code, desc = false },
+                                           { iColumn = sortedCols.Rank, desc = false } })
+            assert.is_false(indexInfo.orderByConsumed)
+
+            -- property without index and property with multiple values
+            indexInfo = flexi_DataBestIndex(DBContext, 'DataItems', { aOrderBy = { { iColumn = cols.Name, desc = false } } })
+            assert.is_false(indexInfo.orderByConsumed)
+            indexInfo = flexi_DataBestIndex(DBContext, 'DataItems', { aOrderBy = { { iColumn = cols.Tags, desc = false } } })
+            assert.is_false(indexInfo.orderByConsumed)
+        end)
+    end)
+end)
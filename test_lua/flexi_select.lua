@@ -0,0 +1,94 @@
+--[[ Busted tests for flexi('select'). Tests run with plain SQLite connection, so JSON is built by Lua version of
+flexi_json_agg (see flexi_Select.lua), which follows the same rules as src/misc/json_select.c ]]
+
+local test_util = require 'test_util'
+local json = cjson or require 'cjson'
+
+describe('flexi select', function()
+    ---@type DBContext
+    local DBContext = test_util.openFlexiDatabaseInMem()
+
+    local itemsClassDef = [[{"properties": {
+        "Name": {"rules": {"type": "text", "maxOccurrences": 1}},
+        "Price": {"rules": {"type": "number", "maxOccurrences": 1}},
+        "Tags": {"rules": {"type": "text", "maxOccurrences": 10}},
+        "Color": {"rules": {"type": "enum", "maxOccurrences": 1},
+            "enumDef": {"items": [{"id": 1, "text": "Red"}, {"id": 2, "text": "Green"}]}}
+    }}]]
+
+    local mappedItemsClassDef = [[{"properties": {
+        "Name": {"rules": {"type": "text", "maxOccurrences": 1}},
+        "Price": {"rules": {"type": "number", "maxOccurrences": 1}}
+    }}]]
+
+    local data = [[{"Items": [{"Name": "Apple", "Price": 1.5, "Tags": ["fruit", "red"]}, {"Name": "Pear", "Price": 2}],
+        "MappedItems": [{"Name": "Apple", "Price": 1.5}, {"Name": "Pear", "Price": 2}]}]]
+
+    DBContext:ExecAdhocSql([[select flexi('create class', 'Items', :def);]], { def = itemsClassDef })
+    DBContext:ExecAdhocSql([[select flexi('create class', 'MappedItems', :def);]], { def = mappedItemsClassDef })
+
+    -- Values of MappedItems are kept in [.objects] columns
+    DBContext:ExecAdhocSql([[update [.classes] set ColMapActive = 1
+        where NameID = (select ID from [.sym_names] where [Value] = 'MappedItems');]])
+    DBContext:ExecAdhocSql([[select flexi('close');]])
+    DBContext:ExecAdhocSql([[select flexi('import data', :data);]], { data = data })
+
+    -- Enum value of the first item is set directly, as stored by import of enum properties
+    local itemsClass = DBContext:getClassDef('Items')
+    local appleID = DBContext:loadOneRow([[select min(ObjectID) as ID from [.objects] where ClassID = :ClassID;]],
+            { ClassID = itemsClass.ClassID }).ID
+    DBContext:ExecAdhocSql([[insert into [.ref-values] (ObjectID, PropertyID, PropIndex, [Value], ctlv)
+        values (:ObjectID, :PropertyID, 1, 1, 6);]],
+            { ObjectID = appleID, PropertyID = itemsClass:getProperty('Color').ID })
+
+    ---@return string
+    local function selectJson(className, filter, properties, mode)
+        for row in DBContext:LoadAdhocRows([[select flexi('select', :className, :filter, :properties, :mode,
+            '{"orderBy": ["Name"]}') as Result;]],
+                { className = className, filter = filter, properties = properties, mode = mode }) do
+            return row.Result
+        end
+    end
+
+    it('should return objects as JSON array', function()
+        local result = json.decode(selectJson('Items'))
+        assert.are.equal(2, #result)
+        assert.are.equal(appleID, result[1].id)
+        assert.are.equal('Apple', result[1].Name)
+        assert.are.equal(1.5, result[1].Price)
+        assert.are.same({ 'fruit', 'red' }, result[1].Tags)
+        assert.are.equal('Red', result[1].Color)
+        assert.are.equal('Pear', result[2].Name)
+        assert.are.equal(2, result[2].Price)
+        assert.is_nil(result[2].Tags)
+    end)
+
+    it('should return objects as JSON Lines', function()
+        local lines = {}
+        for line in string.gmatch(selectJson('Items', nil, nil, 'jsonl'), '[^\n]+') do
+            table.insert(lines, json.decode(line))
+        end
+        assert.are.equal(2, #lines)
+        assert.are.equal('Apple', lines[1].Name)
+        assert.are.equal('Pear', lines[2].Name)
+    end)
+
+    it('should return subset of properties', function()
+        local result = json.decode(selectJson('Items', [[Price > 1.6]], '["Name"]'))
+        assert.are.same({ { id = result[1].id, Name = 'Pear' } }, result)
+    end)
+
+    it('should return values of column mapped properties', function()
+        local result = json.decode(selectJson('MappedItems'))
+        assert.are.equal(2, #result)
+        assert.are.equal('Apple', result[1].Name)
+        assert.are.equal(1.5, result[1].Price)
+        assert.are.equal('Pear', result[2].Name)
+    end)
+
+    it('should return empty result', function()
+        assert.are.equal('[]', selectJson('Items', [[1 == 2]]))
+        assert.are.equal('', selectJson('Items', [[1 == 2]], nil, 'jsonl'))
+        assert.are.equal('[]', selectJson('Items', [[Price > 100]]))
+    end)
+end)
@@ -90,4 +90,48 @@ describe('misc tests', function()
         end)
     end)
 
+    describe('canonicalJSON', function()
+
+        it('should produce the same text regardless of key order', function()
+            local a = { Name = 'X', Price = 10, Tags = { 'a', 'b' }, Nested = { z = 1, a = 2 } }
+            local b = { Nested = { a = 2, z = 1 }, Tags = { 'a', 'b' }, Price = 10, Name = 'X' }
+            assert.are.equal(Util.canonicalJSON(a), Util.canonicalJSON(b))
+            assert.are.equal('{"Name":"X","Nested":{"a":2,"z":1},"Price":10,"Tags":["a","b"]}',
+                    Util.canonicalJSON(a))
+        end)
+    end)
+
+    describe('ActionQueue', function()
+
+        it('should run actions in order and collect batch items into single action', function()
+            local DBContext = require('test_util').TestContext():GetNorthwind()
+            local savedQueue = DBContext:setActionQueue()
+            local queue = DBContext.ActionQueue
+            DBContext:setActionQueue(savedQueue)
+
+            local log = {}
+            local function logAction(params)
+                table.insert(log, params)
+            end
+            local function logBatch(items)
+                table.insert(log, table.concat(items, ','))
+            end
+
+            queue:enqueue(logAction, 'a')
+            queue:enqueueBatch('k', logBatch, 1)
+            queue:enqueue(logAction, 'b')
+            queue:enqueueBatch('k', logBatch, 2)
+            queue:enqueue(function()
+                -- batch has been already processed, so new one is started
+                queue:enqueueBatch('k', logBatch, 3)
+            end)
+            assert.are.equal(4, queue:count())
+
+            queue:run()
+            assert.are.same({ 'a', '1,2', 'b', '3' }, log)
+            assert.are.equal(0, queue:count())
+            assert.is_nil(queue:dequeue())
+        end)
+    end)
+
 end)
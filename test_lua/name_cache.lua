@@ -0,0 +1,47 @@
+--[[Test symbol name intern table]]
+local util = require 'test_util'
+local NameCache = require 'NameCache'
+
+describe('name cache', function()
+    ---@type DBContext
+    local DBContext
+
+    setup(function()
+        DBContext = util.openFlexiDatabaseInMem()
+    end)
+
+    teardown(function()
+        DBContext.db:close()
+    end)
+
+    it('should resolve names both ways', function()
+        local id = DBContext:ensureName('NameCacheTest1')
+        assert.are.equal(id, DBContext:ensureName('NameCacheTest1'))
+        assert.are.equal(id, DBContext:getNameID('NameCacheTest1'))
+        assert.are.equal('NameCacheTest1', DBContext:getNameValueByID(id))
+        local row = DBContext:loadOneRow([[select ID from [.sym_names] where [Value] = :v;]], { v = 'NameCacheTest1' })
+        assert.are.equal(id, row.ID)
+    end)
+
+    it('should forget names of rolled back transaction', function()
+        DBContext.db:exec 'begin'
+        local mark = DBContext.NameCache:mark()
+        local id = DBContext:ensureName('NameCacheTest2')
+        DBContext.db:exec 'rollback'
+        DBContext.NameCache:rollback(mark)
+        assert.is_nil(DBContext.NameCache:getID('NameCacheTest2'))
+        assert.is_nil(DBContext:getNameValueByID(id))
+        assert.has_error(function()
+            DBContext:getNameID('NameCacheTest2')
+        end)
+    end)
+
+    it('should preload all names', function()
+        DBContext:ensureName('NameCacheTest3')
+        DBContext.NameCache:commit()
+        local cache = NameCache(DBContext)
+        cache:preload()
+        assert.is_true(cache.preloaded)
+        assert.is_not_nil(cache.byValue['NameCacheTest3'])
+    end)
+end)
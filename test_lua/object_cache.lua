@@ -0,0 +1,43 @@
+--[[Test eviction order of object cache]]
+local ObjectCache = require 'ObjectCache'
+local Constants = require 'Constants'
+
+describe('object cache', function()
+    local function loadObjects(cache, objects, from, to)
+        for id = from, to do
+            if objects[id] then
+                cache:touch(id)
+            else
+                objects[id] = { state = Constants.OPERATION.READ }
+                cache:add(id)
+                cache:evict(objects)
+            end
+        end
+    end
+
+    it('should keep number of objects within capacity', function()
+        local cache, objects = ObjectCache(10), {}
+        loadObjects(cache, objects, 1, 100)
+        assert.are.equal(10, cache:count())
+        assert.is_nil(objects[1])
+        assert.is_not_nil(objects[100])
+        assert.are.equal(90, cache:getStats().evictions)
+    end)
+
+    it('should keep frequently used objects during scan', function()
+        local cache, objects = ObjectCache(10), {}
+        loadObjects(cache, objects, 1, 3)
+        loadObjects(cache, objects, 1, 3)
+        loadObjects(cache, objects, 1000, 2000)
+        assert.is_not_nil(objects[1])
+        assert.is_not_nil(objects[3])
+    end)
+
+    it('should not evict dirty objects', function()
+        local cache, objects = ObjectCache(2), {}
+        loadObjects(cache, objects, 1, 1)
+        objects[1].state = Constants.OPERATION.UPDATE
+        loadObjects(cache, objects, 2, 10)
+        assert.is_not_nil(objects[1])
+    end)
+end)
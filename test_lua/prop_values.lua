@@ -8,6 +8,8 @@
 
 local test_util = require 'test_util'
 local DBQuery = require('QueryBuilder').DBQuery
+local DBValue = require 'DBValue'
+local Constants = require 'Constants'
 
 -- In memory database
 ---@type DBContext
@@ -21,6 +23,11 @@ local test_cases = {
     { query = [[QuantityPerUnit == '24 - 12 oz bottles']], expected_cnt = 4 },
     { query = [[ProductName == 'Camembert Pierrot']], expected_cnt = 1 },
     { query = [[1 == 1]], expected_cnt = 77 },
+    { query = [[1 == 2]], expected_cnt = 0 },
+    { query = [[false]], expected_cnt = 0 },
+    { query = [[ProductName == 'Camembert Pierrot' or QuantityPerUnit == '24 - 12 oz bottles']], expected_cnt = 5 },
+    { query = [[UnitPrice > 11 and UnitPrice < 21.1 and not (QuantityPerUnit == '24 - 12 oz bottles')]], expected_cnt = 25 },
+    { query = [[not (UnitPrice > 11)]], expected_cnt = 14 },
 }
 
 describe('Property Ops/', function()
@@ -40,4 +47,192 @@ describe('Property Ops/', function()
         run_test_case(i)
     end
 
+    it('should stop after limit is reached', function()
+        local qry = DBQuery(productsClassDef, [[UnitPrice > 11]], nil,
+                { limit = 5, offset = 2, orderBy = { { prop = 'UnitPrice', desc = true } } })
+        qry:Run()
+        assert.are.equal(5, #qry.ObjectIDs)
+    end)
+
+    -- Plain SQLite connection has no flexi_idset functions, so sets of object IDs are only built here, not run
+    it('should not complement superset of object IDs', function()
+        local idSetSupported = DBContext.idSetSupported
+        local filter = [[not (ProductName == 'Camembert Pierrot'
+            or (not (QuantityPerUnit == '24 - 12 oz bottles') and UnitPrice % 5 == 4))]]
+        DBContext.idSetSupported = false
+        local expected = #DBQuery(productsClassDef, filter):GetObjectIDs()
+
+        DBContext.idSetSupported = true
+        local ok, err = pcall(function()
+            -- (not B and X) is superset of matching objects, so 'or' with it cannot be negated
+            local qry = DBQuery(productsClassDef, filter)
+            qry:buildSql()
+            assert.are.equal(0, #qry._filterDef.idSets)
+            assert.are.equal(expected, #qry:GetObjectIDs())
+
+            qry = DBQuery(productsClassDef, [[not (ProductName == 'Camembert Pierrot'
+                or not (QuantityPerUnit == '24 - 12 oz bottles'))]])
+            qry:buildSql()
+            assert.are.equal(1, #qry._filterDef.idSets)
+            assert.is_true(qry._filterDef.idSets[1].exact)
+            assert.is_false(qry._filterDef.idSets[1].negated)
+        end)
+        DBContext.idSetSupported = idSetSupported
+        assert.is_true(ok, err)
+    end)
+
+    it('should evaluate constant filter once', function()
+        local options = { limit = 5, offset = 2 }
+        assert.are.equal(0, #DBQuery(productsClassDef, [[1 == 2]], nil, options):GetObjectIDs())
+        assert.are.equal(0, #DBQuery(productsClassDef, [[nil]], nil, options):GetObjectIDs())
+        assert.are.equal(5, #DBQuery(productsClassDef, [[1 == 1]], nil, options):GetObjectIDs())
+    end)
+
+    it('should finalize statement of not completed iteration', function()
+        local qry = DBQuery(productsClassDef, [[UnitPrice > 11]])
+        for _ in qry:Iterate() do
+            break
+        end
+        assert.is_not_nil(next(DBContext.OpenCursors))
+        DBContext:closeCursors()
+        assert.is_nil(next(DBContext.OpenCursors))
+        DBContext:ExecAdhocSql([[select flexi('close');]])
+    end)
+
+    it('should unpack compressed value on first access', function()
+        local calls = 0
+        local ctx = { unpackValue = function(packed)
+            calls = calls + 1
+            return 'unpacked:' .. packed
+        end }
+        local dbv = DBValue.FromRow({ Value = 'abc', ctlv = Constants.CTLV_FLAGS.COMPRESSED }, ctx)
+        assert.are.equal(0, calls)
+        assert.are.equal('unpacked:abc', dbv.Value)
+        assert.are.equal('unpacked:abc', dbv.Value)
+        assert.are.equal(1, calls)
+
+        local dbv2 = DBValue.FromRow({ Value = 'abc', ctlv = Constants.CTLV_FLAGS.COMPRESSED }, ctx)
+        dbv2.Value = nil
+        assert.is_nil(dbv2.Value)
+        assert.are.equal(1, calls)
+
+        assert.are.equal('abc', DBValue.FromRow({ Value = 'abc', ctlv = 0 }, ctx).Value)
+    end)
+
+    it('should load deduplicated value by hash on first access', function()
+        local ctx = { loadStoredValue = function(hash)
+            return 'stored:' .. hash
+        end }
+        local dbv = DBValue.FromRow({ Value = 'hash1', ctlv = Constants.CTLV_FLAGS.DEDUP }, ctx)
+        assert.are.equal('hash1', rawget(dbv, 'packed'))
+        assert.are.equal('stored:hash1', dbv.Value)
+        assert.is_nil(rawget(dbv, 'packed'))
+    end)
+
+    it('should filter objects by row level access rules', function()
+        local params = { flag = Constants.CTLO_FLAGS.HAS_ACCESS_RULES, ClassID = productsClassDef.ClassID }
+        params.ObjectID = DBContext:loadOneRow([[select ObjectID from [.objects] where ClassID = :ClassID
+            order by ObjectID limit 1;]], params).ObjectID
+        params.Subject = 'r:*'
+
+        local function count()
+            local qry = DBQuery(productsClassDef, [[UnitPrice >= 0 or UnitPrice < 0]])
+            qry:Run()
+            return #qry.ObjectIDs
+        end
+
+        local total = count()
+
+        -- Object with access rules, none of which matches the user
+        DBContext:execStatement([[update [.objects] set ctlo = ctlo | :flag where ObjectID = :ObjectID;]], params)
+        assert.are.equal(total - 1, count())
+
+        DBContext:execStatement([[insert into [.object_access] (ObjectID, Subject, Allowed, Denied)
+            values (:ObjectID, :Subject, 31, 0);]], params)
+        assert.are.equal(total, count())
+
+        DBContext:execStatement([[update [.object_access] set Denied = 31
+            where ObjectID = :ObjectID and Subject = :Subject;]], params)
+        assert.are.equal(total - 1, count())
+
+        -- Objects saved with access rules before [.object_access] was introduced get rows on configure
+        DBContext:execStatement([[delete from [.object_access] where ObjectID = :ObjectID;]], params)
+        DBContext:execStatement([[update [.objects] set MetaData = '{"accessRules":{"roles":{"*":"R"}}}'
+            where ObjectID = :ObjectID;]], params)
+        DBContext:ExecAdhocSql([[select flexi('configure');]])
+        assert.are.equal(total, count())
+
+        -- Flag without applicable rules is cleared
+        DBContext:execStatement([[delete from [.object_access] where ObjectID = :ObjectID;]], params)
+        DBContext:execStatement([[update [.objects] set MetaData = null where ObjectID = :ObjectID;]], params)
+        DBContext:ExecAdhocSql([[select flexi('configure');]])
+        assert.are.equal(0, DBContext:loadOneRow([[select ctlo & :flag as flag from [.objects]
+            where ObjectID = :ObjectID;]], params).flag)
+        assert.are.equal(total, count())
+    end)
+
+    it('should export values of sparse collection', function()
+        local propDef = productsClassDef:getProperty('ProductName')
+        local row = DBContext:loadOneRow([[select ObjectID, [Value] from [.ref-values]
+            where PropertyID = :PropertyID and PropIndex = 1 order by ObjectID desc limit 1;]],
+                { PropertyID = propDef.ID })
+        local params = { ObjectID = row.ObjectID, PropertyID = propDef.ID }
+        DBContext:execStatement([[insert into [.ref-values] (ObjectID, PropertyID, PropIndex, [Value], ctlv)
+            select ObjectID, PropertyID, 3, [Value] || ' #3', ctlv from [.ref-values]
+            where ObjectID = :ObjectID and PropertyID = :PropertyID and PropIndex = 1;]], params)
+
+        local data = DBContext:LoadObject(row.ObjectID):ExportData(propDef.ID)
+        DBContext:execStatement([[delete from [.ref-values]
+            where ObjectID = :ObjectID and PropertyID = :PropertyID and PropIndex = 3;]], params)
+
+        assert.are.same({ row.Value, row.Value .. ' #3' }, data.ProductName)
+    end)
+
+    it('should skip writes of unchanged values on update', function()
+        local propDef = productsClassDef:getProperty('ProductName')
+        local params = { PropertyID = propDef.ID }
+        local sql = [[select ObjectID, [Value] from [.ref-values]
+            where PropertyID = :PropertyID and PropIndex = 1 order by ObjectID limit 1;]]
+        local row = DBContext:loadOneRow(sql, params)
+        params.ObjectID = row.ObjectID
+
+        local function update(value)
+            DBContext:flushDataCache()
+            local obj = DBContext:LoadObject(row.ObjectID, nil, true)
+            obj.curVer:setPropValue('ProductName', 1, value)
+            obj:saveToDB()
+        end
+
+        local changes = DBContext.db:total_changes()
+        local skipped = DBContext.WriteStats.skippedWrites
+        update(row.Value)
+        assert.are.equal(changes, DBContext.db:total_changes())
+        assert.is_true(DBContext.WriteStats.skippedWrites > skipped)
+
+        update(row.Value .. ' (new)')
+        assert.is_true(DBContext.db:total_changes() > changes)
+        assert.are.equal(row.Value .. ' (new)', DBContext:loadOneRow(sql, params).Value)
+
+        update(row.Value)
+        assert.are.equal(row.Value, DBContext:loadOneRow(sql, params).Value)
+        DBContext:flushDataCache()
+    end)
+
+    it('should load cell metadata on demand and purge orphaned rows', function()
+        local propDef = productsClassDef:getProperty('ProductName')
+        local objectID = DBContext:loadOneRow([[select ObjectID from [.ref-values]
+            where PropertyID = :PropertyID limit 1;]], { PropertyID = propDef.ID }).ObjectID
+        DBContext:execStatement([[insert into [.cell_metadata] (ObjectID, PropertyID, PropIndex, MetaData)
+            values (:ObjectID, :PropertyID, 1, '{"color":"red"}'), (:ObjectID, :PropertyID, 99, '{}');]],
+                { ObjectID = objectID, PropertyID = propDef.ID })
+
+        local obj = DBContext:LoadObject(objectID)
+        assert.is_nil(obj.origVer.cellMetaDataLoaded)
+        assert.are.equal('red', obj.origVer:getCellMetaData('ProductName').color)
+        assert.is_true(obj.origVer.cellMetaDataLoaded)
+
+        assert.are.equal(1, DBContext:collectCellMetaData())
+        assert.are.equal(1, DBContext:loadOneRow([[select count(*) as cnt from [.cell_metadata]
+            where ObjectID = :ObjectID;]], { ObjectID = objectID }).cnt)
+    end)
 end)
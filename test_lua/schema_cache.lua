@@ -0,0 +1,97 @@
+--[[ Busted tests for upgrade of class schema tables and for reloading of cached class definitions ]]
+
+local test_util = require 'test_util'
+
+local itemsClassDef = [[{"properties": {
+    "Name": {"rules": {"type": "text", "maxOccurrences": 1}},
+    "Tags": {"rules": {"type": "text", "maxOccurrences": 10}}
+}}]]
+
+describe('class schema cache', function()
+
+    it('should upgrade [.class_props] of database created by older version', function()
+        ---@type DBContext
+        local DBContext = test_util.openFlexiDatabaseInMem()
+        DBContext:ExecAdhocSql([[select flexi('create class', 'Items', :def);]], { def = itemsClassDef })
+
+        -- Rebuild [.class_props] without property attribute columns, as it was created by older version
+        assert.are.equal(sqlite3.OK, DBContext.db:exec [[
+            drop view if exists [flexi_prop];
+            create table [.class_props_old] (
+                [ID] INTEGER NOT NULL PRIMARY KEY AUTOINCREMENT,
+                [ClassID] INTEGER NOT NULL,
+                [NameID] INTEGER NOT NULL,
+                [ctlv] INTEGER NOT NULL DEFAULT 0,
+                [ctlvPlan] INTEGER NOT NULL DEFAULT 0,
+                [ColMap] CHAR NULL,
+                Deleted BOOLEAN NOT NULL DEFAULT 0,
+                NonNullCount INTEGER NOT NULL DEFAULT 0,
+                SearchHitCount INTEGER NOT NULL DEFAULT 0);
+            insert into [.class_props_old] select ID, ClassID, NameID, ctlv, ctlvPlan, ColMap, Deleted,
+                NonNullCount, SearchHitCount from [.class_props];
+            drop table [.class_props];
+            alter table [.class_props_old] rename to [.class_props];
+        ]])
+
+        DBContext:ExecAdhocSql([[select flexi('configure');]])
+
+        local props = {}
+        for row in DBContext:LoadAdhocRows([[select [Name], [Type], MaxOccurrences from [.class_props];]]) do
+            props[row.Name] = row
+        end
+        assert.are.equal('text', props.Name.Type)
+        assert.are.equal(1, props.Name.MaxOccurrences)
+        assert.are.equal(10, props.Tags.MaxOccurrences)
+        assert.are.equal(2, DBContext:loadOneRow([[select count(*) as cnt from [flexi_prop];]]).cnt)
+
+        DBContext:flushSchemaCache()
+        assert.is_not_nil(DBContext:getClassDef('Items'):getProperty('Tags'))
+    end)
+
+    it('should reload only changed classes after schema version change', function()
+        ---@type DBContext
+        local DBContext = test_util.openFlexiDatabaseInMem()
+        DBContext:ExecAdhocSql([[select flexi('create class', 'Items', :def);]], { def = itemsClassDef })
+        DBContext:ExecAdhocSql([[select flexi('create class', 'OtherItems', :def);]], { def = itemsClassDef })
+
+        local items = DBContext:getClassDef('Items')
+        local otherItems = DBContext:getClassDef('OtherItems')
+
+        -- Definition of OtherItems is changed, and schema version is bumped, e.g. by other connection
+        DBContext:execStatement([[update [.classes] set Data = Data || ' ' where ClassID = :ClassID;]],
+                { ClassID = otherItems.ClassID })
+        DBContext.db:exec(string.format([[pragma user_version = %d;]], (DBContext.SchemaVersion or 0) + 100))
+
+        DBContext:ExecAdhocSql([[select flexi('ping');]])
+
+        assert.are.equal(items, DBContext:getClassDef('Items'))
+        assert.are_not.equal(otherItems, DBContext:getClassDef('OtherItems'))
+        assert.are.equal(items:getProperty('Tags'), DBContext.ClassProps[items:getProperty('Tags').ID])
+    end)
+
+    it('should reload class after change of its properties', function()
+        ---@type DBContext
+        local DBContext = test_util.openFlexiDatabaseInMem()
+        DBContext:ExecAdhocSql([[select flexi('create class', 'Items', :def);]], { def = itemsClassDef })
+        DBContext:ExecAdhocSql([[select flexi('create class', 'OtherItems', :def);]], { def = itemsClassDef })
+
+        local items = DBContext:getClassDef('Items')
+        local otherItems = DBContext:getClassDef('OtherItems')
+        local version = DBContext:loadOneRow([[select Version from [.classes] where ClassID = :ClassID;]],
+                { ClassID = otherItems.ClassID }).Version
+
+        -- Statistics do not change class version
+        DBContext:execStatement([[update [.class_props] set SearchHitCount = SearchHitCount + 1
+            where ClassID = :ClassID;]], { ClassID = items.ClassID })
+        DBContext:execStatement([[update [.class_props] set ctlvPlan = ctlvPlan + 1 where ClassID = :ClassID;]],
+                { ClassID = otherItems.ClassID })
+        assert.is_true(DBContext:loadOneRow([[select Version from [.classes] where ClassID = :ClassID;]],
+                { ClassID = otherItems.ClassID }).Version > version)
+
+        DBContext.db:exec(string.format([[pragma user_version = %d;]], (DBContext.SchemaVersion or 0) + 100))
+        DBContext:ExecAdhocSql([[select flexi('ping');]])
+
+        assert.are.equal(items, DBContext:getClassDef('Items'))
+        assert.are_not.equal(otherItems, DBContext:getClassDef('OtherItems'))
+    end)
+end)
@@ -0,0 +1,352 @@
+--[[ Busted tests for transaction handling of flexi calls: write lock, group commit, budgets and cross-request cache.
+Tests use database file, so that second connection can be opened to the same database ]]
+
+local test_util = require 'test_util'
+local json = cjson or require 'cjson'
+
+-- Runs single row SQL and returns value of first column. Raises error if statement fails
+---@param db userdata @comment sqlite3
+---@param sql string
+local function exec(db, sql)
+    local stmt = assert(db:prepare(sql), db:errmsg())
+    local rc = stmt:step()
+    local result = rc == sqlite3.ROW and stmt:get_value(0) or nil
+    local errMsg = db:errmsg()
+    stmt:finalize()
+    if rc ~= sqlite3.ROW and rc ~= sqlite3.DONE then
+        error(errMsg)
+    end
+    return result
+end
+
+local itemsClassDef = [[{"properties": {"Name": {"rules": {"type": "text", "maxOccurences": 1}}}}]]
+
+-- Opens Flexilite database in temporary file with class Items, and second plain connection to the same database
+---@param options string | nil @comment config JSON
+---@return DBContext, userdata, string
+local function openDatabases(options)
+    local fileName = os.tmpname()
+    local DBContext = test_util.openFlexiDatabase(fileName)
+    exec(DBContext.db, string.format([[select flexi('configure', '%s');]],
+            options or [[{"busyTimeout": 10, "busyRetries": 1}]]))
+    exec(DBContext.db, string.format([[select flexi('create class', 'Items', '%s');]], itemsClassDef))
+    local other = sqlite3.open(fileName)
+    return DBContext, other, fileName
+end
+
+---@param DBContext DBContext
+---@param other userdata
+---@param fileName string
+local function closeDatabases(DBContext, other, fileName)
+    other:close()
+    DBContext:close()
+    DBContext.db:close()
+    os.remove(fileName)
+end
+
+---@param db userdata
+---@return number
+local function countObjects(db)
+    return exec(db, [[select count(*) from [.objects];]])
+end
+
+describe('transactions', function()
+
+    it('should not take write lock for read-only action', function()
+        local DBContext, other, fileName = openDatabases()
+
+        -- Other connection holds write lock
+        assert.are.equal(sqlite3.OK, other:exec 'begin immediate')
+
+        assert.is_not_nil(exec(DBContext.db, [[select flexi('select', 'Items');]]))
+        assert.are.equal(0, DBContext.ActionStats['select'].busyRetries)
+
+        -- Write action needs write lock and fails after retries
+        assert.has_error(function()
+            exec(DBContext.db, [[select flexi('import data', '{"Items": [{"Name": "A"}]}');]])
+        end)
+        assert.are.equal(1, DBContext.ActionStats['import data'].busyFailures)
+
+        other:exec 'rollback'
+        closeDatabases(DBContext, other, fileName)
+    end)
+
+    it('should run read-only action in deferred transaction', function()
+        local DBContext, other, fileName = openDatabases()
+
+        local statements = {}
+        DBContext.db:trace(function(_, sql)
+            table.insert(statements, sql)
+        end)
+        exec(DBContext.db, [[select flexi('select', 'Items');]])
+        DBContext.db:trace(nil)
+
+        assert.are.equal('begin', statements[2])
+        assert.are.equal('commit', statements[#statements])
+
+        closeDatabases(DBContext, other, fileName)
+    end)
+
+    it('should restore busy timeout of connection', function()
+        local DBContext, other, fileName = openDatabases()
+        DBContext.db:busy_timeout(1234)
+
+        exec(DBContext.db, [[select flexi('import data', '{"Items": [{"Name": "A"}]}');]])
+        assert.are.equal(1234, exec(DBContext.db, [[pragma busy_timeout;]]))
+
+        -- Write lock is not obtained after retries
+        assert.are.equal(sqlite3.OK, other:exec 'begin immediate')
+        assert.has_error(function()
+            exec(DBContext.db, [[select flexi('import data', '{"Items": [{"Name": "B"}]}');]])
+        end)
+        other:exec 'rollback'
+        assert.are.equal(1234, exec(DBContext.db, [[pragma busy_timeout;]]))
+
+        closeDatabases(DBContext, other, fileName)
+    end)
+
+    it('should roll back call which exceeded its budget', function()
+        local DBContext, other, fileName = openDatabases()
+        local initial = countObjects(other)
+
+        local items = {}
+        for i = 1, 1000 do
+            items[i] = { Name = 'Item ' .. i }
+        end
+        local data = json.encode({ Items = items })
+
+        local ok, errMsg = pcall(exec, DBContext.db,
+                string.format([[select flexi('budget', '{"time": 1}', 'import data', '%s');]], data))
+        assert.is_false(ok)
+        assert.is_truthy(string.find(errMsg, 'Budget exceeded: time', 1, true))
+        assert.are.equal(1, DBContext.ActionStats['import data'].budgetExceeded)
+        assert.are.equal(initial, countObjects(DBContext.db))
+        assert.are.equal(initial, countObjects(other))
+
+        -- The same call without budget succeeds
+        exec(DBContext.db, string.format([[select flexi('import data', '%s');]], data))
+        assert.are.equal(initial + 1000, countObjects(other))
+
+        closeDatabases(DBContext, other, fileName)
+    end)
+
+    it('should interrupt running statement when time budget is exceeded', function()
+        local DBContext, other, fileName = openDatabases()
+        DBContext.config.budgetCheckSteps = 1000
+
+        DBContext:startBudget({ time = 1 })
+        local ok, errMsg = pcall(DBContext.loadOneRow, DBContext, [[with recursive r(n) as
+            (select 1 union all select n + 1 from r where n < 100000000) select count(*) as cnt from r;]])
+        assert.is_false(ok)
+        assert.is_truthy(string.find(tostring(errMsg), 'interrupt', 1, true))
+        assert.are.equal('time', DBContext.Budget.exceeded)
+
+        -- Interrupted statement is reported as exceeded budget
+        local _, budgetError = pcall(DBContext.checkBudget, DBContext)
+        assert.is_truthy(string.find(tostring(budgetError), 'Budget exceeded: time (limit 1)', 1, true))
+        DBContext:stopBudget()
+
+        -- Progress handler is removed with budget
+        assert.are.equal(100000, DBContext:loadOneRow([[with recursive r(n) as
+            (select 1 union all select n + 1 from r where n < 100000) select count(*) as cnt from r;]]).cnt)
+
+        closeDatabases(DBContext, other, fileName)
+    end)
+
+    it('should fail call which exceeded its rows budget', function()
+        local DBContext, other, fileName = openDatabases()
+        exec(DBContext.db, [[select flexi('import data', '{"Items": [{"Name": "A"}, {"Name": "B"}, {"Name": "C"}]}');]])
+
+        local ok, errMsg = pcall(exec, DBContext.db, [[select flexi('budget', '{"rows": 2}', 'select', 'Items');]])
+        assert.is_false(ok)
+        assert.is_truthy(string.find(errMsg, 'Budget exceeded: rows', 1, true))
+        assert.are.equal(1, DBContext.ActionStats['select'].budgetExceeded)
+
+        -- Budget is applied to single call only
+        assert.is_not_nil(exec(DBContext.db, [[select flexi('select', 'Items');]]))
+        assert.is_not_nil(exec(DBContext.db, [[select flexi('budget', '{"rows": 3}', 'select', 'Items');]]))
+
+        closeDatabases(DBContext, other, fileName)
+    end)
+
+    it('should stop loading objects when objects budget is exceeded', function()
+        local DBContext, other, fileName = openDatabases()
+        exec(DBContext.db, [[select flexi('import data', '{"Items": [{"Name": "A"}, {"Name": "B"}, {"Name": "C"}]}');]])
+        local ids = {}
+        for id in DBContext.db:urows [[select ObjectID from [.objects] order by ObjectID desc limit 3;]] do
+            table.insert(ids, id)
+        end
+
+        DBContext:startBudget({ objects = 2 })
+        DBContext:LoadObject(ids[1])
+        DBContext:LoadObject(ids[2])
+        -- Object from cache is not counted
+        DBContext:LoadObject(ids[1])
+        local ok, errMsg = pcall(DBContext.LoadObject, DBContext, ids[3])
+        assert.is_false(ok)
+        assert.is_truthy(string.find(tostring(errMsg), 'Budget exceeded: objects (limit 2)', 1, true))
+        assert.are.equal('objects', DBContext.Budget.exceeded)
+        DBContext:stopBudget()
+        DBContext:flushDataCache()
+
+        closeDatabases(DBContext, other, fileName)
+    end)
+
+    it('should drop cross-request cache when other connection writes', function()
+        local DBContext, other, fileName = openDatabases([[{"crossRequestCache": true}]])
+        exec(DBContext.db, [[select flexi('import data', '{"Items": [{"Name": "A"}]}');]])
+        local id = exec(other, [[select max(ObjectID) from [.objects];]])
+
+        DBContext:LoadObject(id)
+        exec(DBContext.db, [[select flexi('select', 'Items');]])
+        assert.is_not_nil(DBContext.Objects[id])
+
+        -- Read-only call by the same connection keeps cache
+        exec(DBContext.db, [[select flexi('select', 'Items');]])
+        assert.is_not_nil(DBContext.Objects[id])
+
+        assert.are.equal(sqlite3.OK, other:exec(string.format(
+                [[update [.ref-values] set [Value] = 'B' where ObjectID = %d;]], id)))
+        local result = exec(DBContext.db, [[select flexi('select', 'Items');]])
+        assert.is_nil(DBContext.Objects[id])
+        assert.is_truthy(string.find(result, '"B"', 1, true))
+
+        closeDatabases(DBContext, other, fileName)
+    end)
+
+    describe('group commit', function()
+        local importItem = [[select flexi('import data', '{"Items": [{"Name": "A"}]}');]]
+
+        -- Opens databases in WAL mode with group commit on, and returns list of SQL statements traced on flexi connection
+        local function openGroupDatabases(maxBatch, maxDelay)
+            local DBContext, other, fileName = openDatabases()
+            exec(DBContext.db, [[pragma journal_mode = wal;]])
+            exec(DBContext.db, [[pragma synchronous = FULL;]])
+            exec(DBContext.db, string.format(
+                    [[select flexi('configure', '{"groupCommit": true, "groupCommitMaxBatch": %d, "groupCommitMaxDelay": %d}');]],
+                    maxBatch, maxDelay))
+            exec(DBContext.db, [[select flexi('commit');]])
+
+            local statements = {}
+            DBContext.db:trace(function(_, sql)
+                table.insert(statements, sql)
+            end)
+            return DBContext, other, fileName, statements
+        end
+
+        ---@param statements string[]
+        ---@param sql string
+        local function countStatements(statements, sql)
+            local result = 0
+            for _, s in ipairs(statements) do
+                if s == sql then
+                    result = result + 1
+                end
+            end
+            return result
+        end
+
+        local function pending(DBContext)
+            return json.decode(exec(DBContext.db, [[select flexi('stats');]])).groupCommit.pending
+        end
+
+        it('should commit every action and not hold lock between calls', function()
+            local DBContext, other, fileName, statements = openGroupDatabases(100, 60000)
+            local initial = countObjects(other)
+
+            exec(DBContext.db, importItem)
+            assert.are.equal(initial + 1, countObjects(other))
+            assert.are.equal(sqlite3.OK, other:exec 'begin immediate')
+            other:exec 'rollback'
+
+            -- Commit was not synced, synchronous level of connection is restored
+            assert.are.equal(1, countStatements(statements, 'pragma synchronous = NORMAL;'))
+            assert.are.equal(2, exec(DBContext.db, [[pragma synchronous;]]))
+            assert.are.equal(1, pending(DBContext))
+
+            -- flexi('commit') syncs group
+            assert.are.equal('1 action(s) committed', exec(DBContext.db, [[select flexi('commit');]]))
+            assert.are.equal(0, pending(DBContext))
+            assert.are.equal('0 action(s) committed', exec(DBContext.db, [[select flexi('commit');]]))
+
+            DBContext.db:trace(nil)
+            closeDatabases(DBContext, other, fileName)
+        end)
+
+        it('should close group on entry when it has reached its limits', function()
+            local DBContext, other, fileName, statements = openGroupDatabases(2, 60000)
+            local initial = countObjects(other)
+
+            exec(DBContext.db, importItem)
+            exec(DBContext.db, importItem)
+            assert.are.equal(2, pending(DBContext))
+            assert.are.equal(2, countStatements(statements, 'pragma synchronous = NORMAL;'))
+
+            -- Third action closes group: it runs with synchronous level of connection
+            exec(DBContext.db, importItem)
+            assert.are.equal(2, countStatements(statements, 'pragma synchronous = NORMAL;'))
+            assert.are.equal(0, pending(DBContext))
+            assert.are.equal(initial + 3, countObjects(other))
+
+            -- Group older than groupCommitMaxDelay is closed by next action
+            exec(DBContext.db, importItem)
+            assert.are.equal(1, pending(DBContext))
+            exec(DBContext.db, [[select flexi('configure', '{"groupCommitMaxDelay": 0}');]])
+            exec(DBContext.db, importItem)
+            assert.are.equal(0, pending(DBContext))
+
+            DBContext.db:trace(nil)
+            closeDatabases(DBContext, other, fileName)
+        end)
+
+        it('should report failed commit only to its caller', function()
+            local DBContext, other, fileName = openGroupDatabases(2, 60000)
+            local initial = countObjects(other)
+
+            local failCommit = false
+            DBContext.db:commit_hook(function()
+                return failCommit
+            end)
+
+            exec(DBContext.db, importItem)
+            failCommit = true
+            assert.has_error(function()
+                exec(DBContext.db, importItem)
+            end)
+            failCommit = false
+
+            -- First action stays committed
+            assert.are.equal(initial + 1, countObjects(other))
+            assert.are.equal(1, pending(DBContext))
+
+            -- Failed closing action keeps group open
+            exec(DBContext.db, importItem)
+            assert.are.equal(2, pending(DBContext))
+            failCommit = true
+            assert.has_error(function()
+                exec(DBContext.db, importItem)
+            end)
+            failCommit = false
+            local stats = json.decode(exec(DBContext.db, [[select flexi('stats');]]))
+            assert.are.equal(1, stats.groupCommit.failures)
+            assert.are.equal(2, stats.groupCommit.pending)
+
+            exec(DBContext.db, importItem)
+            assert.are.equal(0, pending(DBContext))
+            assert.are.equal(initial + 3, countObjects(other))
+
+            DBContext.db:commit_hook(nil)
+            closeDatabases(DBContext, other, fileName)
+        end)
+
+        it('should not group commits without WAL', function()
+            local DBContext, other, fileName = openDatabases(
+                    [[{"groupCommit": true, "groupCommitMaxBatch": 100, "groupCommitMaxDelay": 60000}]])
+
+            exec(DBContext.db, importItem)
+            assert.are.equal(0, pending(DBContext))
+
+            closeDatabases(DBContext, other, fileName)
+        end)
+    end)
+end)